@@ -63,4 +63,9 @@ enum redis_field_index {
 // Redis field labels
 extern const char *redis_field_labels[MAX_REDIS_FIELDS];
 
+// Query field selecting the semantics of the query time range: 0 for jobs
+// which started and ended within it, 1 for jobs which ran at any time
+// during it
+#define REDIS_QUERY_OVERLAP "_ovl"
+
 #endif /* REDIS_FIELDS_H */
@@ -30,25 +30,30 @@
 #include "sscan_cursor.h"
 
 #include <assert.h>
-
-#include "common/stringto.h"
+#include <string.h>
 
 /*
- * The sscan_cursor object
+ * The sscan_cursor object.  Elements are read off the set key a batch of
+ * about count at a time into a buffer of nul-terminated copies, which the
+ * cursor hands out one at a time
  */
 typedef struct sscan_cursor {
     RedisModuleCtx *ctx;
-    RedisModuleCallReply *reply;
-    RedisModuleCallReply *subreply_array;
+    RedisModuleScanCursor *scan;
     const RedisModuleString *set;
     RedisModuleString *err;
     long long count;
-    long long value;
+    int done;
+    char *buf;
+    size_t buf_len;
+    size_t buf_sz;
+    size_t *offs;
+    size_t offs_sz;
     size_t array_ix;
     size_t array_sz;
 } *sscan_cursor_t;
 
-static void call_sscan_internal(sscan_cursor_t cursor);
+static void scan_internal(sscan_cursor_t cursor);
 
 /*
  * Create an sscan_cursor object
@@ -64,7 +69,7 @@ sscan_cursor_t create_sscan_cursor(const sscan_cursor_init_t *init)
     cursor->ctx = init->ctx;
     cursor->set = init->set;
     cursor->count = init->count;
-    cursor->value = -1;
+    cursor->scan = RedisModule_ScanCursorCreate();
     return cursor;
 }
 
@@ -73,19 +78,16 @@ sscan_cursor_t create_sscan_cursor(const sscan_cursor_init_t *init)
  */
 void destroy_sscan_cursor(sscan_cursor_t *cursor)
 {
-    if (!cursor) {
+    if (!cursor || !*cursor) {
         return;
     }
-    if ((*cursor)->reply) {
-        // This recursively frees the subreplies too
-        RedisModule_FreeCallReply((*cursor)->reply);
-        (*cursor)->reply = NULL;
-        (*cursor)->subreply_array = NULL;
-    }
     if ((*cursor)->err) {
         RedisModule_FreeString((*cursor)->ctx, (*cursor)->err);
         (*cursor)->err = NULL;
     }
+    RedisModule_ScanCursorDestroy((*cursor)->scan);
+    RedisModule_Free((*cursor)->buf);
+    RedisModule_Free((*cursor)->offs);
     RedisModule_Free(*cursor);
     *cursor = NULL;
 }
@@ -106,13 +108,13 @@ int sscan_error(sscan_cursor_t cursor, const char **err, size_t *len)
 }
 
 /*
- * Fetch the next element from the sscan cursor.  We are hiding the necessary
- * repeated calls to SSCAN.  In order to complete a full iteration with SSCAN,
- * it is required that we keep calling SSCAN until the cursor value on reply[0]
- * is zero.  We read the array on reply[1] one at a time with each call to this
- * api, then we issue another SSCAN and repeat until all set members are read
+ * Fetch the next element from the sscan cursor, in place: the element is
+ * nul-terminated and valid until the next call.  We are hiding the
+ * repeated scans of the set key, which is opened for each batch of
+ * elements only, so the cursor may be kept across calls into the module
+ * like the cursor of SSCAN
  */
-int sscan_next_element(sscan_cursor_t cursor, RedisModuleString **str)
+int sscan_next_buffer(sscan_cursor_t cursor, const char **ptr, size_t *len)
 {
     assert(cursor != NULL);
     assert(cursor->ctx != NULL);
@@ -122,99 +124,101 @@ int sscan_next_element(sscan_cursor_t cursor, RedisModuleString **str)
         cursor->err = NULL;
     }
 
-    // Initial SSCAN requires a cursor value of zero
-    if (cursor->value == -1) {
-        cursor->value = 0;
-        call_sscan_internal(cursor);
-    }
-
-    // Do we need to issue another SSCAN?
-    while (cursor->value != 0 &&
-            ((cursor->subreply_array == NULL) ||
-             (cursor->array_ix >= cursor->array_sz))) {
-        call_sscan_internal(cursor);
+    // Scan for another batch of elements once the buffer is consumed
+    if ((cursor->array_ix >= cursor->array_sz) && !cursor->done) {
+        scan_internal(cursor);
         if (cursor->err) {
             return SSCAN_ERR;
         }
     }
 
     // Are we done?
-    if (cursor->value == 0 &&
-        ((cursor->subreply_array == NULL) ||
-         (cursor->array_ix >= cursor->array_sz))) {
+    if (cursor->array_ix >= cursor->array_sz) {
         return SSCAN_EOF;
     }
 
-    // If we have an array on the sub-reply, consume it one at a time
-    if (cursor->subreply_array &&
-        (cursor->array_ix < cursor->array_sz)) {
-        RedisModuleCallReply *subreply_element =
-            RedisModule_CallReplyArrayElement(cursor->subreply_array,
-                cursor->array_ix);
-        if (subreply_element && str) {
-            *str = RedisModule_CreateStringFromCallReply(subreply_element);
-        }
-        ++cursor->array_ix;
+    size_t off = cursor->offs[cursor->array_ix];
+    size_t end = (cursor->array_ix + 1 < cursor->array_sz) ?
+        cursor->offs[cursor->array_ix + 1] : cursor->buf_len;
+    if (ptr) {
+        *ptr = cursor->buf + off;
+    }
+    if (len) {
+        *len = end - off - 1;
     }
+    ++cursor->array_ix;
     return SSCAN_OK;
 }
 
 /*
- * Helper function to issue the SSCAN command and load the returned cursor
- * value and array for reading by sscan_next_element
+ * Fetch a copy of the next element from the sscan cursor
  */
-static void call_sscan_internal(sscan_cursor_t cursor)
+int sscan_next_element(sscan_cursor_t cursor, RedisModuleString **str)
 {
-    assert(cursor != NULL);
-
-    if (cursor->reply) {
-        // This recursively frees the subreplies too
-        RedisModule_FreeCallReply(cursor->reply);
-        cursor->reply = NULL;
-        cursor->subreply_array = NULL;
-    }
-    cursor->array_ix = 0;
-    cursor->array_sz = 0;
-
-    // Call SSCAN
-    cursor->reply = RedisModule_Call(cursor->ctx, "SSCAN", "slcl", cursor->set,
-        cursor->value, "COUNT", cursor->count);
-
-    if ((RedisModule_CallReplyType(cursor->reply) != REDISMODULE_REPLY_ARRAY) ||
-        (RedisModule_CallReplyLength(cursor->reply) != 2)) {
-        cursor->err = RedisModule_CreateStringPrintf(cursor->ctx,
-            REDISMODULE_ERRORMSG_WRONGTYPE);
-        return;
+    const char *ptr;
+    size_t len;
+    int rc = sscan_next_buffer(cursor, &ptr, &len);
+    if ((rc == SSCAN_OK) && str) {
+        *str = RedisModule_CreateString(cursor->ctx, ptr, len);
     }
+    return rc;
+}
 
-    // Fetch the cursor value on the first element; zero means last iteration
-    RedisModuleCallReply *subreply_cursor = RedisModule_CallReplyArrayElement(
-        cursor->reply, 0);
-    if ((RedisModule_CallReplyType(subreply_cursor)
-        != REDISMODULE_REPLY_STRING)) {
-        cursor->err = RedisModule_CreateStringPrintf(cursor->ctx,
-            REDISMODULE_ERRORMSG_WRONGTYPE);
-        return;
+/*
+ * Helper function which appends an element seen by the scan of the set key
+ * to the buffer of the cursor
+ */
+static void scan_element(RedisModuleKey *key, RedisModuleString *field,
+    RedisModuleString *value, void *privdata)
+{
+    (void)key;
+    (void)value;
+    sscan_cursor_t cursor = privdata;
+    size_t len;
+    const char *str = RedisModule_StringPtrLen(field, &len);
+
+    if (cursor->array_sz == cursor->offs_sz) {
+        cursor->offs_sz = cursor->offs_sz ? 2 * cursor->offs_sz : 64;
+        cursor->offs = RedisModule_Realloc(cursor->offs,
+            cursor->offs_sz * sizeof(size_t));
     }
-
-    // Fetch the array of values on the second element; can be NULL
-    cursor->subreply_array = RedisModule_CallReplyArrayElement(cursor->reply,
-        1);
-    if (cursor->subreply_array) {
-        if (RedisModule_CallReplyType(cursor->subreply_array)
-            != REDISMODULE_REPLY_ARRAY) {
-            cursor->err = RedisModule_CreateStringPrintf(cursor->ctx,
-                REDISMODULE_ERRORMSG_WRONGTYPE);
-            return;
+    if (cursor->buf_len + len + 1 > cursor->buf_sz) {
+        while (cursor->buf_len + len + 1 > cursor->buf_sz) {
+            cursor->buf_sz = cursor->buf_sz ? 2 * cursor->buf_sz : 1024;
         }
-        cursor->array_sz = RedisModule_CallReplyLength(cursor->subreply_array);
+        cursor->buf = RedisModule_Realloc(cursor->buf, cursor->buf_sz);
     }
+    cursor->offs[cursor->array_sz++] = cursor->buf_len;
+    memcpy(cursor->buf + cursor->buf_len, str, len);
+    cursor->buf[cursor->buf_len + len] = '\0';
+    cursor->buf_len += len + 1;
+}
+
+/*
+ * Helper function to scan the set key until about count elements are read
+ * into the buffer of the cursor, or the scan is complete
+ */
+static void scan_internal(sscan_cursor_t cursor)
+{
+    assert(cursor != NULL);
 
-    // Convert the string cursor value to an integer
-    if (sr_strtoll(RedisModule_CallReplyStringPtr(subreply_cursor, NULL),
-        &cursor->value) < 0) {
+    cursor->array_ix = 0;
+    cursor->array_sz = 0;
+    cursor->buf_len = 0;
+
+    RedisModuleKey *key = RedisModule_OpenKey(cursor->ctx,
+        (RedisModuleString *)cursor->set, REDISMODULE_READ);
+    int type = RedisModule_KeyType(key);
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        cursor->done = 1;
+    } else if (type != REDISMODULE_KEYTYPE_SET) {
         cursor->err = RedisModule_CreateStringPrintf(cursor->ctx,
-            "invalid cursor");
-        return;
+            REDISMODULE_ERRORMSG_WRONGTYPE);
+    } else {
+        while ((cursor->array_sz < (size_t)cursor->count) && !cursor->done) {
+            cursor->done = !RedisModule_ScanKey(key, cursor->scan,
+                scan_element, cursor);
+        }
     }
+    RedisModule_CloseKey(key);
 }
@@ -31,7 +31,7 @@
 
 /*
  * A wrapper for creating and iterating over redis set scan cursors
- * using the redis module api
+ * using the scan api of redis module keys
  */
 
 // sscan_cursor return codes
@@ -63,4 +63,7 @@ int sscan_error(sscan_cursor_t cursor, const char **err, size_t *len);
 // Return copy of next element byref
 int sscan_next_element(sscan_cursor_t cursor, RedisModuleString **str);
 
+// Return next element and its length byref, valid until the next call
+int sscan_next_buffer(sscan_cursor_t cursor, const char **ptr, size_t *len);
+
 #endif /* SSCAN_CURSOR_H */
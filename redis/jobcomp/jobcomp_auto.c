@@ -29,6 +29,20 @@
 
 #include "jobcomp_auto.h"
 
+#include <stdint.h>
+#include <string.h>
+
+// Scratch memory is handed out aligned for any of the column types
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK_MIN 4096
+
+// An extra chunk of scratch memory, allocated when the arena chunk is full
+// and folded into it on the next reset
+struct redis_module_arena_chunk {
+    redis_module_arena_chunk_t *next;
+    char mem[];
+};
+
 /*
  * Close a redis key
  */
@@ -76,3 +90,125 @@ void destroy_redis_module_fields(redis_module_fields_t *fields)
         }
     }
 }
+
+/*
+ * Free memory from the redis module allocator, given the address of the
+ * pointer to it
+ */
+void free_redis_module_memory(void *ptr)
+{
+    void **mem = ptr;
+    if (mem && *mem) {
+        RedisModule_Free(*mem);
+        *mem = NULL;
+    }
+}
+
+/*
+ * Initialize an arena for a command on the jobs of a key prefix
+ */
+void init_redis_module_arena(redis_module_arena_t *arena, RedisModuleCtx *ctx,
+    const char *prefix)
+{
+    size_t len = strlen(prefix);
+    memset(arena, 0, sizeof(*arena));
+    arena->ctx = ctx;
+    // "<prefix>:" followed by at most a sign and 19 digits
+    arena->name = RedisModule_Alloc(len + 22);
+    memcpy(arena->name, prefix, len);
+    arena->name[len] = ':';
+    arena->name_prefix = len + 1;
+}
+
+/*
+ * Free the buffers of an arena; the memory handed out by the arena is
+ * invalid from here
+ */
+void destroy_redis_module_arena(redis_module_arena_t *arena)
+{
+    if (!arena || !arena->ctx) {
+        return;
+    }
+    redis_module_arena_reset(arena);
+    RedisModule_Free(arena->name);
+    RedisModule_Free(arena->mem);
+    memset(arena, 0, sizeof(*arena));
+}
+
+/*
+ * Create the name of the key of a job, <prefix>:<job id>, in one allocation
+ * of a short string; the caller owns the string
+ */
+RedisModuleString *redis_module_arena_keyname(redis_module_arena_t *arena,
+    long long jobid)
+{
+    char digits[20];
+    unsigned long long n = (jobid < 0) ? -(unsigned long long)jobid :
+        (unsigned long long)jobid;
+    size_t len = 0, i = 0;
+    do {
+        digits[i++] = '0' + (n % 10);
+        n /= 10;
+    } while (n);
+    char *p = arena->name + arena->name_prefix;
+    if (jobid < 0) {
+        p[len++] = '-';
+    }
+    while (i) {
+        p[len++] = digits[--i];
+    }
+    return RedisModule_CreateString(arena->ctx, arena->name,
+        arena->name_prefix + len);
+}
+
+/*
+ * Hand out zeroed scratch memory, valid until the next reset of the arena
+ */
+void *redis_module_arena_alloc(redis_module_arena_t *arena, size_t sz)
+{
+    sz = (sz + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    void *mem;
+    if (!arena->mem && !arena->spill) {
+        arena->mem_sz = (sz > ARENA_CHUNK_MIN) ? sz : ARENA_CHUNK_MIN;
+        arena->mem = RedisModule_Alloc(arena->mem_sz);
+    }
+    if (arena->mem_sz - arena->mem_used >= sz) {
+        mem = arena->mem + arena->mem_used;
+        arena->mem_used += sz;
+    } else {
+        redis_module_arena_chunk_t *chunk = RedisModule_Alloc(
+            sizeof(redis_module_arena_chunk_t) + ARENA_ALIGN + sz);
+        chunk->next = arena->spill;
+        arena->spill = chunk;
+        arena->spill_sz += sz;
+        mem = chunk->mem + ((ARENA_ALIGN - ((uintptr_t)chunk->mem %
+            ARENA_ALIGN)) % ARENA_ALIGN);
+    }
+    memset(mem, 0, sz);
+    return mem;
+}
+
+/*
+ * Take back all of the scratch memory handed out by an arena.  Chunks
+ * allocated because the arena chunk was full are freed and the arena chunk
+ * grown to hold them, so a loop reaches a steady state without allocating
+ */
+void redis_module_arena_reset(redis_module_arena_t *arena)
+{
+    if (arena->spill) {
+        while (arena->spill) {
+            redis_module_arena_chunk_t *next = arena->spill->next;
+            RedisModule_Free(arena->spill);
+            arena->spill = next;
+        }
+        size_t sz = arena->mem_sz + arena->spill_sz;
+        if (sz < ARENA_CHUNK_MIN) {
+            sz = ARENA_CHUNK_MIN;
+        }
+        RedisModule_Free(arena->mem);
+        arena->mem = RedisModule_Alloc(sz);
+        arena->mem_sz = sz;
+        arena->spill_sz = 0;
+    }
+    arena->mem_used = 0;
+}
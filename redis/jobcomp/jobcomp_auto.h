@@ -27,6 +27,7 @@
 #define JOBCOMP_AUTO_H
 
 #include <redismodule.h>
+#include <stddef.h>
 
 #include "common/redis_fields.h"
 
@@ -44,14 +45,43 @@ typedef struct redis_module_fields {
     RedisModuleString *str[MAX_REDIS_FIELDS];
 } redis_module_fields_t;
 
+// AUTO_RMARENA redis_module_arena_t is the scratch storage of a command
+// whose loops run per job: job key names are formatted into a buffer which
+// keeps the key prefix for the whole command, and scratch memory is bumped
+// out of a chunk which is reused after each reset, growing to the largest
+// need, rather than allocated and freed on every iteration
+typedef struct redis_module_arena_chunk redis_module_arena_chunk_t;
+
+typedef struct redis_module_arena {
+    RedisModuleCtx *ctx;
+    char *name;
+    size_t name_prefix;
+    char *mem;
+    size_t mem_sz;
+    size_t mem_used;
+    redis_module_arena_chunk_t *spill;
+    size_t spill_sz;
+} redis_module_arena_t;
+
+#define AUTO_RMARENA AUTO_PTR(destroy_redis_module_arena)
 #define AUTO_RMKEY AUTO_PTR(close_redis_key)
 #define AUTO_RMREPLY AUTO_PTR(destroy_redis_reply)
 #define AUTO_RMSTR AUTO_PTR(destroy_redis_module_string)
 #define AUTO_RMFIELDS AUTO_PTR(destroy_redis_module_fields)
+#define AUTO_RMMEM AUTO_PTR(free_redis_module_memory)
 
 void close_redis_key(RedisModuleKey **key);
 void destroy_redis_reply(RedisModuleCallReply **reply);
 void destroy_redis_module_string(redis_module_string_t *str);
 void destroy_redis_module_fields(redis_module_fields_t *fields);
+void free_redis_module_memory(void *ptr);
+
+void init_redis_module_arena(redis_module_arena_t *arena, RedisModuleCtx *ctx,
+    const char *prefix);
+void destroy_redis_module_arena(redis_module_arena_t *arena);
+RedisModuleString *redis_module_arena_keyname(redis_module_arena_t *arena,
+    long long jobid);
+void *redis_module_arena_alloc(redis_module_arena_t *arena, size_t sz);
+void redis_module_arena_reset(redis_module_arena_t *arena);
 
 #endif /* JOBCOMP_AUTO_H */
@@ -0,0 +1,832 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_bitmap.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "jobcomp_command.h"
+
+// Words of a bitset container
+#define BITSET_WORDS 1024
+
+// Serialized size of a container header: key and cardinality
+#define CONTAINER_HEADER_SZ 6
+
+#define IS_BITSET(c) ((c)->card > JOB_BITMAP_ARRAY_MAX)
+
+enum { OP_AND, OP_OR, OP_ANDNOT };
+
+// A container of the ids sharing the high 16 bits key
+typedef struct container {
+    uint16_t key;
+    uint32_t card;
+    // Capacity of the array, 0 for a bitset
+    uint32_t cap;
+    union {
+        uint16_t *array;
+        uint64_t *words;
+    };
+} container_t;
+
+struct job_bitmap {
+    size_t len;
+    size_t cap;
+    container_t *c;
+};
+
+RedisModuleType *job_bitmap_type = NULL;
+
+/*
+ * Create an empty job bitmap
+ */
+job_bitmap_t create_job_bitmap(void)
+{
+    return RedisModule_Calloc(1, sizeof(struct job_bitmap));
+}
+
+/*
+ * Destroy a job bitmap
+ */
+void destroy_job_bitmap(job_bitmap_t *bitmap)
+{
+    if (!bitmap || !*bitmap) {
+        return;
+    }
+    job_bitmap_t b = *bitmap;
+    size_t i = 0;
+    for (; i < b->len; ++i) {
+        RedisModule_Free(b->c[i].array);
+    }
+    RedisModule_Free(b->c);
+    RedisModule_Free(b);
+    *bitmap = NULL;
+}
+
+/*
+ * Helper function which finds the container of a key by binary search.
+ * Returns 1 with its position byref if found, else 0 with the position
+ * where it belongs
+ */
+static int find_container(const job_bitmap_t b, uint16_t key, size_t *pos)
+{
+    size_t lo = 0, hi = b->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (b->c[mid].key < key) {
+            lo = mid + 1;
+        } else if (b->c[mid].key > key) {
+            hi = mid;
+        } else {
+            *pos = mid;
+            return 1;
+        }
+    }
+    *pos = lo;
+    return 0;
+}
+
+/*
+ * Helper function which finds a low 16 bits value in an array container by
+ * binary search, see find_container
+ */
+static int find_low(const container_t *c, uint16_t low, uint32_t *pos)
+{
+    uint32_t lo = 0, hi = c->card;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (c->array[mid] < low) {
+            lo = mid + 1;
+        } else if (c->array[mid] > low) {
+            hi = mid;
+        } else {
+            *pos = mid;
+            return 1;
+        }
+    }
+    *pos = lo;
+    return 0;
+}
+
+/*
+ * Helper function which makes room for a container at a position and
+ * places it there
+ */
+static void insert_container(job_bitmap_t b, size_t pos, const container_t *c)
+{
+    if (b->len == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 4;
+        b->c = RedisModule_Realloc(b->c, b->cap * sizeof(container_t));
+    }
+    memmove(&b->c[pos + 1], &b->c[pos], (b->len - pos) * sizeof(container_t));
+    b->c[pos] = *c;
+    ++b->len;
+}
+
+/*
+ * Helper function which sets the bits of the ids of an array in a bitset
+ */
+static void array_to_words(const uint16_t *array, uint32_t card,
+    uint64_t *words)
+{
+    uint32_t i = 0;
+    for (; i < card; ++i) {
+        words[array[i] >> 6] |= 1ull << (array[i] & 63);
+    }
+}
+
+/*
+ * Helper function which lists the ids of a bitset in an array
+ */
+static void words_to_array(const uint64_t *words, uint16_t *array)
+{
+    uint32_t i = 0, n = 0;
+    for (; i < BITSET_WORDS; ++i) {
+        uint64_t w = words[i];
+        while (w) {
+            array[n++] = (uint16_t)((i << 6) + __builtin_ctzll(w));
+            w &= w - 1;
+        }
+    }
+}
+
+/*
+ * Add a job id, turning an array container which outgrows
+ * JOB_BITMAP_ARRAY_MAX into a bitset
+ */
+int job_bitmap_add(job_bitmap_t bitmap, uint32_t id)
+{
+    assert(bitmap != NULL);
+
+    uint16_t key = (uint16_t)(id >> 16), low = (uint16_t)id;
+    size_t pos;
+    if (!find_container(bitmap, key, &pos)) {
+        container_t c = {
+            .key = key,
+            .cap = 4,
+            .array = RedisModule_Alloc(4 * sizeof(uint16_t))
+        };
+        insert_container(bitmap, pos, &c);
+    }
+    container_t *c = &bitmap->c[pos];
+
+    if (IS_BITSET(c)) {
+        uint64_t bit = 1ull << (low & 63);
+        if (c->words[low >> 6] & bit) {
+            return 0;
+        }
+        c->words[low >> 6] |= bit;
+        ++c->card;
+        return 1;
+    }
+
+    uint32_t at;
+    if (find_low(c, low, &at)) {
+        return 0;
+    }
+    if (c->card == JOB_BITMAP_ARRAY_MAX) {
+        uint64_t *words = RedisModule_Calloc(BITSET_WORDS, sizeof(uint64_t));
+        array_to_words(c->array, c->card, words);
+        words[low >> 6] |= 1ull << (low & 63);
+        RedisModule_Free(c->array);
+        c->words = words;
+        c->cap = 0;
+        ++c->card;
+        return 1;
+    }
+    if (c->card == c->cap) {
+        c->cap = (c->cap * 2 < JOB_BITMAP_ARRAY_MAX) ? c->cap * 2 :
+            JOB_BITMAP_ARRAY_MAX;
+        c->array = RedisModule_Realloc(c->array, c->cap * sizeof(uint16_t));
+    }
+    memmove(&c->array[at + 1], &c->array[at],
+        (c->card - at) * sizeof(uint16_t));
+    c->array[at] = low;
+    ++c->card;
+    return 1;
+}
+
+/*
+ * Tell if a job id is present
+ */
+int job_bitmap_contains(const job_bitmap_t bitmap, uint32_t id)
+{
+    assert(bitmap != NULL);
+
+    uint16_t low = (uint16_t)id;
+    size_t pos;
+    uint32_t at;
+    if (!find_container(bitmap, (uint16_t)(id >> 16), &pos)) {
+        return 0;
+    }
+    const container_t *c = &bitmap->c[pos];
+    if (IS_BITSET(c)) {
+        return (c->words[low >> 6] >> (low & 63)) & 1;
+    }
+    return find_low(c, low, &at);
+}
+
+/*
+ * Number of job ids
+ */
+uint64_t job_bitmap_cardinality(const job_bitmap_t bitmap)
+{
+    assert(bitmap != NULL);
+
+    uint64_t card = 0;
+    size_t i = 0;
+    for (; i < bitmap->len; ++i) {
+        card += bitmap->c[i].card;
+    }
+    return card;
+}
+
+/*
+ * Helper function which copies a container
+ */
+static void copy_container(const container_t *c, container_t *out)
+{
+    *out = *c;
+    if (IS_BITSET(c)) {
+        out->words = RedisModule_Alloc(BITSET_WORDS * sizeof(uint64_t));
+        memcpy(out->words, c->words, BITSET_WORDS * sizeof(uint64_t));
+    } else {
+        out->cap = c->card;
+        out->array = RedisModule_Alloc(c->card * sizeof(uint16_t));
+        memcpy(out->array, c->array, c->card * sizeof(uint16_t));
+    }
+}
+
+/*
+ * Helper function which merges two sorted arrays; returns the size of the
+ * result
+ */
+static uint32_t merge_arrays(const container_t *a, const container_t *b,
+    int op, uint16_t *out)
+{
+    uint32_t i = 0, j = 0, n = 0;
+    while ((i < a->card) && (j < b->card)) {
+        if (a->array[i] < b->array[j]) {
+            if (op != OP_AND) {
+                out[n++] = a->array[i];
+            }
+            ++i;
+        } else if (a->array[i] > b->array[j]) {
+            if (op == OP_OR) {
+                out[n++] = b->array[j];
+            }
+            ++j;
+        } else {
+            if (op != OP_ANDNOT) {
+                out[n++] = a->array[i];
+            }
+            ++i;
+            ++j;
+        }
+    }
+    if (op != OP_AND) {
+        for (; i < a->card; ++i) {
+            out[n++] = a->array[i];
+        }
+    }
+    if (op == OP_OR) {
+        for (; j < b->card; ++j) {
+            out[n++] = b->array[j];
+        }
+    }
+    return n;
+}
+
+/*
+ * Helper function which combines two containers of the same key into out.
+ * Two arrays are merged; otherwise both are taken as bitsets and combined a
+ * word at a time.  The result is an array or a bitset by its cardinality.
+ * Returns 0 if the result is empty
+ */
+static int combine_containers(const container_t *a, const container_t *b,
+    int op, container_t *out)
+{
+    out->key = a->key;
+
+    if (!IS_BITSET(a) && !IS_BITSET(b)) {
+        uint16_t *array = RedisModule_Alloc((a->card + b->card) *
+            sizeof(uint16_t));
+        uint32_t n = merge_arrays(a, b, op, array);
+        if (n == 0) {
+            RedisModule_Free(array);
+            return 0;
+        }
+        if (n <= JOB_BITMAP_ARRAY_MAX) {
+            out->card = out->cap = n;
+            out->array = RedisModule_Realloc(array, n * sizeof(uint16_t));
+            return 1;
+        }
+        out->words = RedisModule_Calloc(BITSET_WORDS, sizeof(uint64_t));
+        array_to_words(array, n, out->words);
+        RedisModule_Free(array);
+        out->card = n;
+        out->cap = 0;
+        return 1;
+    }
+
+    uint64_t abuf[BITSET_WORDS], bbuf[BITSET_WORDS];
+    const uint64_t *wa = a->words, *wb = b->words;
+    if (!IS_BITSET(a)) {
+        memset(abuf, 0, sizeof(abuf));
+        array_to_words(a->array, a->card, abuf);
+        wa = abuf;
+    }
+    if (!IS_BITSET(b)) {
+        memset(bbuf, 0, sizeof(bbuf));
+        array_to_words(b->array, b->card, bbuf);
+        wb = bbuf;
+    }
+    uint64_t *words = RedisModule_Alloc(BITSET_WORDS * sizeof(uint64_t));
+    uint32_t card = 0, i = 0;
+    for (; i < BITSET_WORDS; ++i) {
+        words[i] = (op == OP_AND) ? (wa[i] & wb[i]) :
+            (op == OP_OR) ? (wa[i] | wb[i]) : (wa[i] & ~wb[i]);
+        card += (uint32_t)__builtin_popcountll(words[i]);
+    }
+    if (card == 0) {
+        RedisModule_Free(words);
+        return 0;
+    }
+    out->card = card;
+    if (card > JOB_BITMAP_ARRAY_MAX) {
+        out->words = words;
+        out->cap = 0;
+        return 1;
+    }
+    out->array = RedisModule_Alloc(card * sizeof(uint16_t));
+    out->cap = card;
+    words_to_array(words, out->array);
+    RedisModule_Free(words);
+    return 1;
+}
+
+/*
+ * Helper function which combines two bitmaps container by container, in
+ * key order
+ */
+static job_bitmap_t combine_bitmaps(const job_bitmap_t a, const job_bitmap_t b,
+    int op)
+{
+    assert(a != NULL);
+    assert(b != NULL);
+
+    job_bitmap_t r = create_job_bitmap();
+    size_t i = 0, j = 0;
+    while ((i < a->len) || (j < b->len)) {
+        container_t out;
+        if ((op == OP_AND) && ((i == a->len) || (j == b->len))) {
+            break;
+        }
+        if ((j == b->len) || ((i < a->len) && (a->c[i].key < b->c[j].key))) {
+            if (op != OP_AND) {
+                copy_container(&a->c[i], &out);
+                insert_container(r, r->len, &out);
+            }
+            ++i;
+        } else if ((i == a->len) || (b->c[j].key < a->c[i].key)) {
+            if (op == OP_OR) {
+                copy_container(&b->c[j], &out);
+                insert_container(r, r->len, &out);
+            }
+            ++j;
+        } else {
+            if (combine_containers(&a->c[i], &b->c[j], op, &out)) {
+                insert_container(r, r->len, &out);
+            }
+            ++i;
+            ++j;
+        }
+    }
+    return r;
+}
+
+job_bitmap_t job_bitmap_and(const job_bitmap_t a, const job_bitmap_t b)
+{
+    return combine_bitmaps(a, b, OP_AND);
+}
+
+job_bitmap_t job_bitmap_or(const job_bitmap_t a, const job_bitmap_t b)
+{
+    return combine_bitmaps(a, b, OP_OR);
+}
+
+job_bitmap_t job_bitmap_andnot(const job_bitmap_t a, const job_bitmap_t b)
+{
+    return combine_bitmaps(a, b, OP_ANDNOT);
+}
+
+/*
+ * Helper function which copies the ids of a container within the low 16 bits
+ * range [from, to] into out.  Returns 0 if there are none
+ */
+static int slice_container(const container_t *c, uint32_t from, uint32_t to,
+    container_t *out)
+{
+    out->key = c->key;
+
+    if (!IS_BITSET(c)) {
+        uint32_t first, last;
+        find_low(c, (uint16_t)from, &first);
+        if (find_low(c, (uint16_t)to, &last)) {
+            ++last;
+        }
+        if (first >= last) {
+            return 0;
+        }
+        out->card = out->cap = last - first;
+        out->array = RedisModule_Alloc(out->card * sizeof(uint16_t));
+        memcpy(out->array, &c->array[first], out->card * sizeof(uint16_t));
+        return 1;
+    }
+
+    uint64_t *words = RedisModule_Calloc(BITSET_WORDS, sizeof(uint64_t));
+    uint32_t card = 0, i = from >> 6;
+    for (; i <= (to >> 6); ++i) {
+        uint64_t w = c->words[i];
+        if (i == (from >> 6)) {
+            w &= ~0ull << (from & 63);
+        }
+        if ((i == (to >> 6)) && ((to & 63) != 63)) {
+            w &= (1ull << ((to & 63) + 1)) - 1;
+        }
+        words[i] = w;
+        card += (uint32_t)__builtin_popcountll(w);
+    }
+    if (card == 0) {
+        RedisModule_Free(words);
+        return 0;
+    }
+    out->card = card;
+    if (card > JOB_BITMAP_ARRAY_MAX) {
+        out->words = words;
+        out->cap = 0;
+        return 1;
+    }
+    out->array = RedisModule_Alloc(card * sizeof(uint16_t));
+    out->cap = card;
+    words_to_array(words, out->array);
+    RedisModule_Free(words);
+    return 1;
+}
+
+/*
+ * Create a bitmap of the job ids within the range [lo, hi].  Containers
+ * inside the range are copied whole and only those at its ends are sliced,
+ * so the cost follows the containers in the range rather than its width
+ */
+job_bitmap_t job_bitmap_range(const job_bitmap_t bitmap, uint32_t lo,
+    uint32_t hi)
+{
+    assert(bitmap != NULL);
+
+    job_bitmap_t r = create_job_bitmap();
+    if (lo > hi) {
+        return r;
+    }
+    size_t i;
+    find_container(bitmap, (uint16_t)(lo >> 16), &i);
+    for (; (i < bitmap->len) && (bitmap->c[i].key <= (hi >> 16)); ++i) {
+        const container_t *c = &bitmap->c[i];
+        uint32_t high = (uint32_t)c->key << 16;
+        uint32_t from = (lo > high) ? lo - high : 0;
+        uint32_t to = ((hi - high) < 0xffff) ? hi - high : 0xffff;
+        container_t out;
+        if ((from == 0) && (to == 0xffff)) {
+            copy_container(c, &out);
+            insert_container(r, r->len, &out);
+        } else if (slice_container(c, from, to, &out)) {
+            insert_container(r, r->len, &out);
+        }
+    }
+    return r;
+}
+
+/*
+ * Return the lowest job id byref; return 0 if the bitmap is empty
+ */
+int job_bitmap_min(const job_bitmap_t bitmap, uint32_t *id)
+{
+    assert(bitmap != NULL);
+    assert(id != NULL);
+
+    job_bitmap_iter_t iter;
+    job_bitmap_iter_init(&iter);
+    return job_bitmap_next(bitmap, &iter, id);
+}
+
+/*
+ * Start an iteration
+ */
+void job_bitmap_iter_init(job_bitmap_iter_t *iter)
+{
+    assert(iter != NULL);
+    iter->container = 0;
+    iter->pos = 0;
+}
+
+/*
+ * Return the next job id byref, in ascending order
+ */
+int job_bitmap_next(const job_bitmap_t bitmap, job_bitmap_iter_t *iter,
+    uint32_t *id)
+{
+    assert(bitmap != NULL);
+    assert(iter != NULL);
+    assert(id != NULL);
+
+    while (iter->container < bitmap->len) {
+        const container_t *c = &bitmap->c[iter->container];
+        uint32_t high = (uint32_t)c->key << 16;
+        if (!IS_BITSET(c)) {
+            if (iter->pos < c->card) {
+                *id = high | c->array[iter->pos++];
+                return 1;
+            }
+        } else {
+            while (iter->pos < (BITSET_WORDS << 6)) {
+                uint32_t i = iter->pos >> 6;
+                uint64_t w = c->words[i] >> (iter->pos & 63);
+                if (w) {
+                    iter->pos += (uint32_t)__builtin_ctzll(w);
+                    *id = high | iter->pos++;
+                    return 1;
+                }
+                iter->pos = (i + 1) << 6;
+            }
+        }
+        ++iter->container;
+        iter->pos = 0;
+    }
+    return 0;
+}
+
+static void put_u16(char *buf, uint16_t v)
+{
+    buf[0] = (char)v;
+    buf[1] = (char)(v >> 8);
+}
+
+static void put_u32(char *buf, uint32_t v)
+{
+    put_u16(buf, (uint16_t)v);
+    put_u16(buf + 2, (uint16_t)(v >> 16));
+}
+
+static void put_u64(char *buf, uint64_t v)
+{
+    put_u32(buf, (uint32_t)v);
+    put_u32(buf + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_u16(const char *buf)
+{
+    return (uint16_t)((unsigned char)buf[0] |
+        ((unsigned)(unsigned char)buf[1] << 8));
+}
+
+static uint32_t get_u32(const char *buf)
+{
+    return get_u16(buf) | ((uint32_t)get_u16(buf + 2) << 16);
+}
+
+static uint64_t get_u64(const char *buf)
+{
+    return get_u32(buf) | ((uint64_t)get_u32(buf + 4) << 32);
+}
+
+/*
+ * Helper function which gives the serialized size of a container's ids
+ */
+static size_t container_data_size(uint32_t card)
+{
+    return (card > JOB_BITMAP_ARRAY_MAX) ?
+        BITSET_WORDS * sizeof(uint64_t) : card * sizeof(uint16_t);
+}
+
+/*
+ * Serialized size of a bitmap
+ */
+size_t job_bitmap_serialized_size(const job_bitmap_t bitmap)
+{
+    assert(bitmap != NULL);
+
+    size_t sz = sizeof(uint32_t), i = 0;
+    for (; i < bitmap->len; ++i) {
+        sz += CONTAINER_HEADER_SZ + container_data_size(bitmap->c[i].card);
+    }
+    return sz;
+}
+
+/*
+ * Serialize a bitmap: the number of containers, then for each container its
+ * key, its cardinality and its sorted ids or bitset words
+ */
+void job_bitmap_serialize(const job_bitmap_t bitmap, char *buf)
+{
+    assert(bitmap != NULL);
+    assert(buf != NULL);
+
+    size_t i = 0;
+    uint32_t j;
+    put_u32(buf, (uint32_t)bitmap->len);
+    buf += sizeof(uint32_t);
+    for (; i < bitmap->len; ++i) {
+        const container_t *c = &bitmap->c[i];
+        put_u16(buf, c->key);
+        put_u32(buf + 2, c->card);
+        buf += CONTAINER_HEADER_SZ;
+        if (IS_BITSET(c)) {
+            for (j = 0; j < BITSET_WORDS; ++j, buf += sizeof(uint64_t)) {
+                put_u64(buf, c->words[j]);
+            }
+        } else {
+            for (j = 0; j < c->card; ++j, buf += sizeof(uint16_t)) {
+                put_u16(buf, c->array[j]);
+            }
+        }
+    }
+}
+
+/*
+ * Create a bitmap from its serialization, checking that containers are in
+ * key order, arrays sorted and bitsets of the stated cardinality
+ */
+job_bitmap_t job_bitmap_deserialize(const char *buf, size_t len)
+{
+    assert(buf != NULL);
+
+    if (len < sizeof(uint32_t)) {
+        return NULL;
+    }
+    uint32_t n = get_u32(buf), i, j;
+    size_t off = sizeof(uint32_t);
+    if (n > (1u << 16)) {
+        return NULL;
+    }
+    job_bitmap_t b = create_job_bitmap();
+    if (n) {
+        b->c = RedisModule_Calloc(n, sizeof(container_t));
+        b->cap = n;
+    }
+    for (i = 0; i < n; ++i) {
+        container_t *c = &b->c[i];
+        if (len - off < CONTAINER_HEADER_SZ) {
+            goto invalid;
+        }
+        c->key = get_u16(buf + off);
+        c->card = get_u32(buf + off + 2);
+        off += CONTAINER_HEADER_SZ;
+        if ((c->card == 0) || (c->card > (1u << 16)) ||
+            (i && (c->key <= b->c[i - 1].key)) ||
+            (len - off < container_data_size(c->card))) {
+            goto invalid;
+        }
+        if (IS_BITSET(c)) {
+            uint32_t card = 0;
+            c->words = RedisModule_Alloc(BITSET_WORDS * sizeof(uint64_t));
+            ++b->len;
+            for (j = 0; j < BITSET_WORDS; ++j, off += sizeof(uint64_t)) {
+                c->words[j] = get_u64(buf + off);
+                card += (uint32_t)__builtin_popcountll(c->words[j]);
+            }
+            if (card != c->card) {
+                goto invalid;
+            }
+        } else {
+            c->cap = c->card;
+            c->array = RedisModule_Alloc(c->card * sizeof(uint16_t));
+            ++b->len;
+            for (j = 0; j < c->card; ++j, off += sizeof(uint16_t)) {
+                c->array[j] = get_u16(buf + off);
+                if (j && (c->array[j] <= c->array[j - 1])) {
+                    goto invalid;
+                }
+            }
+        }
+    }
+    if (off != len) {
+        goto invalid;
+    }
+    return b;
+
+invalid:
+    destroy_job_bitmap(&b);
+    return NULL;
+}
+
+/*
+ * The job bitmap of an open key
+ */
+job_bitmap_t job_bitmap_get(RedisModuleKey *key)
+{
+    if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_MODULE) ||
+        (RedisModule_ModuleTypeGetType(key) != job_bitmap_type)) {
+        return NULL;
+    }
+    return RedisModule_ModuleTypeGetValue(key);
+}
+
+/*
+ * Module type callbacks.  A job bitmap is persisted in its serialized form
+ */
+void *job_bitmap_rdb_load(RedisModuleIO *rdb, int encver)
+{
+    if (encver != JOB_BITMAP_TYPE_ENCVER) {
+        RedisModule_LogIOError(rdb, "warning",
+            "unsupported job index encoding version %d", encver);
+        return NULL;
+    }
+    size_t len = 0;
+    char *buf = RedisModule_LoadStringBuffer(rdb, &len);
+    if (!buf) {
+        return NULL;
+    }
+    job_bitmap_t b = job_bitmap_deserialize(buf, len);
+    RedisModule_Free(buf);
+    if (!b) {
+        RedisModule_LogIOError(rdb, "warning", "invalid job index");
+    }
+    return b;
+}
+
+void job_bitmap_rdb_save(RedisModuleIO *rdb, void *value)
+{
+    size_t len = job_bitmap_serialized_size(value);
+    char *buf = RedisModule_Alloc(len);
+    job_bitmap_serialize(value, buf);
+    RedisModule_SaveStringBuffer(rdb, buf, len);
+    RedisModule_Free(buf);
+}
+
+/*
+ * The rewritten AOF restores each job bitmap with SLURMJC.IDXLOAD; the key
+ * ttl is rewritten by redis
+ */
+void job_bitmap_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key,
+    void *value)
+{
+    size_t len = job_bitmap_serialized_size(value);
+    char *buf = RedisModule_Alloc(len);
+    job_bitmap_serialize(value, buf);
+    RedisModule_EmitAOF(aof, JOBCOMP_COMMAND_IDXLOAD, "sb", key, buf, len);
+    RedisModule_Free(buf);
+}
+
+size_t job_bitmap_mem_usage(const void *value)
+{
+    const struct job_bitmap *b = value;
+    size_t sz = sizeof(*b) + b->cap * sizeof(container_t), i = 0;
+    for (; i < b->len; ++i) {
+        sz += IS_BITSET(&b->c[i]) ? BITSET_WORDS * sizeof(uint64_t) :
+            b->c[i].cap * sizeof(uint16_t);
+    }
+    return sz;
+}
+
+void job_bitmap_digest(RedisModuleDigest *md, void *value)
+{
+    size_t len = job_bitmap_serialized_size(value);
+    char *buf = RedisModule_Alloc(len);
+    job_bitmap_serialize(value, buf);
+    RedisModule_DigestAddStringBuffer(md, (unsigned char *)buf, len);
+    RedisModule_DigestEndSequence(md);
+    RedisModule_Free(buf);
+}
+
+void job_bitmap_free(void *value)
+{
+    job_bitmap_t b = value;
+    destroy_job_bitmap(&b);
+}
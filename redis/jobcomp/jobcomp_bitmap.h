@@ -0,0 +1,117 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_BITMAP_H
+#define JOBCOMP_BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <redismodule.h>
+
+/*
+ * A compressed bitmap of job ids in the style of roaring bitmaps, used for
+ * the daily job indices.  Job ids are split on their high 16 bits into
+ * containers kept in key order; each container holds the low 16 bits of its
+ * ids either as a sorted array, while it has no more than
+ * JOB_BITMAP_ARRAY_MAX ids, or as a bitset of 65536 bits.  Slurm hands out
+ * job ids densely, so a day of jobs takes little more than a bit per job,
+ * and bitmaps are combined container by container, a word at a time where
+ * the containers are bitsets
+ */
+
+// Most ids of an array container; beyond this a bitset is smaller
+#define JOB_BITMAP_ARRAY_MAX 4096
+
+// Name and encoding version of the job index module type
+#define JOB_BITMAP_TYPE_NAME "slurmjcix"
+#define JOB_BITMAP_TYPE_ENCVER 0
+
+// A job bitmap is an opaque pointer
+typedef struct job_bitmap *job_bitmap_t;
+
+// Iteration over the ids of a job bitmap in ascending order
+typedef struct {
+    size_t container;
+    uint32_t pos;
+} job_bitmap_iter_t;
+
+// The job index module type, created on module load
+extern RedisModuleType *job_bitmap_type;
+
+// Create an empty job bitmap
+job_bitmap_t create_job_bitmap(void);
+
+// Destroy a job bitmap
+void destroy_job_bitmap(job_bitmap_t *bitmap);
+
+// Add a job id; return 1 if it was added, 0 if already present
+int job_bitmap_add(job_bitmap_t bitmap, uint32_t id);
+
+// Tell if a job id is present
+int job_bitmap_contains(const job_bitmap_t bitmap, uint32_t id);
+
+// Number of job ids
+uint64_t job_bitmap_cardinality(const job_bitmap_t bitmap);
+
+// Create the intersection, union or difference (a and not b) of bitmaps
+job_bitmap_t job_bitmap_and(const job_bitmap_t a, const job_bitmap_t b);
+job_bitmap_t job_bitmap_or(const job_bitmap_t a, const job_bitmap_t b);
+job_bitmap_t job_bitmap_andnot(const job_bitmap_t a, const job_bitmap_t b);
+
+// Create a bitmap of the job ids within the range [lo, hi]
+job_bitmap_t job_bitmap_range(const job_bitmap_t bitmap, uint32_t lo,
+    uint32_t hi);
+
+// Return the lowest job id byref; return 1 if there is one, 0 if empty
+int job_bitmap_min(const job_bitmap_t bitmap, uint32_t *id);
+
+// Start an iteration
+void job_bitmap_iter_init(job_bitmap_iter_t *iter);
+
+// Return the next job id byref; return 1 if there is one, 0 at the end
+int job_bitmap_next(const job_bitmap_t bitmap, job_bitmap_iter_t *iter,
+    uint32_t *id);
+
+// Serialized size of a bitmap, and its serialization into a buffer of that
+// size: containers in key order, all integers little-endian
+size_t job_bitmap_serialized_size(const job_bitmap_t bitmap);
+void job_bitmap_serialize(const job_bitmap_t bitmap, char *buf);
+
+// Create a bitmap from its serialization; return NULL if it is invalid
+job_bitmap_t job_bitmap_deserialize(const char *buf, size_t len);
+
+// The job bitmap of an open key, NULL if the key holds none
+job_bitmap_t job_bitmap_get(RedisModuleKey *key);
+
+// Module type callbacks of job bitmaps
+void *job_bitmap_rdb_load(RedisModuleIO *rdb, int encver);
+void job_bitmap_rdb_save(RedisModuleIO *rdb, void *value);
+void job_bitmap_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key,
+    void *value);
+size_t job_bitmap_mem_usage(const void *value);
+void job_bitmap_digest(RedisModuleDigest *md, void *value);
+void job_bitmap_free(void *value);
+
+#endif /* JOBCOMP_BITMAP_H */
@@ -0,0 +1,325 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_bloom.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Serialized size of the header: bits, hashes and jobs
+#define BLOOM_HEADER_SZ (2 * sizeof(uint32_t) + sizeof(uint64_t))
+
+struct job_bloom {
+    uint32_t nbits;
+    uint32_t nhashes;
+    uint64_t jobs;
+    uint64_t *words;
+};
+
+RedisModuleType *job_bloom_type = NULL;
+
+/*
+ * Create an empty filter
+ */
+job_bloom_t create_job_bloom(uint32_t nbits, uint32_t nhashes)
+{
+    job_bloom_t bloom = RedisModule_Calloc(1, sizeof(struct job_bloom));
+    bloom->nbits = JOB_BLOOM_BITS_MIN;
+    while ((bloom->nbits < nbits) && (bloom->nbits < JOB_BLOOM_BITS_MAX)) {
+        bloom->nbits <<= 1;
+    }
+    bloom->nhashes = (nhashes < 1) ? 1 :
+        (nhashes > JOB_BLOOM_HASHES_MAX) ? JOB_BLOOM_HASHES_MAX : nhashes;
+    bloom->words = RedisModule_Calloc(bloom->nbits / 64, sizeof(uint64_t));
+    return bloom;
+}
+
+/*
+ * Destroy a filter
+ */
+void destroy_job_bloom(job_bloom_t *bloom)
+{
+    if (bloom && *bloom) {
+        RedisModule_Free((*bloom)->words);
+        RedisModule_Free(*bloom);
+        *bloom = NULL;
+    }
+}
+
+/*
+ * Helper function which hashes the value of a field: 64 bit FNV-1a over the
+ * field and the value, finished with the splitmix64 mixer.  The two halves
+ * seed the double hashing of the bit positions
+ */
+static uint64_t bloom_hash(int field, const char *value, size_t len)
+{
+    uint64_t h = 14695981039346656037ull;
+    size_t i = 0;
+    h = (h ^ (unsigned char)field) * 1099511628211ull;
+    for (; i < len; ++i) {
+        h = (h ^ (unsigned char)value[i]) * 1099511628211ull;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+/*
+ * Add the value of a field of a job
+ */
+void job_bloom_add(job_bloom_t bloom, int field, const char *value,
+    size_t len)
+{
+    assert(bloom != NULL);
+
+    uint64_t h = bloom_hash(field, value, len);
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    uint32_t i = 0;
+    for (; i < bloom->nhashes; ++i) {
+        uint32_t bit = (h1 + i * h2) & (bloom->nbits - 1);
+        bloom->words[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+/*
+ * Tell if the value of a field may have been added
+ */
+int job_bloom_contains(const job_bloom_t bloom, int field, const char *value,
+    size_t len)
+{
+    assert(bloom != NULL);
+
+    uint64_t h = bloom_hash(field, value, len);
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    uint32_t i = 0;
+    for (; i < bloom->nhashes; ++i) {
+        uint32_t bit = (h1 + i * h2) & (bloom->nbits - 1);
+        if (!(bloom->words[bit / 64] & ((uint64_t)1 << (bit % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Count a job new to the day
+ */
+void job_bloom_count(job_bloom_t bloom)
+{
+    assert(bloom != NULL);
+    ++bloom->jobs;
+}
+
+uint64_t job_bloom_jobs(const job_bloom_t bloom)
+{
+    assert(bloom != NULL);
+    return bloom->jobs;
+}
+
+uint32_t job_bloom_bits(const job_bloom_t bloom)
+{
+    assert(bloom != NULL);
+    return bloom->nbits;
+}
+
+uint32_t job_bloom_hashes(const job_bloom_t bloom)
+{
+    assert(bloom != NULL);
+    return bloom->nhashes;
+}
+
+uint64_t job_bloom_bits_set(const job_bloom_t bloom)
+{
+    assert(bloom != NULL);
+    uint64_t n = 0;
+    uint32_t i = 0;
+    for (; i < bloom->nbits / 64; ++i) {
+        n += __builtin_popcountll(bloom->words[i]);
+    }
+    return n;
+}
+
+static void put_u32(char *buf, uint32_t v)
+{
+    buf[0] = (char)v;
+    buf[1] = (char)(v >> 8);
+    buf[2] = (char)(v >> 16);
+    buf[3] = (char)(v >> 24);
+}
+
+static uint32_t get_u32(const char *buf)
+{
+    const unsigned char *b = (const unsigned char *)buf;
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static void put_u64(char *buf, uint64_t v)
+{
+    put_u32(buf, (uint32_t)v);
+    put_u32(buf + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get_u64(const char *buf)
+{
+    return get_u32(buf) | ((uint64_t)get_u32(buf + 4) << 32);
+}
+
+/*
+ * Serialized size of a filter
+ */
+size_t job_bloom_serialized_size(const job_bloom_t bloom)
+{
+    assert(bloom != NULL);
+    return BLOOM_HEADER_SZ + bloom->nbits / 8;
+}
+
+/*
+ * Serialize a filter into a buffer of its serialized size
+ */
+void job_bloom_serialize(const job_bloom_t bloom, char *buf)
+{
+    assert(bloom != NULL);
+    assert(buf != NULL);
+
+    put_u32(buf, bloom->nbits);
+    put_u32(buf + 4, bloom->nhashes);
+    put_u64(buf + 8, bloom->jobs);
+    buf += BLOOM_HEADER_SZ;
+    uint32_t i = 0;
+    for (; i < bloom->nbits / 64; ++i, buf += 8) {
+        put_u64(buf, bloom->words[i]);
+    }
+}
+
+/*
+ * Create a filter from its serialization, checking the size is a power of
+ * two within bounds and the buffer holds exactly its bits
+ */
+job_bloom_t job_bloom_deserialize(const char *buf, size_t len)
+{
+    if (!buf || (len < BLOOM_HEADER_SZ)) {
+        return NULL;
+    }
+    uint32_t nbits = get_u32(buf);
+    uint32_t nhashes = get_u32(buf + 4);
+    if ((nbits < JOB_BLOOM_BITS_MIN) || (nbits > JOB_BLOOM_BITS_MAX) ||
+        (nbits & (nbits - 1)) || (nhashes < 1) ||
+        (nhashes > JOB_BLOOM_HASHES_MAX) ||
+        (len != BLOOM_HEADER_SZ + nbits / 8)) {
+        return NULL;
+    }
+    job_bloom_t bloom = create_job_bloom(nbits, nhashes);
+    bloom->jobs = get_u64(buf + 8);
+    buf += BLOOM_HEADER_SZ;
+    uint32_t i = 0;
+    for (; i < nbits / 64; ++i, buf += 8) {
+        bloom->words[i] = get_u64(buf);
+    }
+    return bloom;
+}
+
+/*
+ * The job bloom filter of an open key, NULL if the key holds none
+ */
+job_bloom_t job_bloom_get(RedisModuleKey *key)
+{
+    if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_MODULE) ||
+        (RedisModule_ModuleTypeGetType(key) != job_bloom_type)) {
+        return NULL;
+    }
+    return RedisModule_ModuleTypeGetValue(key);
+}
+
+/*
+ * Module type callbacks.  A job bloom filter is persisted in its serialized
+ * form
+ */
+void *job_bloom_rdb_load(RedisModuleIO *rdb, int encver)
+{
+    if (encver != JOB_BLOOM_TYPE_ENCVER) {
+        RedisModule_LogIOError(rdb, "warning",
+            "unsupported job bloom filter encoding version %d", encver);
+        return NULL;
+    }
+    size_t len = 0;
+    char *buf = RedisModule_LoadStringBuffer(rdb, &len);
+    if (!buf) {
+        return NULL;
+    }
+    job_bloom_t bloom = job_bloom_deserialize(buf, len);
+    RedisModule_Free(buf);
+    if (!bloom) {
+        RedisModule_LogIOError(rdb, "warning", "invalid job bloom filter");
+    }
+    return bloom;
+}
+
+void job_bloom_rdb_save(RedisModuleIO *rdb, void *value)
+{
+    size_t len = job_bloom_serialized_size(value);
+    char *buf = RedisModule_Alloc(len);
+    job_bloom_serialize(value, buf);
+    RedisModule_SaveStringBuffer(rdb, buf, len);
+    RedisModule_Free(buf);
+}
+
+/*
+ * A filter is derived from the job values, so nothing is emitted.  A day
+ * whose filter is lost this way is no longer pruned by it, as a filter
+ * started over by the next job of the day does not cover the jobs before
+ */
+void job_bloom_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key,
+    void *value)
+{
+    (void)aof;
+    (void)key;
+    (void)value;
+}
+
+size_t job_bloom_mem_usage(const void *value)
+{
+    const struct job_bloom *bloom = value;
+    return sizeof(*bloom) + bloom->nbits / 8;
+}
+
+void job_bloom_digest(RedisModuleDigest *md, void *value)
+{
+    size_t len = job_bloom_serialized_size(value);
+    char *buf = RedisModule_Alloc(len);
+    job_bloom_serialize(value, buf);
+    RedisModule_DigestAddStringBuffer(md, (unsigned char *)buf, len);
+    RedisModule_DigestEndSequence(md);
+    RedisModule_Free(buf);
+}
+
+void job_bloom_free(void *value)
+{
+    job_bloom_t bloom = value;
+    destroy_job_bloom(&bloom);
+}
@@ -0,0 +1,104 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_BLOOM_H
+#define JOBCOMP_BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <redismodule.h>
+
+/*
+ * A Bloom filter of the uids, gids, partitions and job names of the jobs
+ * which ended on a day, <prefix>:idx:blm:<days>, kept by SLURMJC.INDEX.
+ * Values are hashed along with their field, so the one filter answers for
+ * all four attributes.  MATCH skips a day whose filter holds none of the
+ * values asked for, before reading its attribute indices or scanning its
+ * segment.  Like zone maps, a filter only speaks for the day when it has
+ * seen every job of the day index
+ */
+
+// Name and encoding version of the job bloom filter module type
+#define JOB_BLOOM_TYPE_NAME "slurmjcbf"
+#define JOB_BLOOM_TYPE_ENCVER 0
+
+// Bounds on the size of a filter in bits, a power of two, and on the
+// number of hash functions
+#define JOB_BLOOM_BITS_MIN 64
+#define JOB_BLOOM_BITS_MAX (1u << 30)
+#define JOB_BLOOM_HASHES_MAX 16
+
+// A job bloom filter is an opaque pointer
+typedef struct job_bloom *job_bloom_t;
+
+// The job bloom filter module type, created on module load
+extern RedisModuleType *job_bloom_type;
+
+// Create an empty filter of nbits bits (rounded up to a power of two within
+// bounds) and nhashes hash functions
+job_bloom_t create_job_bloom(uint32_t nbits, uint32_t nhashes);
+
+// Destroy a filter
+void destroy_job_bloom(job_bloom_t *bloom);
+
+// Add the value of a field of a job
+void job_bloom_add(job_bloom_t bloom, int field, const char *value,
+    size_t len);
+
+// Tell if the value of a field may have been added
+int job_bloom_contains(const job_bloom_t bloom, int field, const char *value,
+    size_t len);
+
+// Count a job new to the day, and the number of jobs counted
+void job_bloom_count(job_bloom_t bloom);
+uint64_t job_bloom_jobs(const job_bloom_t bloom);
+
+// Size of the filter in bits, number of hash functions and number of bits
+// set, as reported by SLURMJC.BLOOM
+uint32_t job_bloom_bits(const job_bloom_t bloom);
+uint32_t job_bloom_hashes(const job_bloom_t bloom);
+uint64_t job_bloom_bits_set(const job_bloom_t bloom);
+
+// Serialized size of a filter, and its serialization into a buffer of that
+// size: bits, hashes and jobs, then the bit words, all little-endian
+size_t job_bloom_serialized_size(const job_bloom_t bloom);
+void job_bloom_serialize(const job_bloom_t bloom, char *buf);
+
+// Create a filter from its serialization; return NULL if it is invalid
+job_bloom_t job_bloom_deserialize(const char *buf, size_t len);
+
+// The job bloom filter of an open key, NULL if the key holds none
+job_bloom_t job_bloom_get(RedisModuleKey *key);
+
+// Module type callbacks of job bloom filters
+void *job_bloom_rdb_load(RedisModuleIO *rdb, int encver);
+void job_bloom_rdb_save(RedisModuleIO *rdb, void *value);
+void job_bloom_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key,
+    void *value);
+size_t job_bloom_mem_usage(const void *value);
+void job_bloom_digest(RedisModuleDigest *md, void *value);
+void job_bloom_free(void *value);
+
+#endif /* JOBCOMP_BLOOM_H */
@@ -29,16 +29,470 @@
 
 #include "jobcomp_command.h"
 
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 
 #include "common/iso8601_format.h"
 #include "common/redis_fields.h"
 #include "jobcomp_auto.h"
+#include "jobcomp_bitmap.h"
+#include "jobcomp_bloom.h"
+#include "jobcomp_compact.h"
 #include "jobcomp_query.h"
+#include "jobcomp_record.h"
+#include "jobcomp_segment.h"
+#include "jobcomp_worker.h"
+#include "jobcomp_zone.h"
+
+// Time-to-live of job and index keys in ms, JCR_TTL being in seconds
+#define JCR_TTL_MS ((mstime_t)JCR_TTL * 1000)
+
+/*
+ * Helper function which returns the index of a field label, -1 if the
+ * label is unknown
+ */
+static int field_index(const RedisModuleString *label)
+{
+    size_t len;
+    const char *field = RedisModule_StringPtrLen(label, &len);
+    int i = 0;
+    for (; i < MAX_REDIS_FIELDS; ++i) {
+        if ((strncmp(field, redis_field_labels[i], len) == 0) &&
+            (redis_field_labels[i][len] == '\0')) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Helper function which adds the job id to an index key: a job bitmap,
+ * created on first use, or a set of job ids written by an earlier release.
+ * The index time-to-live is applied and, if added is not NULL, whether the
+ * job id was new to the index is returned byref.  With check set, the key
+ * is only checked to be one the job id can be added to.  Returns QUERY_OK
+ * or QUERY_ERR, setting the error message byref
+ */
+static int index_set(RedisModuleCtx *ctx, RedisModuleString *idx,
+    RedisModuleString *jobid, int *added, int check, const char **err)
+{
+    long long id;
+    if ((RedisModule_StringToLongLong(jobid, &id) == REDISMODULE_ERR) ||
+        (id <= 0) || (id > UINT32_MAX)) {
+        *err = "invalid job id";
+        return QUERY_ERR;
+    }
+
+    AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(ctx, idx,
+        check ? REDISMODULE_READ : REDISMODULE_READ | REDISMODULE_WRITE);
+    int type = RedisModule_KeyType(key);
+    if (check) {
+        if ((type != REDISMODULE_KEYTYPE_EMPTY) &&
+            (type != REDISMODULE_KEYTYPE_SET) && !job_bitmap_get(key)) {
+            *err = REDISMODULE_ERRORMSG_WRONGTYPE;
+            return QUERY_ERR;
+        }
+        return QUERY_OK;
+    }
+    if (type == REDISMODULE_KEYTYPE_SET) {
+        AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(ctx,
+            "SADD", "ss", idx, jobid);
+        if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR) {
+            *err = "failed to update index";
+            return QUERY_ERR;
+        }
+        if (added) {
+            *added = (RedisModule_CallReplyInteger(reply) > 0);
+        }
+        if (JCR_TTL > 0) {
+            AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(ctx,
+                "EXPIRE", "sl", idx, JCR_TTL);
+            if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR) {
+                *err = "failed to set ttl on index";
+                return QUERY_ERR;
+            }
+        }
+        return QUERY_OK;
+    }
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        job_bitmap_t bitmap = create_job_bitmap();
+        if (RedisModule_ModuleTypeSetValue(key, job_bitmap_type, bitmap)
+            == REDISMODULE_ERR) {
+            destroy_job_bitmap(&bitmap);
+            *err = "failed to create index";
+            return QUERY_ERR;
+        }
+    }
+    job_bitmap_t bitmap = job_bitmap_get(key);
+    if (!bitmap) {
+        *err = REDISMODULE_ERRORMSG_WRONGTYPE;
+        return QUERY_ERR;
+    }
+    int is_new = job_bitmap_add(bitmap, (uint32_t)id);
+    if (added) {
+        *added = is_new;
+    }
+    if ((JCR_TTL > 0) &&
+        (RedisModule_SetExpire(key, JCR_TTL_MS) == REDISMODULE_ERR)) {
+        *err = "failed to set ttl on index";
+        return QUERY_ERR;
+    }
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which adds the job id to a sorted set of job ids scored by
+ * end time and applies the index time-to-live.  With check set, the key is
+ * only checked to be a sorted set or empty.  Returns QUERY_OK or QUERY_ERR,
+ * setting the error message byref
+ */
+static int index_time(RedisModuleCtx *ctx, RedisModuleString *tme,
+    RedisModuleString *jobid, long long end_time, int check, const char **err)
+{
+    if (check) {
+        AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(ctx, tme,
+            REDISMODULE_READ);
+        int type = RedisModule_KeyType(key);
+        if ((type != REDISMODULE_KEYTYPE_EMPTY) &&
+            (type != REDISMODULE_KEYTYPE_ZSET)) {
+            *err = REDISMODULE_ERRORMSG_WRONGTYPE;
+            return QUERY_ERR;
+        }
+        return QUERY_OK;
+    }
+    AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(ctx, "ZADD",
+        "sls", tme, end_time, jobid);
+    if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR) {
+        *err = "failed to update time index";
+        return QUERY_ERR;
+    }
+    if (JCR_TTL > 0) {
+        AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(ctx,
+            "EXPIRE", "sl", tme, JCR_TTL);
+        if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR) {
+            *err = "failed to set ttl on time index";
+            return QUERY_ERR;
+        }
+    }
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which widens the zone map of a day to cover the job and
+ * applies the index time-to-live.  With check set, the key is only checked
+ * to be a hash or empty.  Returns QUERY_OK or QUERY_ERR, setting the error
+ * message byref
+ */
+static int index_zone(RedisModuleCtx *ctx, RedisModuleString *zon,
+    const job_record_t *rec, int added, int check, const char **err)
+{
+    AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(ctx, zon,
+        check ? REDISMODULE_READ : REDISMODULE_READ | REDISMODULE_WRITE);
+    if (check) {
+        int type = RedisModule_KeyType(key);
+        if ((type != REDISMODULE_KEYTYPE_EMPTY) &&
+            (type != REDISMODULE_KEYTYPE_HASH)) {
+            *err = REDISMODULE_ERRORMSG_WRONGTYPE;
+            return QUERY_ERR;
+        }
+        return QUERY_OK;
+    }
+    job_zone_t zone;
+    if (job_zone_get(ctx, key, &zone) == QUERY_ERR) {
+        // A zone map which cannot be read is started over; it no longer
+        // covers every job of the day, so it is not trusted by MATCH
+        if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_HASH) {
+            *err = REDISMODULE_ERRORMSG_WRONGTYPE;
+            return QUERY_ERR;
+        }
+        RedisModule_DeleteKey(key);
+        memset(&zone, 0, sizeof(zone));
+    }
+    job_zone_add(&zone, rec, added);
+    if (job_zone_set(ctx, key, &zone) == QUERY_ERR) {
+        *err = "failed to update zone map";
+        return QUERY_ERR;
+    }
+    if ((JCR_TTL > 0) &&
+        (RedisModule_SetExpire(key, JCR_TTL_MS) == REDISMODULE_ERR)) {
+        *err = "failed to set ttl on zone map";
+        return QUERY_ERR;
+    }
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which adds the uid, gid, partition and job name of the job
+ * to the bloom filter of a day, created on first use, and applies the index
+ * time-to-live.  With check set, the key is only checked to be a bloom
+ * filter or empty.  Returns QUERY_OK or QUERY_ERR, setting the error message
+ * byref
+ */
+static int index_bloom(RedisModuleCtx *ctx, RedisModuleString *blm,
+    const job_record_t *rec, int added, int check, const char **err)
+{
+    static const int fields[] = { kUID, kGID, kPartition, kJobName };
+
+    AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(ctx, blm,
+        check ? REDISMODULE_READ : REDISMODULE_READ | REDISMODULE_WRITE);
+    if (check) {
+        if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) &&
+            !job_bloom_get(key)) {
+            *err = REDISMODULE_ERRORMSG_WRONGTYPE;
+            return QUERY_ERR;
+        }
+        return QUERY_OK;
+    }
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
+        job_bloom_t bloom = create_job_bloom(JCR_BLOOM_BITS,
+            JCR_BLOOM_HASHES);
+        if (RedisModule_ModuleTypeSetValue(key, job_bloom_type, bloom)
+            == REDISMODULE_ERR) {
+            destroy_job_bloom(&bloom);
+            *err = "failed to create bloom filter";
+            return QUERY_ERR;
+        }
+    }
+    job_bloom_t bloom = job_bloom_get(key);
+    if (!bloom) {
+        *err = REDISMODULE_ERRORMSG_WRONGTYPE;
+        return QUERY_ERR;
+    }
+    size_t i = 0;
+    for (; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+        char buf[JOB_RECORD_TEXT_SZ];
+        const char *text = NULL;
+        int len = job_record_text(rec, fields[i], buf, &text);
+        if (len >= 0) {
+            job_bloom_add(bloom, fields[i], text, len);
+        }
+    }
+    if (added) {
+        job_bloom_count(bloom);
+    }
+    if ((JCR_TTL > 0) &&
+        (RedisModule_SetExpire(key, JCR_TTL_MS) == REDISMODULE_ERR)) {
+        *err = "failed to set ttl on bloom filter";
+        return QUERY_ERR;
+    }
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which drops the job segment of a day if it holds the job,
+ * as a frozen day no longer describes a job which is stored again; the
+ * compaction timer does not visit the day again, so the day is matched key
+ * by key from here on.  A segment of the day still being built starts over
+ */
+static void index_thaw(RedisModuleCtx *ctx, const char *prefix,
+    long long day, long long jobid)
+{
+    if ((jobid <= 0) || (jobid > UINT32_MAX)) {
+        return;
+    }
+    jobcomp_compact_thaw(prefix, day, (uint32_t)jobid);
+    AUTO_RMSTR redis_module_string_t seg_name = {
+        .ctx = ctx,
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:seg:%lld", prefix,
+            day)
+    };
+    AUTO_RMKEY RedisModuleKey *seg_key = RedisModule_OpenKey(ctx,
+        seg_name.str, REDISMODULE_READ | REDISMODULE_WRITE);
+    job_segment_t seg = job_segment_get(seg_key);
+    if (seg && job_bitmap_contains(job_segment_jobs(seg), (uint32_t)jobid)) {
+        RedisModule_DeleteKey(seg_key);
+    }
+}
+
+/*
+ * Helper function which adds the job id to the daily index of its end time
+ * and to the daily indices of its attributes.  The name of the index key is
+ * returned byref on QUERY_OK, otherwise QUERY_ERR sets the error message
+ * byref.  With check set, nothing is written: the index keys are only
+ * checked to be of a type the job can be added to, and no name is returned
+ */
+static int index_add(RedisModuleCtx *ctx, const char *prefix,
+    RedisModuleString *jobid, const job_record_t *rec, long long end_time,
+    int check, RedisModuleString **idx_name, const char **err)
+{
+    long long end_days = end_time / SECONDS_PER_DAY;
+    RedisModuleString *idx = RedisModule_CreateStringPrintf(ctx,
+        "%s:idx:end:%lld", prefix, end_days);
+    int added = 0;
+    if (index_set(ctx, idx, jobid, &added, check, err) == QUERY_ERR) {
+        RedisModule_FreeString(ctx, idx);
+        return QUERY_ERR;
+    }
+
+    // The zone map of the day, counting the job only once
+    AUTO_RMSTR redis_module_string_t zon = {
+        .ctx = ctx,
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:zon:%lld", prefix,
+            end_days)
+    };
+    if (index_zone(ctx, zon.str, rec, added, check, err) == QUERY_ERR) {
+        RedisModule_FreeString(ctx, idx);
+        return QUERY_ERR;
+    }
+
+    // The bloom filter of the day
+    if (JCR_BLOOM_BITS > 0) {
+        AUTO_RMSTR redis_module_string_t blm = {
+            .ctx = ctx,
+            .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:blm:%lld",
+                prefix, end_days)
+        };
+        if (index_bloom(ctx, blm.str, rec, added, check, err)
+            == QUERY_ERR) {
+            RedisModule_FreeString(ctx, idx);
+            return QUERY_ERR;
+        }
+    }
+
+    // The job id index, for queries on job ids and job id ranges
+    AUTO_RMSTR redis_module_string_t ids = {
+        .ctx = ctx,
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:job", prefix)
+    };
+    if (index_set(ctx, ids.str, jobid, NULL, check, err) == QUERY_ERR) {
+        RedisModule_FreeString(ctx, idx);
+        return QUERY_ERR;
+    }
+
+    // The attribute indices of the day
+    int i = 0;
+    for (; i < MAX_ATTR_INDEXES; ++i) {
+        char buf[JOB_RECORD_TEXT_SZ];
+        const char *text = NULL;
+        int len = job_record_text(rec, attr_index_field[i], buf, &text);
+        if (len < 0) {
+            continue;
+        }
+        AUTO_RMSTR redis_module_string_t attr = {
+            .ctx = ctx,
+            .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:%s:%lld:%.*s",
+                prefix, attr_index_tag[i], end_days, len, text)
+        };
+        if (index_set(ctx, attr.str, jobid, NULL, check, err) == QUERY_ERR) {
+            RedisModule_FreeString(ctx, idx);
+            return QUERY_ERR;
+        }
+    }
+
+    // The end time index of the day
+    AUTO_RMSTR redis_module_string_t tme = {
+        .ctx = ctx,
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:tme:%lld", prefix,
+            end_days)
+    };
+    if (index_time(ctx, tme.str, jobid, end_time, check, err)
+        == QUERY_ERR) {
+        RedisModule_FreeString(ctx, idx);
+        return QUERY_ERR;
+    }
+
+    // The days the job ran on, for overlap queries
+    long long start_time;
+    if ((job_record_time(rec, kStart, &start_time) != 0) ||
+        (start_time <= 0) || (start_time > end_time)) {
+        start_time = end_time;
+    }
+    long long day = start_time / SECONDS_PER_DAY;
+    if (end_days - day >= JOB_RUN_DAYS_MAX) {
+        AUTO_RMSTR redis_module_string_t lng = {
+            .ctx = ctx,
+            .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:lng", prefix)
+        };
+        if (index_set(ctx, lng.str, jobid, NULL, check, err) == QUERY_ERR) {
+            RedisModule_FreeString(ctx, idx);
+            return QUERY_ERR;
+        }
+        day = end_days + 1;
+    }
+    for (; day <= end_days; ++day) {
+        AUTO_RMSTR redis_module_string_t run = {
+            .ctx = ctx,
+            .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:run:%lld",
+                prefix, day)
+        };
+        if (index_set(ctx, run.str, jobid, NULL, check, err) == QUERY_ERR) {
+            RedisModule_FreeString(ctx, idx);
+            return QUERY_ERR;
+        }
+    }
+
+    // Only now is the job trusted to be in the attribute and time indices
+    AUTO_RMSTR redis_module_string_t att = {
+        .ctx = ctx,
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:att:%lld", prefix,
+            end_days)
+    };
+    if (index_set(ctx, att.str, jobid, NULL, check, err) == QUERY_ERR) {
+        RedisModule_FreeString(ctx, idx);
+        return QUERY_ERR;
+    }
+
+    if (check) {
+        RedisModule_FreeString(ctx, idx);
+        return QUERY_OK;
+    }
+    *idx_name = idx;
+    return QUERY_OK;
+}
 
 /*
- * SLURMJC.INDEX <prefix> <job id>
+ * Helper function which indexes one job, see SLURMJC.INDEX.  The name of the
+ * index key is returned byref on QUERY_OK, QUERY_NULL means the job key does
+ * not exist and QUERY_ERR sets the error message byref
+ */
+static int index_job(RedisModuleCtx *ctx, const char *prefix,
+    RedisModuleString *jobid, RedisModuleString **idx_name, const char **err)
+{
+    AUTO_RMSTR redis_module_string_t job_keyname = {
+        .ctx = ctx,
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:%s", prefix,
+            RedisModule_StringPtrLen(jobid, NULL))
+    };
+
+    // Open the job key: a job value, a packed job record or a job hash
+    AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(ctx,
+        job_keyname.str, REDISMODULE_READ);
+    int rc = job_record_key(key);
+    if (rc == QUERY_NULL) {
+        return QUERY_NULL;
+    }
+    if (rc == QUERY_ERR) {
+        *err = REDISMODULE_ERRORMSG_WRONGTYPE;
+        return QUERY_ERR;
+    }
+
+    // Fetch the needed job data; a job value has the end time typed
+    job_record_t rec;
+    AUTO_RMFIELDS redis_module_fields_t fields = { .ctx = ctx };
+    if (job_record_load(key, &rec, &fields) != QUERY_OK) {
+        *err = "invalid job record";
+        return QUERY_ERR;
+    }
+    long long end_time;
+    const job_value_t *v = job_value_get(key);
+    if (v ? !(v->typed & JOB_FIELD_BIT(kEnd)) :
+        (job_record_time(&rec, kEnd, &end_time) != 0)) {
+        *err = "invalid end date/time";
+        return QUERY_ERR;
+    }
+    if (v) {
+        end_time = v->end_time;
+    }
+
+    // Create or update the indices
+    return index_add(ctx, prefix, jobid, &rec, end_time, 0, idx_name, err);
+}
+
+/*
+ * SLURMJC.INDEX <prefix> <job id> [<job id> ...]
  *
  * This command will index the job in redis. The indexing scheme is as follows:
  * Read the end date/time of the job and determine how many days that is since
@@ -46,93 +500,197 @@
  * value, adding the job id to the set.  In other words, we place each job id
  * into a daily bucket corresponding to its end time.
  *
+ * Each index key is a job bitmap, see jobcomp_bitmap.h; sets written by an
+ * earlier release are kept up to date as sets.  The job id is also added to
+ * daily bitmaps for its uid, gid, partition, state and job name,
+ * <prefix>:idx:<tag>:<days>:<value>, see jobcomp_query.h, to the sorted
+ * set of the jobs of the day scored by end time, <prefix>:idx:tme:<days>,
+ * to the bitmaps of the days the job ran on, <prefix>:idx:run:<days>, and
+ * then to the bitmap of the jobs of the day held in those,
+ * <prefix>:idx:att:<days>.  Every job id also goes into the job id index,
+ * <prefix>:idx:job, a single bitmap of all indexed jobs.  The zone map of
+ * the day, <prefix>:idx:zon:<days>, is widened to cover the job, see
+ * jobcomp_zone.h, and its uid, gid, partition and job name are added to the
+ * bloom filter of the day, <prefix>:idx:blm:<days>, see jobcomp_bloom.h.
+ *
  * When job query criteria arrives during the match process, it may or may not
- * have explicit job ids enumerated.  If it does have job ids, we do not need
- * to inspect any index at all, since we have direct access to each job key.
- * If the criteria has no job ids, however, we look at the time range of the
- * query, determine which indices need to be opened and visit the jobs in each
- * index, asking if the job matches the rest of the criteria
+ * have explicit job ids enumerated.  If it does have job ids or job id
+ * ranges, we need not inspect the daily indices: the ids are intersected
+ * with the job id index a range at a time, and only the jobs found there
+ * are opened.  If the criteria has no job ids, however, we look at the time
+ * range of the query and determine which indices need to be opened.  With
+ * criteria on the indexed attributes, the candidates of each day are
+ * computed as bitmap algebra over the attribute bitmaps, and on days the
+ * time range covers only in part they are narrowed to the jobs ending
+ * within it, read off the end time index; otherwise we visit every job in
+ * the daily index, asking if the job matches the rest of the criteria.  A
+ * query for the jobs which ran at any time during the range visits the run
+ * indices of its days.  Days whose zone map or bloom filter rules out
+ * every job are skipped.
+ *
+ * Days which have closed are frozen in the background into job segments,
+ * <prefix>:idx:seg:<days>, see jobcomp_compact.h; the jobs of a segment are
+ * matched by scanning its columns, without opening their keys.
+ *
+ * A single job id replies with the name of its index key.  Several job ids,
+ * as sent by the writer when it commits a batch of jobs, reply with an array
+ * holding the index key name, nil or an error for each job in turn
  */
 int jobcomp_cmd_index(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
     RedisModule_AutoMemory(ctx);
-    if (argc != 3) {
+    if (argc < 3) {
         return RedisModule_WrongArity(ctx);
     }
 
     const char *prefix = RedisModule_StringPtrLen(argv[1], NULL);
-    const char *jobid = RedisModule_StringPtrLen(argv[2], NULL);
-    AUTO_RMSTR redis_module_string_t job_keyname = {
-        .ctx = ctx,
-        .str = RedisModule_CreateStringPrintf(ctx, "%s:%s", prefix, jobid)
-    };
+    const char *err = NULL;
+    jobcomp_compact_prefix(prefix);
 
-    // Open the job key
-    AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(ctx,
-        job_keyname.str, REDISMODULE_READ);
-    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
-        RedisModule_ReplyWithNull(ctx);
+    if (argc == 3) {
+        AUTO_RMSTR redis_module_string_t idx = { .ctx = ctx };
+        int rc = index_job(ctx, prefix, argv[2], &idx.str, &err);
+        if (rc == QUERY_ERR) {
+            RedisModule_ReplyWithError(ctx, err);
+            return REDISMODULE_ERR;
+        }
+        if (rc == QUERY_NULL) {
+            RedisModule_ReplyWithNull(ctx);
+            return REDISMODULE_OK;
+        }
+        RedisModule_ReplyWithString(ctx, idx.str);
         return REDISMODULE_OK;
     }
-    if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_HASH) {
-        RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
-        return REDISMODULE_ERR;
+
+    RedisModule_ReplyWithArray(ctx, argc - 2);
+    int i = 2;
+    for (; i < argc; ++i) {
+        AUTO_RMSTR redis_module_string_t idx = { .ctx = ctx };
+        int rc = index_job(ctx, prefix, argv[i], &idx.str, &err);
+        if (rc == QUERY_ERR) {
+            RedisModule_ReplyWithError(ctx, err);
+        } else if (rc == QUERY_NULL) {
+            RedisModule_ReplyWithNull(ctx);
+        } else {
+            RedisModule_ReplyWithString(ctx, idx.str);
+        }
     }
+    return REDISMODULE_OK;
+}
 
-    // Fetch the needed job data
-    AUTO_RMSTR redis_module_string_t abi = { .ctx = ctx };
-    AUTO_RMSTR redis_module_string_t tmf = { .ctx = ctx };
-    AUTO_RMSTR redis_module_string_t end = { .ctx = ctx };
-    if (RedisModule_HashGet(key, REDISMODULE_HASH_CFIELDS,
-        redis_field_labels[kABI], &abi.str,
-        redis_field_labels[kTimeFormat], &tmf.str,
-        redis_field_labels[kEnd], &end.str,
-        NULL) == REDISMODULE_ERR) {
-        RedisModule_ReplyWithError(ctx, "expected field(s) missing");
-        return REDISMODULE_ERR;
+/*
+ * SLURMJC.STORE <prefix> <job id> <field> <value> [<field> <value> ...]
+ *
+ * This command stores a completed job in one atomic step: it packs the
+ * field-value pairs into a job value of the job record module type (see
+ * jobcomp_record.h) stored on the key <prefix>:<job id>, replacing any
+ * previous record or job hash, applies the key time-to-live (JCR_TTL) and
+ * adds the job to the daily index of its end time, see SLURMJC.INDEX.
+ * Field names are not stored with each job, integers and date/times are
+ * packed as varints and the fields used to match jobs are kept typed.  No
+ * MULTI/EXEC transaction is needed around the write.  The job id, the job
+ * record and the types of the index keys are checked before any key is
+ * written; once one is, the command is replicated even if it then fails.
+ * Replies with the name of the index key
+ */
+int jobcomp_cmd_store(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    RedisModule_AutoMemory(ctx);
+    if ((argc < 5) || ((argc - 3) % 2)) {
+        return RedisModule_WrongArity(ctx);
     }
 
-    long long _tmf;
-    if (RedisModule_StringToLongLong(tmf.str, &_tmf) == REDISMODULE_ERR) {
-        RedisModule_ReplyWithError(ctx, "invalid _tmf");
+    const char *prefix = RedisModule_StringPtrLen(argv[1], NULL);
+    const char *err = NULL;
+    long long jobid;
+    if ((RedisModule_StringToLongLong(argv[2], &jobid) == REDISMODULE_ERR) ||
+        (jobid <= 0) || (jobid > UINT32_MAX)) {
+        RedisModule_ReplyWithError(ctx, "invalid job id");
         return REDISMODULE_ERR;
     }
 
-    long long end_time;
-    if (_tmf == 1) {
-        end_time = mk_time(RedisModule_StringPtrLen(end.str, NULL));
-        if (end_time == (-1)) {
-            RedisModule_ReplyWithError(ctx, "invalid iso8601 end date/time");
-            return REDISMODULE_ERR;
-        }
-    } else {
-        if (RedisModule_StringToLongLong(end.str, &end_time)
-            == REDISMODULE_ERR) {
-            RedisModule_ReplyWithError(ctx, "invalid end date/time");
+    // Order the field values by field index
+    const char *value[MAX_REDIS_FIELDS] = {0};
+    size_t len[MAX_REDIS_FIELDS] = {0};
+    int i = 3;
+    for (; i < argc; i += 2) {
+        int field = field_index(argv[i]);
+        if (field < 0) {
+            RedisModule_ReplyWithError(ctx, "unknown job field");
             return REDISMODULE_ERR;
         }
+        value[field] = RedisModule_StringPtrLen(argv[i + 1], &len[field]);
     }
 
-    // Create or update the index
-    long long end_days = end_time / SECONDS_PER_DAY;
-    AUTO_RMSTR redis_module_string_t idx = {
+    // Open the job key
+    AUTO_RMSTR redis_module_string_t job_keyname = {
         .ctx = ctx,
-        .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:end:%lld",
-            prefix, end_days)
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:%s", prefix,
+            RedisModule_StringPtrLen(argv[2], NULL))
     };
-    AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(ctx, "SADD",
-        "sc", idx.str, jobid);
-    if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR) {
-        RedisModule_ReplyWithCallReply(ctx, reply);
+    AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(ctx,
+        job_keyname.str, REDISMODULE_READ | REDISMODULE_WRITE);
+    if (job_record_key(key) == QUERY_ERR) {
+        RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
         return REDISMODULE_ERR;
     }
-    if (JCR_TTL > 0) {
-        AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(ctx,
-            "EXPIRE", "sl", idx.str, JCR_TTL);
-        if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR) {
-            RedisModule_ReplyWithCallReply(ctx, reply);
-            return REDISMODULE_ERR;
+
+    // Pack the job value, the end time is needed for the index
+    job_value_t *v = job_value_pack(value, len);
+    if (!v || !(v->typed & JOB_FIELD_BIT(kEnd))) {
+        if (v) {
+            job_record_free(v);
         }
+        RedisModule_ReplyWithError(ctx, "invalid end date/time");
+        return REDISMODULE_ERR;
+    }
+    long long end_time = v->end_time;
+
+    // Check the record and the index keys before anything is written; the
+    // record points into the packed value, which the key owns once stored
+    job_record_t rec;
+    if (job_record_unpack(v->packed, v->packed_sz, &rec) != 0) {
+        job_record_free(v);
+        RedisModule_ReplyWithError(ctx, "invalid job record");
+        return REDISMODULE_ERR;
+    }
+    if (index_add(ctx, prefix, argv[2], &rec, end_time, 1, NULL, &err)
+        == QUERY_ERR) {
+        job_record_free(v);
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_ERR;
+    }
+
+    // A job stored again thaws the frozen days which hold it
+    const job_value_t *old = job_value_get(key);
+    long long old_days = (old && (old->typed & JOB_FIELD_BIT(kEnd))) ?
+        old->end_time / SECONDS_PER_DAY : -1;
+    jobcomp_compact_prefix(prefix);
+
+    // Replace the job record; the key owns the value from here
+    if (RedisModule_ModuleTypeSetValue(key, job_record_type, v)
+        == REDISMODULE_ERR) {
+        job_record_free(v);
+        RedisModule_ReplyWithError(ctx, "failed to store job");
+        return REDISMODULE_ERR;
+    }
+    RedisModule_ReplicateVerbatim(ctx);
+    if ((JCR_TTL > 0) &&
+        (RedisModule_SetExpire(key, JCR_TTL_MS) == REDISMODULE_ERR)) {
+        RedisModule_ReplyWithError(ctx, "failed to set ttl on job");
+        return REDISMODULE_ERR;
+    }
+
+    // Create or update the indices
+    AUTO_RMSTR redis_module_string_t idx = { .ctx = ctx };
+    if (index_add(ctx, prefix, argv[2], &rec, end_time, 0, &idx.str, &err)
+        == QUERY_ERR) {
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_ERR;
+    }
+    index_thaw(ctx, prefix, end_time / SECONDS_PER_DAY, jobid);
+    if ((old_days >= 0) && (old_days != end_time / SECONDS_PER_DAY)) {
+        index_thaw(ctx, prefix, old_days, jobid);
     }
 
     RedisModule_ReplyWithString(ctx, idx.str);
@@ -140,79 +698,388 @@ int jobcomp_cmd_index(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 }
 
 /*
- * SLURMJC.MATCH <prefix> <uuid>
+ * SLURMJC.LOAD <key> <packed job record>
  *
- * This command matches jobs in redis to the criteria sent from slurm.
- * A job query object is created which reads the job criteria from the query
- * keys, then a request to match jobs is issued.  If there are any matching
- * jobs, a match key is created corresponding to the uuid of the request and
- * that match key name is returned to the caller.  If the caller receives a
- * match set name, the command SLURMJC.FETCH command can be issued to return
- * the job data of the jobs in the matchset.  The matchset key has a limited
- * TTL and will be deleted automatically if not read promptly by the caller
+ * This command sets a job key to a job value holding the packed job record,
+ * as it was persisted.  It is emitted by the AOF rewrite of job values and
+ * neither indexes the job nor touches the key time-to-live, both of which
+ * are rewritten on their own.  Replies OK
  */
-int jobcomp_cmd_match(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+int jobcomp_cmd_load(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
     RedisModule_AutoMemory(ctx);
     if (argc != 3) {
         return RedisModule_WrongArity(ctx);
     }
 
+    AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ | REDISMODULE_WRITE);
+    if (job_record_key(key) == QUERY_ERR) {
+        RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+        return REDISMODULE_ERR;
+    }
+
+    size_t len = 0;
+    const char *packed = RedisModule_StringPtrLen(argv[2], &len);
+    job_value_t *v = job_value_create(packed, len);
+    if (!v) {
+        RedisModule_ReplyWithError(ctx, "invalid job record");
+        return REDISMODULE_ERR;
+    }
+    if (RedisModule_ModuleTypeSetValue(key, job_record_type, v)
+        == REDISMODULE_ERR) {
+        job_record_free(v);
+        RedisModule_ReplyWithError(ctx, "failed to store job");
+        return REDISMODULE_ERR;
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+    return REDISMODULE_OK;
+}
+
+/*
+ * SLURMJC.IDXLOAD <key> <serialized job bitmap>
+ *
+ * This command sets an index key to a job bitmap in its serialized form,
+ * see jobcomp_bitmap.h.  It is emitted by the AOF rewrite of job bitmaps.
+ * Replies OK
+ */
+int jobcomp_cmd_idxload(RedisModuleCtx *ctx, RedisModuleString **argv,
+    int argc)
+{
+    RedisModule_AutoMemory(ctx);
+    if (argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ | REDISMODULE_WRITE);
+    int type = RedisModule_KeyType(key);
+    if ((type != REDISMODULE_KEYTYPE_EMPTY) && !job_bitmap_get(key)) {
+        RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+        return REDISMODULE_ERR;
+    }
+
+    size_t len = 0;
+    const char *buf = RedisModule_StringPtrLen(argv[2], &len);
+    job_bitmap_t bitmap = job_bitmap_deserialize(buf, len);
+    if (!bitmap) {
+        RedisModule_ReplyWithError(ctx, "invalid job index");
+        return REDISMODULE_ERR;
+    }
+    if (RedisModule_ModuleTypeSetValue(key, job_bitmap_type, bitmap)
+        == REDISMODULE_ERR) {
+        destroy_job_bitmap(&bitmap);
+        RedisModule_ReplyWithError(ctx, "failed to store job index");
+        return REDISMODULE_ERR;
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+    return REDISMODULE_OK;
+}
+
+// A job query run by SLURMJC.MATCH, with its budget and the continuation
+// token it resumes from if any, and its outcome: the name of the match set
+// and the continuation token of a query whose budget ran out, or an error.
+// The query lives from match_begin to match_end
+typedef struct {
+    RedisModuleBlockedClient *bc;
+    RedisModuleCtx *ctx;
+    char *prefix;
+    char *uuid;
+    long long budget;
+    int budget_unit;
+    char *resume;
+    job_query_t qry;
+    RedisModuleString *matchset;
     int rc;
-    const char *prefix = RedisModule_StringPtrLen(argv[1], NULL);
-    const char *uuid = RedisModule_StringPtrLen(argv[2], NULL);
-    const char *err = NULL;
+    char *reply;
+    char token[QUERY_TOKEN_SZ];
+} match_work_t;
+
+/*
+ * Helper function which frees a job query run by SLURMJC.MATCH, along with
+ * the thread safe context of a blocked client
+ */
+static void destroy_match_work(match_work_t *work)
+{
+    if (work) {
+        if (work->bc) {
+            RedisModule_FreeThreadSafeContext(work->ctx);
+        }
+        RedisModule_Free(work->prefix);
+        RedisModule_Free(work->uuid);
+        if (work->resume) {
+            RedisModule_Free(work->resume);
+        }
+        if (work->reply) {
+            RedisModule_Free(work->reply);
+        }
+        RedisModule_Free(work);
+    }
+}
+
+/*
+ * Helper function which creates and prepares the job query of SLURMJC.MATCH
+ * on a context which outlives the command for a blocked client, resuming it
+ * from a continuation token if given one
+ */
+static void match_begin(RedisModuleCtx *ctx, match_work_t *work)
+{
+    work->ctx = ctx;
     job_query_init_t init = {
         .ctx = ctx,
-        .prefix = prefix,
-        .uuid = uuid,
+        .prefix = work->prefix,
+        .uuid = work->uuid,
+        .slice = JCR_MATCH_SLICE,
+        .budget = work->budget,
+        .budget_unit = work->budget_unit
     };
-    AUTO_PTR(destroy_job_query) job_query_t qry = create_job_query(&init);
-    rc = job_query_prepare(qry);
-    if (rc == QUERY_ERR) {
-        job_query_error(qry, &err, NULL);
-        RedisModule_ReplyWithError(ctx, err);
-        return REDISMODULE_ERR;
+    work->qry = create_job_query(&init);
+    work->matchset = RedisModule_CreateStringPrintf(ctx, "%s:mat:%s",
+        work->prefix, work->uuid);
+    work->rc = job_query_prepare(work->qry);
+    if ((work->rc == QUERY_OK) && work->resume) {
+        work->rc = job_query_resume(work->qry, work->resume);
     }
-    if (rc == QUERY_NULL) {
-        RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
+    if (work->rc == QUERY_OK) {
+        work->rc = QUERY_PASS;
     }
+}
 
-    AUTO_RMSTR redis_module_string_t matchset = {
-        .ctx = ctx,
-        .str = RedisModule_CreateStringPrintf(ctx, "%s:mat:%s", prefix, uuid)
-    };
+/*
+ * Helper function which gives the match set of a job query the query ttl,
+ * frees the query and leaves the outcome on the work for match_reply.  The
+ * query keys of a query whose budget ran out are given the query ttl
+ * again, for the query which resumes from its continuation token
+ */
+static void match_end(match_work_t *work)
+{
+    RedisModuleCtx *ctx = work->ctx;
+    const char *err = NULL;
+    if ((work->rc == QUERY_OK) &&
+        (job_query_token(work->qry, work->token) == QUERY_PASS) &&
+        (job_query_expire(work->qry, JCR_QUERY_TTL * 1000) == QUERY_ERR)) {
+        work->rc = QUERY_ERR;
+    }
+    if (work->rc == QUERY_ERR) {
+        job_query_error(work->qry, &err, NULL);
+        work->reply = RedisModule_Strdup(err);
+    } else if (work->rc == QUERY_OK) {
+        AUTO_RMKEY RedisModuleKey *matchset_key = RedisModule_OpenKey(ctx,
+            work->matchset, REDISMODULE_WRITE);
+        if (RedisModule_KeyType(matchset_key) == REDISMODULE_KEYTYPE_EMPTY) {
+            work->rc = QUERY_NULL;
+        } else if (RedisModule_KeyType(matchset_key) !=
+            REDISMODULE_KEYTYPE_ZSET) {
+            work->rc = QUERY_ERR;
+            work->reply = RedisModule_Strdup(REDISMODULE_ERRORMSG_WRONGTYPE);
+        } else if (RedisModule_SetExpire(matchset_key, JCR_QUERY_TTL * 1000)
+            == REDISMODULE_ERR) {
+            work->rc = QUERY_ERR;
+            work->reply = RedisModule_Strdup("failed to set ttl on match set");
+        } else {
+            work->reply = RedisModule_Strdup(
+                RedisModule_StringPtrLen(work->matchset, NULL));
+        }
+    }
+    destroy_job_query(&work->qry);
+    RedisModule_FreeString(ctx, work->matchset);
+    work->matchset = NULL;
+}
 
-    rc = job_query_match(qry, matchset.str);
-    if (rc == QUERY_ERR) {
-        job_query_error(qry, &err, NULL);
-        RedisModule_ReplyWithError(ctx, err);
+/*
+ * Helper function which runs one time slice of the job query of
+ * SLURMJC.MATCH, ending the query when it is done.  The slice is reported
+ * to the latency monitor as event "slurmjc-match".  Returns QUERY_PASS
+ * while jobs remain to be matched
+ */
+static int match_next(match_work_t *work)
+{
+    if (work->rc != QUERY_PASS) {
+        match_end(work);
+        return work->rc;
+    }
+    mstime_t t0 = RedisModule_Milliseconds();
+    work->rc = job_query_match_next(work->qry, work->matchset);
+    RedisModule_LatencyAddSample("slurmjc-match",
+        RedisModule_Milliseconds() - t0);
+    if (work->rc != QUERY_PASS) {
+        match_end(work);
+    }
+    return work->rc;
+}
+
+/*
+ * Helper function which replies with the outcome of SLURMJC.MATCH: the name
+ * of the match set, or with a budget the name of the match set and the
+ * continuation token, either of which may be nil
+ */
+static int match_reply(RedisModuleCtx *ctx, const match_work_t *work)
+{
+    if (work->rc == QUERY_ERR) {
+        RedisModule_ReplyWithError(ctx, work->reply);
         return REDISMODULE_ERR;
     }
-    if (rc == QUERY_NULL) {
+    if (work->budget) {
+        RedisModule_ReplyWithArray(ctx, 2);
+    }
+    if (work->rc == QUERY_NULL) {
         RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
+    } else {
+        RedisModule_ReplyWithStringBuffer(ctx, work->reply,
+            strlen(work->reply));
+    }
+    if (work->budget) {
+        if (work->token[0]) {
+            RedisModule_ReplyWithStringBuffer(ctx, work->token,
+                strlen(work->token));
+        } else {
+            RedisModule_ReplyWithNull(ctx);
+        }
     }
+    return REDISMODULE_OK;
+}
 
-    AUTO_RMKEY RedisModuleKey *matchset_key = RedisModule_OpenKey(ctx,
-        matchset.str, REDISMODULE_WRITE);
-    if (RedisModule_KeyType(matchset_key) == REDISMODULE_KEYTYPE_EMPTY) {
-        RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
+/*
+ * Match worker: runs the job query of a blocked client under the redis
+ * module lock, handing the lock back to the event loop between time
+ * slices, then unblocks the client
+ */
+static void match_worker(void *arg)
+{
+    match_work_t *work = arg;
+    RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(work->bc);
+    jobcomp_worker_lock(ctx);
+    match_begin(ctx, work);
+    while (match_next(work) == QUERY_PASS) {
+        jobcomp_worker_yield(ctx);
     }
-    if (RedisModule_KeyType(matchset_key) != REDISMODULE_KEYTYPE_ZSET) {
-        RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
-        return REDISMODULE_ERR;
+    jobcomp_worker_unlock(ctx);
+    RedisModule_UnblockClient(work->bc, work);
+}
+
+/*
+ * Match timer: runs a time slice of the job query of a blocked client on
+ * the main thread, then either sets itself to run again on the next turn
+ * of the event loop or unblocks the client
+ */
+static void match_tick(RedisModuleCtx *ctx, void *data)
+{
+    match_work_t *work = data;
+    if (match_next(work) == QUERY_PASS) {
+        RedisModule_CreateTimer(ctx, 0, match_tick, work);
+        return;
     }
-    if (RedisModule_SetExpire(matchset_key, JCR_QUERY_TTL * 1000)
-        == REDISMODULE_ERR) {
-        RedisModule_ReplyWithError(ctx, "failed to set ttl on match set");
-        return REDISMODULE_ERR;
+    RedisModule_UnblockClient(work->bc, work);
+}
+
+/*
+ * Blocked client callbacks of SLURMJC.MATCH.  The match set is given its
+ * ttl before the client is unblocked, so nothing is left behind if the
+ * client went away
+ */
+static int match_unblocked(RedisModuleCtx *ctx, RedisModuleString **argv,
+    int argc)
+{
+    (void)argv;
+    (void)argc;
+    return match_reply(ctx, RedisModule_GetBlockedClientPrivateData(ctx));
+}
+
+static void match_free(RedisModuleCtx *ctx, void *privdata)
+{
+    (void)ctx;
+    destroy_match_work(privdata);
+}
+
+/*
+ * SLURMJC.MATCH <prefix> <uuid> [<budget> JOBS|KEYS|MS [<token>]]
+ *
+ * This command matches jobs in redis to the criteria sent from slurm.
+ * A job query object is created which reads the job criteria from the query
+ * keys, then a request to match jobs is issued.  If there are any matching
+ * jobs, a match key is created corresponding to the uuid of the request and
+ * that match key name is returned to the caller.  If the caller receives a
+ * match set name, the command SLURMJC.FETCH command can be issued to return
+ * the job data of the jobs in the matchset.  The matchset key has a limited
+ * TTL and will be deleted automatically if not read promptly by the caller.
+ *
+ * The client is blocked while a match worker thread runs the query, see
+ * jobcomp_worker.h, or without match threads while the query runs a time
+ * slice of JCR_MATCH_SLICE ms per turn of the event loop.  Within MULTI or
+ * a lua script, where clients cannot block, or with neither, the query is
+ * run here in one go
+ *
+ * With a budget, of jobs examined, keys opened or milliseconds, the query
+ * stops once the budget runs out and the reply is an array of the match
+ * set name and a continuation token, either of which may be nil.  The
+ * matches found so far can then be fetched, and the command issued again
+ * with the token to resume the query where it stopped, until no token is
+ * returned.  The query keys are given their ttl again with each token.
+ * The budget is checked between batches of jobs and between days, and
+ * never within a day held in a set of job ids by an earlier release
+ */
+int jobcomp_cmd_match(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if ((argc != 3) && (argc != 5) && (argc != 6)) {
+        return RedisModule_WrongArity(ctx);
     }
 
-    RedisModule_ReplyWithString(ctx, matchset.str);
-    return REDISMODULE_OK;
+    long long budget = 0;
+    int budget_unit = QUERY_BUDGET_JOBS;
+    if (argc > 3) {
+        const char *unit = RedisModule_StringPtrLen(argv[4], NULL);
+        if ((RedisModule_StringToLongLong(argv[3], &budget)
+            != REDISMODULE_OK) || (budget <= 0)) {
+            RedisModule_ReplyWithError(ctx, "invalid budget");
+            return REDISMODULE_ERR;
+        }
+        if (!strcasecmp(unit, "JOBS")) {
+            budget_unit = QUERY_BUDGET_JOBS;
+        } else if (!strcasecmp(unit, "KEYS")) {
+            budget_unit = QUERY_BUDGET_KEYS;
+        } else if (!strcasecmp(unit, "MS")) {
+            budget_unit = QUERY_BUDGET_MS;
+        } else {
+            RedisModule_ReplyWithError(ctx, "invalid budget unit");
+            return REDISMODULE_ERR;
+        }
+    }
+
+    match_work_t *work = RedisModule_Calloc(1, sizeof(match_work_t));
+    work->prefix = RedisModule_Strdup(RedisModule_StringPtrLen(argv[1], NULL));
+    work->uuid = RedisModule_Strdup(RedisModule_StringPtrLen(argv[2], NULL));
+    work->budget = budget;
+    work->budget_unit = budget_unit;
+    if (argc > 5) {
+        work->resume = RedisModule_Strdup(
+            RedisModule_StringPtrLen(argv[5], NULL));
+    }
+    jobcomp_compact_prefix(work->prefix);
+
+    if ((jobcomp_worker_threads() || JCR_MATCH_SLICE) &&
+        !(RedisModule_GetContextFlags(ctx) &
+        (REDISMODULE_CTX_FLAGS_MULTI | REDISMODULE_CTX_FLAGS_LUA))) {
+        work->bc = RedisModule_BlockClient(ctx, match_unblocked, NULL,
+            match_free, 0);
+        if (jobcomp_worker_threads()) {
+            jobcomp_worker_submit(match_worker, work);
+        } else {
+            match_begin(RedisModule_GetThreadSafeContext(work->bc), work);
+            match_tick(ctx, work);
+        }
+        return REDISMODULE_OK;
+    }
+
+    match_begin(ctx, work);
+    while (match_next(work) == QUERY_PASS) {
+    }
+    int rc = match_reply(ctx, work);
+    destroy_match_work(work);
+    return rc;
 }
 
 /*
@@ -231,7 +1098,6 @@ int jobcomp_cmd_match(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
  */
 int jobcomp_cmd_fetch(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
-    RedisModule_AutoMemory(ctx);
     if (argc != 4) {
         return RedisModule_WrongArity(ctx);
     }
@@ -239,10 +1105,10 @@ int jobcomp_cmd_fetch(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     long long max_count, count = 0;
     const char *prefix = RedisModule_StringPtrLen(argv[1], NULL);
     const char *uuid = RedisModule_StringPtrLen(argv[2], NULL);
-    AUTO_RMSTR redis_module_string_t matchset;
-        matchset.ctx = ctx;
-        matchset.str = RedisModule_CreateStringPrintf(ctx, "%s:mat:%s",
-            prefix, uuid);
+    AUTO_RMSTR redis_module_string_t matchset = {
+        .ctx = ctx,
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:mat:%s", prefix, uuid)
+    };
 
     if (RedisModule_StringToLongLong(argv[3], &max_count) != REDISMODULE_OK) {
         RedisModule_ReplyWithError(ctx, "invalid max count");
@@ -253,84 +1119,136 @@ int jobcomp_cmd_fetch(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     }
     RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
 
+    AUTO_RMKEY RedisModuleKey *matchset_key = RedisModule_OpenKey(ctx,
+        matchset.str, REDISMODULE_READ | REDISMODULE_WRITE);
+    if ((RedisModule_KeyType(matchset_key) != REDISMODULE_KEYTYPE_ZSET) ||
+        (RedisModule_ZsetFirstInScoreRange(matchset_key,
+        REDISMODULE_NEGATIVE_INFINITE, REDISMODULE_POSITIVE_INFINITE, 0, 0)
+        == REDISMODULE_ERR)) {
+        RedisModule_ReplySetArrayLength(ctx, 0);
+        return REDISMODULE_OK;
+    }
+
+    // Read the match set in job id order; the jobs read are removed from it
+    // once the range is done with
+    AUTO_RMARENA redis_module_arena_t arena;
+    init_redis_module_arena(&arena, ctx, prefix);
+    AUTO_RMMEM RedisModuleString **read = NULL;
+    size_t read_sz = 0, read_cap = 0, r;
     count = 0;
-    while (count < max_count) {
-        AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(ctx,
-            "ZPOPMIN", "sl", matchset.str, JCR_FETCH_COUNT);
-        if ((RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_NULL) ||
-            (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY) ||
-            (RedisModule_CallReplyLength(reply)) == 0) {
+    for (; (count < max_count) &&
+        !RedisModule_ZsetRangeEndReached(matchset_key);
+        RedisModule_ZsetRangeNext(matchset_key)) {
+        RedisModuleString *job = RedisModule_ZsetRangeCurrentElement(
+            matchset_key, NULL);
+        if (!job) {
             break;
         }
-        size_t s = 0;
-        for (; (s < RedisModule_CallReplyLength(reply)) && (count < max_count);
-            s += 2) {
-            RedisModuleCallReply *subreply = // no AUTO_RMREPLY
-                RedisModule_CallReplyArrayElement(reply, s);
-            AUTO_RMSTR redis_module_string_t job = {
-                .ctx = ctx,
-                .str = RedisModule_CreateStringFromCallReply(subreply)
-            };
-            long long jobid;
-            if (RedisModule_StringToLongLong(job.str, &jobid)
-                == REDISMODULE_ERR) {
-                continue;
-            }
-            AUTO_RMSTR redis_module_string_t job_keyname = {
-                .ctx = ctx,
-                .str = RedisModule_CreateStringPrintf(ctx, "%s:%lld",
-                    prefix, jobid)
-            };
-            AUTO_RMKEY RedisModuleKey *job_key = RedisModule_OpenKey(ctx,
-                job_keyname.str, REDISMODULE_READ);
-            if (RedisModule_KeyType(job_key) == REDISMODULE_KEYTYPE_EMPTY) {
-                continue;
-            }
-            AUTO_RMFIELDS redis_module_fields_t fields = { .ctx = ctx };
-            if (RedisModule_HashGet(job_key, REDISMODULE_HASH_CFIELDS,
-                redis_field_labels[0], &fields.str[0],
-                redis_field_labels[1], &fields.str[1],
-                redis_field_labels[2], &fields.str[2],
-                redis_field_labels[3], &fields.str[3],
-                redis_field_labels[4], &fields.str[4],
-                redis_field_labels[5], &fields.str[5],
-                redis_field_labels[6], &fields.str[6],
-                redis_field_labels[7], &fields.str[7],
-                redis_field_labels[8], &fields.str[8],
-                redis_field_labels[9], &fields.str[9],
-                redis_field_labels[10], &fields.str[10],
-                redis_field_labels[11], &fields.str[11],
-                redis_field_labels[12], &fields.str[12],
-                redis_field_labels[13], &fields.str[13],
-                redis_field_labels[14], &fields.str[14],
-                redis_field_labels[15], &fields.str[15],
-                redis_field_labels[16], &fields.str[16],
-                redis_field_labels[17], &fields.str[17],
-                redis_field_labels[18], &fields.str[18],
-                redis_field_labels[19], &fields.str[19],
-                redis_field_labels[20], &fields.str[20],
-                redis_field_labels[21], &fields.str[21],
-                redis_field_labels[22], &fields.str[22],
-                redis_field_labels[23], &fields.str[23],
-                redis_field_labels[24], &fields.str[24],
-                redis_field_labels[25], &fields.str[25],
-                redis_field_labels[26], &fields.str[26],
-                redis_field_labels[27], &fields.str[27],
-                NULL) == REDISMODULE_ERR) {
-                    continue;
-            }
-            RedisModule_ReplyWithArray(ctx, MAX_REDIS_FIELDS);
-            int i = 0;
-            for (; i < MAX_REDIS_FIELDS; ++i) {
-                if (fields.str[i]) {
-                    RedisModule_ReplyWithString(ctx, fields.str[i]);
-                } else {
-                    RedisModule_ReplyWithNull(ctx);
-                }
+        if (read_sz == read_cap) {
+            read_cap = read_cap ? 2 * read_cap : JCR_FETCH_COUNT;
+            read = RedisModule_Realloc(read,
+                read_cap * sizeof(RedisModuleString *));
+        }
+        read[read_sz++] = job;
+        long long jobid;
+        if (RedisModule_StringToLongLong(job, &jobid) == REDISMODULE_ERR) {
+            continue;
+        }
+        AUTO_RMSTR redis_module_string_t job_keyname = {
+            .ctx = ctx,
+            .str = redis_module_arena_keyname(&arena, jobid)
+        };
+        AUTO_RMKEY RedisModuleKey *job_key = RedisModule_OpenKey(ctx,
+            job_keyname.str, REDISMODULE_READ);
+        if (RedisModule_KeyType(job_key) == REDISMODULE_KEYTYPE_EMPTY) {
+            continue;
+        }
+        job_record_t rec;
+        AUTO_RMFIELDS redis_module_fields_t fields = { .ctx = ctx };
+        if (job_record_load(job_key, &rec, &fields) != QUERY_OK) {
+            continue;
+        }
+        RedisModule_ReplyWithArray(ctx, MAX_REDIS_FIELDS);
+        int i = 0;
+        for (; i < MAX_REDIS_FIELDS; ++i) {
+            char buf[JOB_RECORD_TEXT_SZ];
+            const char *text = NULL;
+            int len = job_record_text(&rec, i, buf, &text);
+            if (len >= 0) {
+                RedisModule_ReplyWithStringBuffer(ctx, text, len);
+            } else {
+                RedisModule_ReplyWithNull(ctx);
             }
-            ++count;
         }
+        ++count;
+    }
+    RedisModule_ZsetRangeStop(matchset_key);
+    for (r = 0; r < read_sz; ++r) {
+        RedisModule_ZsetRem(matchset_key, read[r], NULL);
+        RedisModule_FreeString(ctx, read[r]);
     }
     RedisModule_ReplySetArrayLength(ctx, count);
     return REDISMODULE_OK;
 }
+
+/*
+ * SLURMJC.BLOOM <prefix> <days>
+ *
+ * This command reports on the bloom filter of the jobs which ended on a day,
+ * given as days since the unix epoch: an array of field names and values
+ * holding the size of the filter in bits, the number of hash functions, the
+ * number of jobs it has seen, the number of bits set and the estimated rate
+ * of false positives, (bits set / bits) ^ hashes.  Nil is returned if the
+ * day has no filter
+ */
+int jobcomp_cmd_bloom(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    RedisModule_AutoMemory(ctx);
+    if (argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    long long day;
+    if (RedisModule_StringToLongLong(argv[2], &day) != REDISMODULE_OK) {
+        RedisModule_ReplyWithError(ctx, "invalid day");
+        return REDISMODULE_ERR;
+    }
+    const char *prefix = RedisModule_StringPtrLen(argv[1], NULL);
+    AUTO_RMSTR redis_module_string_t blm = {
+        .ctx = ctx,
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:blm:%lld", prefix,
+            day)
+    };
+    AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(ctx, blm.str,
+        REDISMODULE_READ);
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+    job_bloom_t bloom = job_bloom_get(key);
+    if (!bloom) {
+        RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+        return REDISMODULE_ERR;
+    }
+
+    uint64_t bits_set = job_bloom_bits_set(bloom);
+    double fill = (double)bits_set / job_bloom_bits(bloom), rate = 1.0;
+    uint32_t i = 0;
+    for (; i < job_bloom_hashes(bloom); ++i) {
+        rate *= fill;
+    }
+    char fpr[32];
+    snprintf(fpr, sizeof(fpr), "%.6g", rate);
+    RedisModule_ReplyWithArray(ctx, 10);
+    RedisModule_ReplyWithSimpleString(ctx, "Bits");
+    RedisModule_ReplyWithLongLong(ctx, job_bloom_bits(bloom));
+    RedisModule_ReplyWithSimpleString(ctx, "Hashes");
+    RedisModule_ReplyWithLongLong(ctx, job_bloom_hashes(bloom));
+    RedisModule_ReplyWithSimpleString(ctx, "Jobs");
+    RedisModule_ReplyWithLongLong(ctx, (long long)job_bloom_jobs(bloom));
+    RedisModule_ReplyWithSimpleString(ctx, "BitsSet");
+    RedisModule_ReplyWithLongLong(ctx, (long long)bits_set);
+    RedisModule_ReplyWithSimpleString(ctx, "FalsePositiveRate");
+    RedisModule_ReplyWithSimpleString(ctx, fpr);
+    return REDISMODULE_OK;
+}
@@ -29,11 +29,20 @@
 #include <redismodule.h>
 
 #define JOBCOMP_COMMAND_INDEX "SLURMJC.INDEX"
+#define JOBCOMP_COMMAND_STORE "SLURMJC.STORE"
+#define JOBCOMP_COMMAND_LOAD "SLURMJC.LOAD"
+#define JOBCOMP_COMMAND_IDXLOAD "SLURMJC.IDXLOAD"
 #define JOBCOMP_COMMAND_MATCH "SLURMJC.MATCH"
 #define JOBCOMP_COMMAND_FETCH "SLURMJC.FETCH"
+#define JOBCOMP_COMMAND_BLOOM "SLURMJC.BLOOM"
 
 int jobcomp_cmd_index(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+int jobcomp_cmd_store(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+int jobcomp_cmd_load(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+int jobcomp_cmd_idxload(RedisModuleCtx *ctx, RedisModuleString **argv,
+    int argc);
 int jobcomp_cmd_match(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 int jobcomp_cmd_fetch(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+int jobcomp_cmd_bloom(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 
 #endif /* JOBCOMP_COMMAND_H */
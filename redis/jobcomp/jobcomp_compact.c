@@ -0,0 +1,222 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_compact.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "common/iso8601_format.h"
+#include "jobcomp_auto.h"
+#include "jobcomp_bitmap.h"
+#include "jobcomp_record.h"
+#include "jobcomp_segment.h"
+
+// Most days looked at by one tick of the compaction timer
+#define COMPACT_DAYS_PER_TICK 64
+
+// Most jobs added to segments by one tick of the compaction timer
+#define COMPACT_JOBS_PER_TICK 1024
+
+// Days looked back on when a prefix is first seen: the lifetime of the
+// jobs, or ten years when they are kept for good
+#define COMPACT_LOOKBACK_DAYS \
+    ((JCR_TTL > 0) ? (JCR_TTL / SECONDS_PER_DAY + 2) : 3660)
+
+// A key prefix, the next day to compact, and the segment of the day being
+// built with the next job id to add to it
+typedef struct {
+    char *prefix;
+    long long next_day;
+    job_segment_t seg;
+    uint64_t next_job;
+} compact_prefix_t;
+
+static compact_prefix_t *prefixes = NULL;
+static size_t prefixes_sz = 0;
+
+/*
+ * Note a key prefix whose closed days are to be compacted; the days of the
+ * lookback period are visited first, then each day as it closes
+ */
+void jobcomp_compact_prefix(const char *prefix)
+{
+    size_t i = 0;
+    for (; i < prefixes_sz; ++i) {
+        if (!strcmp(prefixes[i].prefix, prefix)) {
+            return;
+        }
+    }
+    prefixes = RedisModule_Realloc(prefixes,
+        (prefixes_sz + 1) * sizeof(compact_prefix_t));
+    prefixes[prefixes_sz].prefix = RedisModule_Strdup(prefix);
+    prefixes[prefixes_sz].next_day = time(NULL) / SECONDS_PER_DAY -
+        COMPACT_LOOKBACK_DAYS;
+    prefixes[prefixes_sz].seg = NULL;
+    prefixes[prefixes_sz].next_job = 0;
+    ++prefixes_sz;
+}
+
+/*
+ * Note a job stored again on a day of a key prefix; a segment of the day
+ * being built which already holds the job starts over
+ */
+void jobcomp_compact_thaw(const char *prefix, long long day, uint32_t jobid)
+{
+    size_t i = 0;
+    for (; i < prefixes_sz; ++i) {
+        compact_prefix_t *p = &prefixes[i];
+        if (!strcmp(p->prefix, prefix)) {
+            if (p->seg && (p->next_day == day) &&
+                job_bitmap_contains(job_segment_jobs(p->seg), jobid)) {
+                destroy_job_segment(&p->seg);
+                p->next_job = 0;
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * Helper function which freezes the job index of the next day of a prefix
+ * into a job segment with the time-to-live of the index, adding up to the
+ * number of jobs byref; the segment is kept on the prefix until the day is
+ * done with.  Jobs indexed behind the position reached are left out of the
+ * segment, as those indexed after it is built.  Returns 1 once the day is
+ * done with: its segment is built, or it has no job bitmap, already has a
+ * segment or has no job values.  Returns 0 if jobs remain to be added
+ */
+static int compact_day(RedisModuleCtx *ctx, compact_prefix_t *p, int *jobs)
+{
+    AUTO_RMSTR redis_module_string_t idx = {
+        .ctx = ctx,
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:end:%lld",
+            p->prefix, p->next_day)
+    };
+    AUTO_RMKEY RedisModuleKey *idx_key = RedisModule_OpenKey(ctx, idx.str,
+        REDISMODULE_READ);
+    job_bitmap_t day_jobs = job_bitmap_get(idx_key);
+    AUTO_RMSTR redis_module_string_t seg_name = {
+        .ctx = ctx,
+        .str = RedisModule_CreateStringPrintf(ctx, "%s:idx:seg:%lld",
+            p->prefix, p->next_day)
+    };
+    AUTO_RMKEY RedisModuleKey *seg_key = RedisModule_OpenKey(ctx,
+        seg_name.str, REDISMODULE_READ | REDISMODULE_WRITE);
+    if (!day_jobs ||
+        (RedisModule_KeyType(seg_key) != REDISMODULE_KEYTYPE_EMPTY)) {
+        destroy_job_segment(&p->seg);
+        return 1;
+    }
+
+    if (!p->seg) {
+        p->seg = create_job_segment();
+        p->next_job = 0;
+    }
+    AUTO_PTR(destroy_job_bitmap) job_bitmap_t rest = NULL;
+    if (p->next_job) {
+        rest = job_bitmap_range(day_jobs, (uint32_t)p->next_job, UINT32_MAX);
+    }
+    job_bitmap_iter_t iter;
+    uint32_t jobid;
+    job_bitmap_iter_init(&iter);
+    while (job_bitmap_next(rest ? rest : day_jobs, &iter, &jobid)) {
+        if (!*jobs) {
+            return 0;
+        }
+        --*jobs;
+        p->next_job = (uint64_t)jobid + 1;
+        AUTO_RMSTR redis_module_string_t job_keyname = {
+            .ctx = ctx,
+            .str = RedisModule_CreateStringPrintf(ctx, "%s:%u", p->prefix,
+                jobid)
+        };
+        AUTO_RMKEY RedisModuleKey *job_key = RedisModule_OpenKey(ctx,
+            job_keyname.str, REDISMODULE_READ);
+        const job_value_t *v = job_value_get(job_key);
+        job_record_t rec;
+        if (v && (v->job_id == jobid) &&
+            (job_record_unpack(v->packed, v->packed_sz, &rec) == 0)) {
+            job_segment_append(p->seg, v, &rec);
+        }
+        if (jobid == UINT32_MAX) {
+            break;
+        }
+    }
+
+    job_segment_t seg = p->seg;
+    p->seg = NULL;
+    if (!job_bitmap_cardinality(job_segment_jobs(seg)) ||
+        (RedisModule_ModuleTypeSetValue(seg_key, job_segment_type, seg)
+        == REDISMODULE_ERR)) {
+        destroy_job_segment(&seg);
+        return 1;
+    }
+    mstime_t ttl = RedisModule_GetExpire(idx_key);
+    if (ttl != REDISMODULE_NO_EXPIRE) {
+        RedisModule_SetExpire(seg_key, ttl);
+    }
+    return 1;
+}
+
+/*
+ * Helper function run by the compaction timer: walk the closed days of each
+ * prefix in turn, then schedule the next tick.  While the jobs of a tick
+ * run out first, the next tick runs on the next turn of the event loop
+ */
+static void compact_tick(RedisModuleCtx *ctx, void *data)
+{
+    long long closed = time(NULL) / SECONDS_PER_DAY - 1;
+    int days = COMPACT_DAYS_PER_TICK, jobs = COMPACT_JOBS_PER_TICK;
+    size_t i = 0;
+    (void)data;
+
+    for (; (i < prefixes_sz) && days && jobs; ++i) {
+        compact_prefix_t *p = &prefixes[i];
+        while ((p->next_day < closed) && days && jobs) {
+            if (!compact_day(ctx, p, &jobs)) {
+                break;
+            }
+            ++p->next_day;
+            --days;
+        }
+    }
+    RedisModule_CreateTimer(ctx, jobs ? JCR_COMPACT_INTERVAL : 0,
+        compact_tick, NULL);
+}
+
+/*
+ * Start the compaction timer
+ */
+void jobcomp_compact_start(RedisModuleCtx *ctx)
+{
+    if (JCR_COMPACT_INTERVAL > 0) {
+        RedisModule_CreateTimer(ctx, JCR_COMPACT_INTERVAL, compact_tick, NULL);
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_COMPACT_H
+#define JOBCOMP_COMPACT_H
+
+#include <stdint.h>
+
+#include <redismodule.h>
+
+/*
+ * Background compaction of closed days into job segments, see
+ * jobcomp_segment.h.  A timer runs every JCR_COMPACT_INTERVAL ms and walks
+ * the days of each key prefix the module has seen, freezing the job index
+ * of each day which ended before yesterday into <prefix>:idx:seg:<days>.
+ * Each tick looks at a bounded number of days and adds a bounded number of
+ * jobs to segments, so redis is never held up for long; a day with more
+ * jobs is built over several ticks, run on consecutive turns of the event
+ * loop
+ */
+
+// Note a key prefix whose closed days are to be compacted
+void jobcomp_compact_prefix(const char *prefix);
+
+// Note a job stored again, which restarts the segment of its day if the
+// segment is being built and already holds it
+void jobcomp_compact_thaw(const char *prefix, long long day, uint32_t jobid);
+
+// Start the compaction timer, unless JCR_COMPACT_INTERVAL is 0
+void jobcomp_compact_start(RedisModuleCtx *ctx);
+
+#endif /* JOBCOMP_COMPACT_H */
@@ -0,0 +1,219 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_kernel.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * Helper function which tells if any job of a block is still selected
+ */
+static int block_any(const uint8_t *sel, uint32_t n)
+{
+    uint8_t any = 0;
+    uint32_t i = 0;
+    for (; i < n; ++i) {
+        any |= sel[i];
+    }
+    return any;
+}
+
+/*
+ * Helper function which hashes an integer, with the murmur3 finalizer
+ */
+static uint32_t block_hash(uint32_t v)
+{
+    v ^= v >> 16;
+    v *= 0x85ebca6bu;
+    v ^= v >> 13;
+    v *= 0xc2b2ae35u;
+    return v ^ (v >> 16);
+}
+
+/*
+ * Number of hash slots for a set of sz values: at least twice as many
+ */
+size_t job_block_set_slots(size_t sz)
+{
+    size_t n = 16;
+    while (n < 2 * sz) {
+        n <<= 1;
+    }
+    return n;
+}
+
+/*
+ * Hash the values of a set into slots, by linear probing
+ */
+void job_block_set_hash(job_block_set_t *set, uint32_t *slots)
+{
+    assert(set != NULL);
+    assert(slots != NULL);
+
+    set->nslots = job_block_set_slots(set->sz);
+    memset(slots, 0, set->nslots * sizeof(uint32_t));
+    size_t i = 0;
+    for (; i < set->sz; ++i) {
+        size_t h = block_hash(set->v[i]) & (set->nslots - 1);
+        while (slots[h]) {
+            h = (h + 1) & (set->nslots - 1);
+        }
+        slots[h] = (uint32_t)(i + 1);
+    }
+    set->slots = slots;
+}
+
+/*
+ * Tell if a value is in a set
+ */
+int job_block_set_has(const job_block_set_t *set, uint32_t value)
+{
+    assert(set != NULL);
+
+    if (!set->slots) {
+        size_t i = 0;
+        for (; i < set->sz; ++i) {
+            if (set->v[i] == value) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    size_t h = block_hash(value) & (set->nslots - 1);
+    for (; set->slots[h]; h = (h + 1) & (set->nslots - 1)) {
+        if (set->v[set->slots[h] - 1] == value) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Helper function which keeps the jobs of a block whose value is in a set:
+ * a small set is compared a value at a time against the whole column, a
+ * hashed one is looked up job by job
+ */
+static void block_member(uint8_t *sel, uint32_t n, const uint32_t *col,
+    const job_block_set_t *set)
+{
+    uint32_t i;
+    if (!set->slots) {
+        uint8_t hit[JOB_BLOCK_SZ] = {0};
+        size_t j = 0;
+        for (; j < set->sz; ++j) {
+            const uint32_t v = set->v[j];
+            for (i = 0; i < n; ++i) {
+                hit[i] |= (col[i] == v);
+            }
+        }
+        for (i = 0; i < n; ++i) {
+            sel[i] &= hit[i];
+        }
+        return;
+    }
+    for (i = 0; i < n; ++i) {
+        if (sel[i]) {
+            sel[i] = (uint8_t)job_block_set_has(set, col[i]);
+        }
+    }
+}
+
+/*
+ * Helper function which keeps the jobs of a block whose code is marked
+ */
+static void block_codes(uint8_t *sel, uint32_t n, const uint32_t *col,
+    const job_block_codes_t *codes)
+{
+    uint32_t i = 0;
+    for (; i < n; ++i) {
+        sel[i] &= (col[i] < codes->ncodes) ? codes->codes[col[i]] : 0;
+    }
+}
+
+/*
+ * Select the jobs of a block which meet the criteria
+ */
+uint32_t job_block_match(const job_block_criteria_t *crit,
+    const job_block_t *blk, uint64_t mask[JOB_BLOCK_WORDS])
+{
+    assert(crit != NULL);
+    assert(blk != NULL);
+    assert(blk->n <= JOB_BLOCK_SZ);
+
+    uint8_t sel[JOB_BLOCK_SZ];
+    const uint32_t n = blk->n;
+    const int64_t lo = crit->start_time, hi = crit->end_time;
+    uint32_t i;
+
+    // The time range, then the node count range
+    if (crit->overlap) {
+        for (i = 0; i < n; ++i) {
+            sel[i] = (blk->start_time[i] <= hi) & (blk->end_time[i] >= lo);
+        }
+    } else {
+        for (i = 0; i < n; ++i) {
+            sel[i] = (blk->start_time[i] >= lo) & (blk->end_time[i] <= hi);
+        }
+    }
+    if (crit->nnodes_min > 0) {
+        for (i = 0; i < n; ++i) {
+            sel[i] &= ((int64_t)blk->nnodes[i] >= crit->nnodes_min);
+        }
+    }
+    if (crit->nnodes_max > 0) {
+        for (i = 0; i < n; ++i) {
+            sel[i] &= ((int64_t)blk->nnodes[i] <= crit->nnodes_max);
+        }
+    }
+
+    // The sets in order, skipped once no job is left
+    const uint32_t *cols[JOB_BLOCK_SETS] = { blk->uid, blk->gid, blk->state };
+    int k = 0;
+    for (; k < JOB_BLOCK_SETS; ++k) {
+        const int set = crit->order[k];
+        if (crit->sets[set].active && block_any(sel, n)) {
+            block_member(sel, n, cols[set], &crit->sets[set]);
+        }
+    }
+    if (crit->partitions.codes && blk->partition && block_any(sel, n)) {
+        block_codes(sel, n, blk->partition, &crit->partitions);
+    }
+    if (crit->job_names.codes && blk->job_name && block_any(sel, n)) {
+        block_codes(sel, n, blk->job_name, &crit->job_names);
+    }
+
+    uint32_t count = 0;
+    memset(mask, 0, JOB_BLOCK_WORDS * sizeof(uint64_t));
+    for (i = 0; i < n; ++i) {
+        mask[i / 64] |= (uint64_t)sel[i] << (i % 64);
+        count += sel[i];
+    }
+    return count;
+}
@@ -0,0 +1,120 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_KERNEL_H
+#define JOBCOMP_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The block match kernel evaluates the numeric criteria of a query over a
+ * block of up to JOB_BLOCK_SZ jobs held as integer columns, one predicate
+ * at a time across the whole block, and yields a selection bitmask of the
+ * jobs which pass.  The loops are branch-free compares over contiguous
+ * arrays so the compiler can vectorize them.  Blocks are cut from the
+ * columns of job segments in place, or decoded from the typed members of
+ * job values
+ */
+
+// Jobs in a block, and 64 bit words in its selection bitmask
+#define JOB_BLOCK_SZ 256
+#define JOB_BLOCK_WORDS (JOB_BLOCK_SZ / 64)
+
+// A block of n jobs held as columns.  Partition and job name are codes into
+// the dictionaries of a segment, and may be NULL where there is no criteria
+// on them
+typedef struct {
+    uint32_t n;
+    const int64_t *start_time;
+    const int64_t *end_time;
+    const uint32_t *uid;
+    const uint32_t *gid;
+    const uint32_t *nnodes;
+    const uint32_t *state;
+    const uint32_t *partition;
+    const uint32_t *job_name;
+} job_block_t;
+
+// Largest set of integer criteria compared value by value across a block;
+// larger sets are looked up job by job in a hash of the values
+#define JOB_BLOCK_SET_LINEAR_MAX 8
+
+// Integer columns with set criteria, evaluated in the order given by the
+// criteria
+enum {
+    JOB_BLOCK_UID,
+    JOB_BLOCK_GID,
+    JOB_BLOCK_STATE,
+    JOB_BLOCK_SETS
+};
+
+// A set of integer criteria; an active set which is empty matches nothing.
+// A set of more than JOB_BLOCK_SET_LINEAR_MAX values has a hash of them,
+// slots holding the position + 1 of a value, 0 for an empty slot
+typedef struct {
+    int active;
+    const uint32_t *v;
+    size_t sz;
+    const uint32_t *slots;
+    size_t nslots;
+} job_block_set_t;
+
+// A set of dictionary codes, marked in a table of ncodes bytes
+typedef struct {
+    const uint8_t *codes;
+    uint32_t ncodes;
+} job_block_codes_t;
+
+// The criteria evaluated by the kernel; nnodes bounds of 0 are not checked
+// and the sets are evaluated in order, most selective first
+typedef struct {
+    int overlap;
+    int64_t start_time;
+    int64_t end_time;
+    int64_t nnodes_min;
+    int64_t nnodes_max;
+    job_block_set_t sets[JOB_BLOCK_SETS];
+    int order[JOB_BLOCK_SETS];
+    job_block_codes_t partitions;
+    job_block_codes_t job_names;
+} job_block_criteria_t;
+
+// Number of hash slots for a set of sz values, a power of two
+size_t job_block_set_slots(size_t sz);
+
+// Hash the values of a set into slots, an array of job_block_set_slots(sz)
+// entries
+void job_block_set_hash(job_block_set_t *set, uint32_t *slots);
+
+// Tell if a value is in a set
+int job_block_set_has(const job_block_set_t *set, uint32_t value);
+
+// Select the jobs of a block which meet the criteria; return the number of
+// jobs selected
+uint32_t job_block_match(const job_block_criteria_t *crit,
+    const job_block_t *blk, uint64_t mask[JOB_BLOCK_WORDS]);
+
+#endif /* JOBCOMP_KERNEL_H */
@@ -30,11 +30,60 @@
 #include "jobcomp_query.h"
 
 #include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "common/iso8601_format.h"
 #include "common/sscan_cursor.h"
+#include "common/stringto.h"
 #include "jobcomp_auto.h"
+#include "jobcomp_bitmap.h"
+#include "jobcomp_bloom.h"
+#include "jobcomp_kernel.h"
+#include "jobcomp_record.h"
+#include "jobcomp_segment.h"
+#include "jobcomp_zone.h"
+
+// Most job ids of a query looked up one by one below the job id index;
+// beyond that, the candidates there are read off the day indices instead
+#define JOB_RANGE_PROBE_MAX JOB_BLOCK_SZ
+
+// Typed members a job value needs to be matched by the block kernel
+#define BLOCK_TYPED (JOB_FIELD_BIT(kStart) | JOB_FIELD_BIT(kEnd) | \
+    JOB_FIELD_BIT(kUID) | JOB_FIELD_BIT(kGID) | JOB_FIELD_BIT(kNNodes) | \
+    JOB_FIELD_BIT(kState))
+
+// An inclusive range of job ids, a single job id when lo and hi are equal
+typedef struct {
+    uint32_t lo;
+    uint32_t hi;
+} job_range_t;
+
+// A set of integer criteria, with a hash of the values when there are many
+typedef struct {
+    uint32_t *v;
+    size_t sz;
+    uint32_t *slots;
+} int_criteria_t;
+
+// Text criteria lists longer than this are hashed for membership tests
+#define TEXT_SET_LINEAR_MAX 8
+
+// A compiled predicate on a job field with set-based criteria: the criteria
+// strings, hashed when there are many (slots hold the position + 1 of a
+// string, 0 for an empty slot), the integer criteria for a field a job
+// value holds typed, and the estimated share of jobs which pass
+typedef struct {
+    int field;
+    RedisModuleString **arr;
+    size_t sz;
+    uint32_t *slots;
+    size_t nslots;
+    const int_criteria_t *ints;
+    double pass;
+} field_pred_t;
 
 // The redis-side representation of slurm's slurmdb_job_cond_t
 typedef struct job_query {
@@ -45,15 +94,14 @@ typedef struct job_query {
     // secs since unix epoch
     long long start_time;
     long long end_time;
-    // iso8601 date/times w/tz "Z"
-    char start_time_c[ISO8601_SZ];
-    char end_time_c[ISO8601_SZ];
+    // match jobs which ran during the time range, not only within it
+    int overlap;
     // nnodes range
     long long nnodes_min;
     long long nnodes_max;
     // arrays for set-based criteria
     RedisModuleString **gids;
-    long long *jobs;
+    job_range_t *jobs;
     RedisModuleString **jobnames;
     RedisModuleString **partitions;
     RedisModuleString **states;
@@ -64,16 +112,152 @@ typedef struct job_query {
     size_t partitions_sz;
     size_t states_sz;
     size_t uids_sz;
+    // uid, gid and state criteria as integers, for scans of job segments
+    int_criteria_t uid_ints;
+    int_criteria_t gid_ints;
+    int_criteria_t state_ints;
+    // the predicates on set-based criteria, most selective first, and the
+    // fields of a job hash they need along with the time and nnodes ones
+    field_pred_t preds[MAX_ATTR_INDEXES];
+    size_t preds_sz;
+    uint32_t need;
+    // the numeric criteria, as evaluated by the block kernel
+    job_block_criteria_t block;
+    // jobs run through the block kernel and the time spent matching, for
+    // the scan throughput
+    unsigned long long scanned;
+    double secs;
+    // time slice of job_query_match_next in ms, 0 for none, and when the
+    // current slice ends in usecs of the monotonic clock
+    long long slice;
+    unsigned long long slice_end;
+    // work budget in budget units, 0 for none, the jobs examined and keys
+    // opened against it, when matching began in usecs of the monotonic
+    // clock, and whether the budget ran out
+    long long budget;
+    int budget_unit;
+    unsigned long long examined;
+    unsigned long long opened;
+    unsigned long long began;
+    int spent;
+    // where matching resumes, once started: the next day of the time range,
+    // and within it whether the day had a job segment (-1 if the day is
+    // not started), whether its segment is done with, the job id below
+    // which every job of the day was matched before the day was frozen,
+    // and the next job id
+    int started;
+    long long next_day;
+    int day_seg;
+    int day_part;
+    uint64_t day_from;
+    uint64_t next_job;
+    // the scan of a day held in a set of job ids, and the name of the set
+    sscan_cursor_t scan;
+    RedisModuleString *scan_set;
+    // the candidates of a query on job ids or of an overlap query, as
+    // computed by its first step
+    job_bitmap_t candidates;
+    // for a query on job ids or an overlap query, the jobs below the job id
+    // index found so far in the day indices, and the next day to read
+    job_bitmap_t legacy;
+    long long legacy_day;
+    // job key names and per day scratch memory of the match loops
+    redis_module_arena_t arena;
 } *job_query_t;
 
 static int add_criteria(job_query_t qry, const RedisModuleString *key,
     RedisModuleString ***arr, size_t *len);
 
 static int add_job_criteria(job_query_t qry, const RedisModuleString *key,
-    long long **arr, size_t *len);
+    job_range_t **arr, size_t *len);
+
+static int parse_job_range(const RedisModuleString *str, job_range_t *range);
+
+static int match_step(const job_query_t qry,
+    RedisModuleKey *matchset);
+
+static int match_next_day(const job_query_t qry,
+    RedisModuleKey *matchset);
+
+static unsigned long long monotonic_usec(void);
+
+static int slice_spent(const job_query_t qry);
+
+static int budget_spent(const job_query_t qry);
+
+static int step_spent(const job_query_t qry);
+
+static RedisModuleKey *open_key(const job_query_t qry, RedisModuleString *name,
+    int mode);
+
+static void end_scan(const job_query_t qry);
+
+static void match_add(const job_query_t qry, RedisModuleKey *matchset,
+    long long jobid);
+
+static int match_jobs(const job_query_t qry,
+    RedisModuleKey *matchset);
+
+static job_bitmap_t read_job_index(const job_query_t qry,
+    uint64_t *indexed_from, int *rc);
+
+static int legacy_jobs(const job_query_t qry, uint64_t indexed_from);
 
 static int job_query_match_job(const job_query_t qry, long long jobid);
 
+static int match_job_key(const job_query_t qry, RedisModuleKey *job_key);
+
+static int match_time(const job_query_t qry, long long start_time,
+    long long end_time);
+
+static int match_day(const job_query_t qry, long long day,
+    const job_bitmap_t day_jobs, RedisModuleKey *matchset);
+
+static int match_bitmap(const job_query_t qry, const job_bitmap_t jobs,
+    RedisModuleKey *matchset);
+
+static int match_batch(const job_query_t qry, const uint32_t *ids,
+    uint32_t n, RedisModuleKey *matchset);
+
+static int match_segment(const job_query_t qry, const job_segment_t seg,
+    RedisModuleKey *matchset);
+
+static int zone_excludes(const job_query_t qry, long long day,
+    const job_bitmap_t day_jobs);
+
+static int bloom_excludes(const job_query_t qry, long long day,
+    const job_bitmap_t day_jobs);
+
+static void compile_int_criteria(RedisModuleString **arr, size_t sz,
+    int_criteria_t *ints);
+
+static void compile_predicates(job_query_t qry);
+
+static int match_pred(const field_pred_t *pred, const job_record_t *rec);
+
+static int scan_day(const job_query_t qry, RedisModuleString *idx,
+    RedisModuleKey *matchset);
+
+static int match_overlap(const job_query_t qry,
+    RedisModuleKey *matchset);
+
+static job_bitmap_t read_index(const job_query_t qry, RedisModuleString *name,
+    int *rc);
+
+static int attr_candidates(const job_query_t qry, long long day,
+    job_bitmap_t *candidates);
+
+static int time_candidates(const job_query_t qry, long long day,
+    job_bitmap_t *candidates);
+
+const int attr_index_field[MAX_ATTR_INDEXES] = {
+    kUID, kGID, kPartition, kState, kJobName
+};
+
+const char *attr_index_tag[MAX_ATTR_INDEXES] = {
+    "uid", "gid", "prt", "stt", "jnm"
+};
+
 /*
  * Create a job query object, used to match jobs against provided criteria
  */
@@ -84,6 +268,11 @@ job_query_t create_job_query(const job_query_init_t *init)
     qry->ctx = init->ctx;
     qry->prefix = init->prefix;
     qry->uuid = init->uuid;
+    qry->slice = init->slice;
+    qry->budget = init->budget;
+    qry->budget_unit = init->budget_unit;
+    qry->day_seg = -1;
+    init_redis_module_arena(&qry->arena, qry->ctx, qry->prefix);
     return qry;
 }
 
@@ -133,6 +322,19 @@ void destroy_job_query(job_query_t *qry)
         }
         RedisModule_Free(q->uids);
     }
+    for (i = 0; i < q->preds_sz; ++i) {
+        RedisModule_Free(q->preds[i].slots);
+    }
+    RedisModule_Free(q->uid_ints.slots);
+    RedisModule_Free(q->gid_ints.slots);
+    RedisModule_Free(q->state_ints.slots);
+    RedisModule_Free(q->uid_ints.v);
+    RedisModule_Free(q->gid_ints.v);
+    RedisModule_Free(q->state_ints.v);
+    end_scan(q);
+    destroy_job_bitmap(&q->candidates);
+    destroy_job_bitmap(&q->legacy);
+    destroy_redis_module_arena(&q->arena);
     RedisModule_Free(q);
     *qry = NULL;
 }
@@ -169,6 +371,7 @@ int job_query_prepare(job_query_t qry)
     AUTO_RMSTR redis_module_string_t end = { .ctx = qry->ctx };
     AUTO_RMSTR redis_module_string_t nnodes_min = { .ctx = qry->ctx };
     AUTO_RMSTR redis_module_string_t nnodes_max = { .ctx = qry->ctx };
+    AUTO_RMSTR redis_module_string_t overlap = { .ctx = qry->ctx };
     char nnodes_min_label[16] = {0};
     char nnodes_max_label[16] = {0};
     snprintf(nnodes_min_label, sizeof(nnodes_min_label)-1, "%sMin",
@@ -182,6 +385,7 @@ int job_query_prepare(job_query_t qry)
         redis_field_labels[kEnd], &end.str,
         nnodes_min_label, &nnodes_min.str,
         nnodes_max_label, &nnodes_max.str,
+        REDIS_QUERY_OVERLAP, &overlap.str,
         NULL) == REDISMODULE_ERR) {
         qry->err = RedisModule_CreateStringPrintf(qry->ctx,
             "error fetching query data");
@@ -211,8 +415,6 @@ int job_query_prepare(job_query_t qry)
                 "invalid iso8601 end date/time");
             return QUERY_ERR;
         }
-        strncpy(qry->start_time_c, start_c, ISO8601_SZ-1);
-        strncpy(qry->end_time_c, end_c, ISO8601_SZ-1);
     } else {
         if (RedisModule_StringToLongLong(start.str, &start_time)
             == REDISMODULE_ERR) {
@@ -230,6 +432,19 @@ int job_query_prepare(job_query_t qry)
     qry->start_time = start_time;
     qry->end_time = end_time;
 
+    // Load the time range semantics into the query, absent from the
+    // queries of earlier releases
+    if (overlap.str) {
+        long long ovl;
+        if (RedisModule_StringToLongLong(overlap.str, &ovl)
+            == REDISMODULE_ERR) {
+            qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                "invalid overlap value");
+            return QUERY_ERR;
+        }
+        qry->overlap = (ovl != 0);
+    }
+
     // Load the node count criteria into the query
     if (nnodes_min.str) {
         if (RedisModule_StringToLongLong(nnodes_min.str, &qry->nnodes_min)
@@ -295,406 +510,1776 @@ int job_query_prepare(job_query_t qry)
             == QUERY_ERR)) {
         return QUERY_ERR;
     }
+    compile_int_criteria(qry->uids, qry->uids_sz, &qry->uid_ints);
+    compile_int_criteria(qry->gids, qry->gids_sz, &qry->gid_ints);
+    compile_int_criteria(qry->states, qry->states_sz, &qry->state_ints);
+    compile_predicates(qry);
 
     return QUERY_OK;
 }
 
 /*
- * Provide the last job query error and error length to the caller
+ * Resume a prepared job query from the continuation token handed out by a
+ * query on the same keys whose budget ran out, see job_query_token
  */
-int job_query_error(job_query_t qry, const char **err, size_t *len)
+int job_query_resume(job_query_t qry, const char *token)
 {
     assert(qry != NULL);
-    if (qry->err && err) {
-        *err = RedisModule_StringPtrLen(qry->err, len);
+    assert(token != NULL);
+    long long day;
+    int seg, part, len = 0;
+    unsigned long long from, next;
+    if ((sscanf(token, "%lld:%d:%d:%llu:%llu%n", &day, &seg, &part, &from,
+        &next, &len) != 5) || token[len] ||
+        (day < qry->start_time / SECONDS_PER_DAY) ||
+        (day > qry->end_time / SECONDS_PER_DAY) ||
+        (seg < -1) || (seg > 1) || (part < 0) || (part > 1) ||
+        (from > next) || (next > (UINT64_C(1) << 32))) {
+        qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+            "invalid continuation token");
         return QUERY_ERR;
     }
+    qry->started = 1;
+    qry->next_day = day;
+    qry->day_seg = seg;
+    qry->day_part = part;
+    qry->day_from = from;
+    qry->next_job = next;
     return QUERY_OK;
 }
 
 /*
- * Match jobs in redis against the criteria in the job query.  Matches are
- * stored on the indicated matchset key (a set of job ids)
+ * Provide the continuation token of a job query whose budget ran out: the
+ * position reached, as kept between steps, which job_query_resume picks up
+ * from
  */
-int job_query_match(job_query_t qry, const RedisModuleString *matchset)
+int job_query_token(job_query_t qry, char *token)
 {
     assert(qry != NULL);
-
-    if (qry->err) {
-        RedisModule_FreeString(qry->ctx, qry->err);
-        qry->err = NULL;
+    if (!qry->spent) {
+        return QUERY_OK;
     }
+    snprintf(token, QUERY_TOKEN_SZ, "%lld:%d:%d:%llu:%llu", qry->next_day,
+        qry->day_seg, qry->day_part, (unsigned long long)qry->day_from,
+        (unsigned long long)qry->next_job);
+    return QUERY_PASS;
+}
 
-    if (qry->jobs_sz) {
-        // Scan user-specified job set
-        size_t i = 0;
-        for (; i < qry->jobs_sz; ++i) {
-            if (job_query_match_job(qry, qry->jobs[i]) == QUERY_PASS) {
-                // Add job to sorted matchset
-                AUTO_RMREPLY RedisModuleCallReply *reply =
-                    RedisModule_Call(qry->ctx, "ZADD", "sll", matchset,
-                        qry->jobs[i], qry->jobs[i]);
-            }
-        }
-    } else {
-        // Scan indices for jobs that match
-        int rc;
-        const char *err = NULL;
-        long long start_day = qry->start_time / SECONDS_PER_DAY;
-        long long end_day = qry->end_time / SECONDS_PER_DAY;
-        long long day;
-
-        for (day = start_day; day <= end_day; ++day) {
-
-            AUTO_RMSTR redis_module_string_t idx = {
-                .ctx = qry->ctx,
-                .str = RedisModule_CreateStringPrintf(qry->ctx,
-                    "%s:idx:end:%lld", qry->prefix, day)
-            };
-            sscan_cursor_init_t init = {
-                .ctx = qry->ctx,
-                .set = idx.str,
-                .count = JCR_FETCH_COUNT
-            };
-            AUTO_PTR(destroy_sscan_cursor) sscan_cursor_t cursor =
-                create_sscan_cursor(&init);
-            if (sscan_error(cursor, &err, NULL) == SSCAN_ERR) {
-                qry->err = RedisModule_CreateStringPrintf(qry->ctx, err);
-                return QUERY_ERR;
-            }
-            do {
-                AUTO_RMSTR redis_module_string_t job = { .ctx = qry->ctx };
-                rc = sscan_next_element(cursor, &job.str);
-                if (rc == SSCAN_ERR) {
-                    sscan_error(cursor, &err, NULL);
-                    qry->err = RedisModule_CreateStringPrintf(qry->ctx, err);
-                    return QUERY_ERR;
-                }
-                if ((rc == SSCAN_OK) && job.str) {
-                    long long jobid;
-                    if (RedisModule_StringToLongLong(job.str, &jobid)
-                        == REDISMODULE_ERR) {
-                        qry->err = RedisModule_CreateStringPrintf(qry->ctx,
-                            "invalid job id");
-                        return QUERY_ERR;
-                    }
-                    int job_match = job_query_match_job(qry, jobid);
-                    if (job_match == QUERY_ERR) {
-                        return QUERY_ERR;
-                    }
-                    if (job_match == QUERY_PASS) {
-                        // Add job to sorted matchset
-                        AUTO_RMREPLY RedisModuleCallReply *reply =
-                            RedisModule_Call(qry->ctx, "ZADD", "sll", matchset,
-                                jobid, jobid);
-                    }
-                }
-            } while (rc != SSCAN_EOF);
+/*
+ * Give the query keys which exist a ttl, so that they outlive the queries
+ * which resume from a continuation token
+ */
+int job_query_expire(job_query_t qry, long long ttl)
+{
+    assert(qry != NULL);
+    static const char *suffix[] = {
+        "", ":gid", ":job", ":jnm", ":prt", ":stt", ":uid"
+    };
+    size_t i = 0;
+    for (; i < sizeof(suffix) / sizeof(suffix[0]); ++i) {
+        AUTO_RMSTR redis_module_string_t name = {
+            .ctx = qry->ctx,
+            .str = RedisModule_CreateStringPrintf(qry->ctx, "%s:qry:%s%s",
+                qry->prefix, qry->uuid, suffix[i])
+        };
+        AUTO_RMKEY RedisModuleKey *key = RedisModule_OpenKey(qry->ctx,
+            name.str, REDISMODULE_WRITE);
+        if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) &&
+            (RedisModule_SetExpire(key, ttl) == REDISMODULE_ERR)) {
+            qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                "failed to set ttl on query keys");
+            return QUERY_ERR;
         }
     }
+    return QUERY_OK;
+}
 
+/*
+ * Provide the last job query error and error length to the caller
+ */
+int job_query_error(job_query_t qry, const char **err, size_t *len)
+{
+    assert(qry != NULL);
+    if (qry->err && err) {
+        *err = RedisModule_StringPtrLen(qry->err, len);
+        return QUERY_ERR;
+    }
     return QUERY_OK;
 }
 
 /*
- * Helper function which reads a key of job criteria containing a set
- * of strings.  The provided string array and array size variable are
- * loaded with those strings
+ * Match jobs in redis against the criteria in the job query.  Matches are
+ * stored on the indicated matchset key (a sorted set of job ids)
  */
-static int add_criteria(job_query_t qry, const RedisModuleString *key,
-    RedisModuleString ***arr, size_t *len)
+int job_query_match(job_query_t qry, const RedisModuleString *matchset)
+{
+    int rc;
+    do {
+        rc = job_query_match_next(qry, matchset);
+    } while (rc == QUERY_PASS);
+    return rc;
+}
+
+/*
+ * Match the jobs of the time range against the criteria in the job query
+ * for up to one time slice, storing matches on the indicated matchset key,
+ * which is opened for the step and written through the key api.  The
+ * position reached (a day of the time range and a job id or set scan
+ * within it) is kept on the query, and nothing else is held across steps,
+ * so the keyspace may change in between.  Queries on job ids or on the
+ * jobs which ran during the time range keep their candidates instead, and
+ * resume at a job id within them.  Returns QUERY_PASS while jobs remain to
+ * be matched.  A query whose budget runs out returns QUERY_OK with a
+ * continuation token instead, once it reaches a position the token can
+ * hold, which is anywhere but within a day held in a set of job ids, or
+ * while a query on job ids or an overlap query reads its candidates off
+ * the day indices
+ */
+int job_query_match_next(job_query_t qry, const RedisModuleString *matchset)
 {
     assert(qry != NULL);
-    assert(key != NULL);
-    assert(arr != NULL);
-    assert(len != NULL);
 
     if (qry->err) {
         RedisModule_FreeString(qry->ctx, qry->err);
         qry->err = NULL;
     }
 
-    AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(qry->ctx,
-        "SMEMBERS", "s", key);
-    if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_NULL) {
-        return QUERY_OK;
-    }
-    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY) {
+    AUTO_RMKEY RedisModuleKey *matchset_key = RedisModule_OpenKey(qry->ctx,
+        (RedisModuleString *)matchset, REDISMODULE_READ | REDISMODULE_WRITE);
+    int type = RedisModule_KeyType(matchset_key);
+    if ((type != REDISMODULE_KEYTYPE_EMPTY) &&
+        (type != REDISMODULE_KEYTYPE_ZSET)) {
         qry->err = RedisModule_CreateStringPrintf(qry->ctx,
             REDISMODULE_ERRORMSG_WRONGTYPE);
         return QUERY_ERR;
     }
-    *len = RedisModule_CallReplyLength(reply);
-    if (*len > 0) {
-        *arr = RedisModule_Calloc(*len, sizeof(RedisModuleString *));
+
+    if (!qry->started) {
+        qry->started = 1;
+        qry->next_day = qry->start_time / SECONDS_PER_DAY;
     }
 
-    size_t i = 0;
-    for (; i < *len; ++i) {
-        RedisModuleCallReply *subreply =
-            RedisModule_CallReplyArrayElement(reply, i); // no AUTO_RMREPLY
-        if (RedisModule_CallReplyType(subreply) != REDISMODULE_REPLY_STRING) {
-            qry->err = RedisModule_CreateStringPrintf(qry->ctx,
-                REDISMODULE_ERRORMSG_WRONGTYPE);
-            return QUERY_ERR;
-        }
-        (*arr)[i] = RedisModule_CreateStringFromCallReply(subreply);
+    unsigned long long t0 = monotonic_usec();
+    if (!qry->began) {
+        qry->began = t0;
+    }
+    qry->slice_end = t0 + qry->slice * 1000;
+    int rc = match_step(qry, matchset_key);
+    qry->secs += (monotonic_usec() - t0) / 1e6;
+    if ((rc == QUERY_PASS) && !qry->scan && !qry->legacy &&
+        budget_spent(qry)) {
+        qry->spent = 1;
+        rc = QUERY_OK;
     }
 
-    return QUERY_OK;
+    // Steps run one at a time under the redis module lock, so this is per
+    // core
+    if ((rc == QUERY_OK) && qry->scanned && (qry->secs > 0)) {
+        RedisModule_Log(qry->ctx, "verbose",
+            "query %s: %llu jobs through the block kernel in %.3f s, "
+            "%.0f jobs/sec/core", qry->uuid, qry->scanned, qry->secs,
+            qry->scanned / qry->secs);
+    }
+    return rc;
 }
 
 /*
- * Helper function which reads a key of job criteria containing a set
- * of integers. The provided integer array and array size variable are
- * loaded with those integers
+ * Helper function which matches jobs by the means the criteria allow, from
+ * the position reached by the previous step, see job_query_match_next
  */
-static int add_job_criteria(job_query_t qry, const RedisModuleString *key,
-    long long **arr, size_t *len)
+static int match_step(const job_query_t qry,
+    RedisModuleKey *matchset)
 {
-    assert(qry != NULL);
-    assert(key != NULL);
-    assert(arr != NULL);
-    assert(len != NULL);
+    int rc;
+    if (qry->jobs_sz) {
+        // Visit the user-specified job ids and job id ranges
+        return match_jobs(qry, matchset);
+    } else if (qry->overlap) {
+        // Visit the jobs which ran during the time range
+        return match_overlap(qry, matchset);
+    }
 
-    if (qry->err) {
-        RedisModule_FreeString(qry->ctx, qry->err);
-        qry->err = NULL;
+    // Scan indices for jobs that match, a day at a time
+    long long end_day = qry->end_time / SECONDS_PER_DAY;
+    while (qry->next_day <= end_day) {
+        rc = match_next_day(qry, matchset);
+        if (rc != QUERY_OK) {
+            return rc;
+        }
+        ++qry->next_day;
+        qry->day_seg = -1;
+        qry->day_part = 0;
+        qry->day_from = 0;
+        qry->next_job = 0;
+        if ((qry->next_day <= end_day) && step_spent(qry)) {
+            return QUERY_PASS;
+        }
     }
+    return QUERY_OK;
+}
 
-    AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(qry->ctx,
-        "SMEMBERS", "s", key);
-    if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_NULL) {
+/*
+ * Helper function which matches the jobs which ended on the next day of
+ * the time range, from the position reached within the day.  Returns
+ * QUERY_PASS if the time slice ran out first
+ */
+static int match_next_day(const job_query_t qry,
+    RedisModuleKey *matchset)
+{
+    int rc;
+    redis_module_arena_reset(&qry->arena);
+    AUTO_RMSTR redis_module_string_t idx = {
+        .ctx = qry->ctx,
+        .str = RedisModule_CreateStringPrintf(qry->ctx,
+            "%s:idx:end:%lld", qry->prefix, qry->next_day)
+    };
+    AUTO_RMKEY RedisModuleKey *idx_key = open_key(qry, idx.str,
+        REDISMODULE_READ);
+    int type = RedisModule_KeyType(idx_key);
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        end_scan(qry);
         return QUERY_OK;
     }
-    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY) {
+    job_bitmap_t day_jobs = job_bitmap_get(idx_key);
+    if (day_jobs) {
+        end_scan(qry);
+        rc = match_day(qry, qry->next_day, day_jobs, matchset);
+    } else if (type == REDISMODULE_KEYTYPE_SET) {
+        rc = scan_day(qry, idx.str, matchset);
+    } else {
         qry->err = RedisModule_CreateStringPrintf(qry->ctx,
             REDISMODULE_ERRORMSG_WRONGTYPE);
-        return QUERY_ERR;
+        rc = QUERY_ERR;
     }
-    *len = RedisModule_CallReplyLength(reply);
-    if (*len > 0) {
-        *arr = RedisModule_Calloc(*len, sizeof(long long));
+    return rc;
+}
+
+/*
+ * Helper function which reads the monotonic clock in usecs
+ */
+static unsigned long long monotonic_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Helper function which tells if the time slice of the current step of a
+ * job query has run out
+ */
+static int slice_spent(const job_query_t qry)
+{
+    if (!qry->slice) {
+        return 0;
     }
+    return monotonic_usec() >= qry->slice_end;
+}
 
-    size_t i = 0;
-    for (; i < *len; ++i) {
-        RedisModuleCallReply *subreply =
-            RedisModule_CallReplyArrayElement(reply, i); // no AUTO_RMREPLY
-        if (RedisModule_CallReplyType(subreply) != REDISMODULE_REPLY_STRING) {
-            qry->err = RedisModule_CreateStringPrintf(qry->ctx,
-                REDISMODULE_ERRORMSG_WRONGTYPE);
-            return QUERY_ERR;
-        }
-        AUTO_RMSTR redis_module_string_t job = {
-            .ctx = qry->ctx,
-            .str = RedisModule_CreateStringFromCallReply(subreply)
-        };
-        if (RedisModule_StringToLongLong(job.str, (*arr)+i)
-            == REDISMODULE_ERR) {
-            return QUERY_ERR;
-        }
+/*
+ * Helper function which tells if the work budget of a job query has run out
+ */
+static int budget_spent(const job_query_t qry)
+{
+    if (!qry->budget) {
+        return 0;
     }
+    unsigned long long used;
+    switch (qry->budget_unit) {
+    case QUERY_BUDGET_KEYS:
+        used = qry->opened;
+        break;
+    case QUERY_BUDGET_MS:
+        used = (monotonic_usec() - qry->began) / 1000;
+        break;
+    default:
+        used = qry->examined;
+        break;
+    }
+    return used >= (unsigned long long)qry->budget;
+}
 
-    return QUERY_OK;
+/*
+ * Helper function which tells if the current step of a job query is to
+ * end, its time slice or the budget of the query having run out
+ */
+static int step_spent(const job_query_t qry)
+{
+    return slice_spent(qry) || budget_spent(qry);
 }
 
 /*
- * Helper function which looks at an individual job and determines if it
- * matches the query criteria or not
+ * Helper function which opens a key while matching, counting it against
+ * the budget of the query
  */
-static int job_query_match_job(const job_query_t qry, long long jobid)
+static RedisModuleKey *open_key(const job_query_t qry, RedisModuleString *name,
+    int mode)
 {
-    assert(qry != NULL);
-    assert(jobid > 0);
+    ++qry->opened;
+    return RedisModule_OpenKey(qry->ctx, name, mode);
+}
 
-    size_t i = 0;
-    int match = QUERY_PASS;
+/*
+ * Helper function which adds a job to the sorted matchset, scored by its id
+ */
+static void match_add(const job_query_t qry, RedisModuleKey *matchset,
+    long long jobid)
+{
+    AUTO_RMSTR redis_module_string_t job = {
+        .ctx = qry->ctx,
+        .str = RedisModule_CreateStringFromLongLong(qry->ctx, jobid)
+    };
+    RedisModule_ZsetAdd(matchset, (double)jobid, job.str, NULL);
+}
 
-    if (qry->err) {
-        RedisModule_FreeString(qry->ctx, qry->err);
-        qry->err = NULL;
+/*
+ * Helper function which checks a candidate job and adds it to the sorted
+ * matchset if it matches
+ */
+static int match_candidate(const job_query_t qry, long long jobid,
+    RedisModuleKey *matchset)
+{
+    int job_match = job_query_match_job(qry, jobid);
+    if (job_match == QUERY_ERR) {
+        return QUERY_ERR;
+    }
+    if (job_match == QUERY_PASS) {
+        match_add(qry, matchset, jobid);
+    }
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which matches the jobs of a day held in a job bitmap, in
+ * job id order.  With criteria on the indexed attributes, or a time range
+ * covering the day only in part, only the candidates computed from the
+ * attribute and time indices are visited, along with any jobs of the day
+ * missing from those indices (indexed by an earlier release).  On a day
+ * frozen into a job segment, the jobs of the segment are scanned instead
+ * and only the jobs indexed since are visited.  Days ruled out by their
+ * zone map or bloom filter are not visited at all.  A day resumed by a
+ * later step picks up at the job id it reached.  A day frozen in between
+ * picks up at that job id in its segment and in the jobs indexed since; a
+ * day thawed in between starts over from the job id it was frozen at, and
+ * the matches found again are re-added
+ */
+static int match_day(const job_query_t qry, long long day,
+    const job_bitmap_t day_jobs, RedisModuleKey *matchset)
+{
+    AUTO_PTR(destroy_job_bitmap) job_bitmap_t candidates = NULL;
+    AUTO_PTR(destroy_job_bitmap) job_bitmap_t unfrozen = NULL;
+    job_bitmap_t left = day_jobs;
+    int rc = QUERY_OK;
+
+    if (zone_excludes(qry, day, day_jobs) ||
+        bloom_excludes(qry, day, day_jobs)) {
+        return QUERY_OK;
     }
 
-    // Open job key
-    AUTO_RMSTR redis_module_string_t job_keyname = {
+    AUTO_RMSTR redis_module_string_t seg_name = {
         .ctx = qry->ctx,
-        .str = RedisModule_CreateStringPrintf(qry->ctx, "%s:%lld",
-            qry->prefix, jobid)
+        .str = RedisModule_CreateStringPrintf(qry->ctx, "%s:idx:seg:%lld",
+            qry->prefix, day)
     };
-    AUTO_RMKEY RedisModuleKey *job_key = RedisModule_OpenKey(qry->ctx,
-        job_keyname.str, REDISMODULE_READ);
-    if (RedisModule_KeyType(job_key) == REDISMODULE_KEYTYPE_EMPTY) {
-        return QUERY_NULL;
+    AUTO_RMKEY RedisModuleKey *seg_key = open_key(qry, seg_name.str,
+        REDISMODULE_READ);
+    job_segment_t seg = job_segment_get(seg_key);
+    if (qry->day_seg != (seg != NULL)) {
+        if (!qry->day_seg) {
+            qry->day_from = qry->next_job;
+        }
+        qry->day_seg = (seg != NULL);
+        qry->day_part = 0;
+        qry->next_job = qry->day_from;
     }
-    if (RedisModule_KeyType(job_key) != REDISMODULE_KEYTYPE_HASH) {
-        qry->err = RedisModule_CreateStringPrintf(qry->ctx,
-            REDISMODULE_ERRORMSG_WRONGTYPE);
-        return QUERY_ERR;
+    if (seg) {
+        if (!qry->day_part) {
+            rc = match_segment(qry, seg, matchset);
+            if (rc != QUERY_OK) {
+                return rc;
+            }
+            qry->day_part = 1;
+            qry->next_job = qry->day_from;
+        }
+        unfrozen = job_bitmap_andnot(day_jobs, job_segment_jobs(seg));
+        if (!job_bitmap_cardinality(unfrozen)) {
+            return QUERY_OK;
+        }
+        left = unfrozen;
     }
+    int attrs = qry->uids_sz || qry->gids_sz || qry->partitions_sz ||
+        qry->states_sz || qry->jobnames_sz;
+    int partial = (qry->start_time > day * SECONDS_PER_DAY) ||
+        (qry->end_time < (day + 1) * SECONDS_PER_DAY - 1);
 
-    // Fetch data on job key
-    AUTO_RMSTR redis_module_string_t abi = { .ctx = qry->ctx };
-    AUTO_RMSTR redis_module_string_t tmf = { .ctx = qry->ctx };
-    AUTO_RMSTR redis_module_string_t start = { .ctx = qry->ctx };
-    AUTO_RMSTR redis_module_string_t end = { .ctx = qry->ctx };
-    AUTO_RMSTR redis_module_string_t gid = { .ctx = qry->ctx };
-    AUTO_RMSTR redis_module_string_t nnodes = { .ctx = qry->ctx };
-    AUTO_RMSTR redis_module_string_t jobname = { .ctx = qry->ctx };
-    AUTO_RMSTR redis_module_string_t partition = { .ctx = qry->ctx };
-    AUTO_RMSTR redis_module_string_t state = { .ctx = qry->ctx };
-    AUTO_RMSTR redis_module_string_t uid = { .ctx = qry->ctx };
-    if (RedisModule_HashGet(job_key, REDISMODULE_HASH_CFIELDS,
-        redis_field_labels[kABI], &abi.str,
-        redis_field_labels[kTimeFormat], &tmf.str,
-        redis_field_labels[kStart], &start.str,
-        redis_field_labels[kEnd], &end.str,
-        redis_field_labels[kGID], &gid.str,
-        redis_field_labels[kNNodes], &nnodes.str,
-        redis_field_labels[kJobName], &jobname.str,
-        redis_field_labels[kPartition], &partition.str,
-        redis_field_labels[kState], &state.str,
-        redis_field_labels[kUID], &uid.str,
-        NULL) == REDISMODULE_ERR) {
-        qry->err = RedisModule_CreateStringPrintf(qry->ctx,
-            "error fetching job data");
+    AUTO_RMSTR redis_module_string_t att = {
+        .ctx = qry->ctx,
+        .str = RedisModule_CreateStringPrintf(qry->ctx, "%s:idx:att:%lld",
+            qry->prefix, day)
+    };
+    job_bitmap_t indexed = (attrs || partial) ?
+        read_index(qry, att.str, &rc) : NULL;
+    if (rc == QUERY_ERR) {
         return QUERY_ERR;
     }
 
-    long long _tmf;
-    if (RedisModule_StringToLongLong(tmf.str, &_tmf) == REDISMODULE_ERR) {
-        qry->err = RedisModule_CreateStringPrintf(qry->ctx, "invalid _tmf");
-        return QUERY_ERR;
+    if (indexed) {
+        if (attrs && (attr_candidates(qry, day, &candidates) == QUERY_ERR)) {
+            return QUERY_ERR;
+        }
+        if (partial) {
+            job_bitmap_t window = NULL, tmp;
+            if (time_candidates(qry, day, &window) == QUERY_ERR) {
+                return QUERY_ERR;
+            }
+            if (candidates) {
+                tmp = job_bitmap_and(candidates, window);
+                destroy_job_bitmap(&candidates);
+                destroy_job_bitmap(&window);
+                candidates = tmp;
+            } else {
+                candidates = window;
+            }
+        }
+        AUTO_PTR(destroy_job_bitmap) job_bitmap_t unindexed =
+            job_bitmap_andnot(left, indexed);
+        if (job_bitmap_cardinality(unindexed)) {
+            job_bitmap_t tmp = job_bitmap_or(candidates, unindexed);
+            destroy_job_bitmap(&candidates);
+            candidates = tmp;
+        }
+        if (unfrozen) {
+            job_bitmap_t tmp = job_bitmap_and(candidates, unfrozen);
+            destroy_job_bitmap(&candidates);
+            candidates = tmp;
+        }
     }
 
-    // Check job time
-    if (_tmf == 1) {
-        const char *start_c = RedisModule_StringPtrLen(start.str, NULL);
-        const char *end_c = RedisModule_StringPtrLen(end.str, NULL);
-        if (strncmp(qry->start_time_c, start_c, ISO8601_SZ-1) > 0 ||
-                strncmp(qry->end_time_c, end_c, ISO8601_SZ-1) < 0) {
-            match = QUERY_FAIL;
+    return match_bitmap(qry, candidates ? candidates : left, matchset);
+}
+
+/*
+ * Helper function which matches the jobs of a job bitmap in job id order, a
+ * batch of JOB_BLOCK_SZ jobs at a time, from the next job id of the query.
+ * Returns QUERY_PASS if the time slice ran out first
+ */
+static int match_bitmap(const job_query_t qry, const job_bitmap_t jobs,
+    RedisModuleKey *matchset)
+{
+    AUTO_PTR(destroy_job_bitmap) job_bitmap_t rest = NULL;
+    if (qry->next_job > UINT32_MAX) {
+        return QUERY_OK;
+    }
+    if (qry->next_job) {
+        rest = job_bitmap_range(jobs, (uint32_t)qry->next_job, UINT32_MAX);
+    }
+
+    job_bitmap_iter_t iter;
+    uint32_t batch[JOB_BLOCK_SZ], n = 0;
+    job_bitmap_iter_init(&iter);
+    while (job_bitmap_next(rest ? rest : jobs, &iter, &batch[n])) {
+        if (++n < JOB_BLOCK_SZ) {
+            continue;
         }
-    } else do {
-        long long start_time, end_time;
-        if (RedisModule_StringToLongLong(start.str, &start_time)
-            == REDISMODULE_ERR) {
-            match = QUERY_FAIL;
-            break;
+        if (match_batch(qry, batch, n, matchset) == QUERY_ERR) {
+            return QUERY_ERR;
         }
-        if (RedisModule_StringToLongLong(end.str, &end_time)
-            == REDISMODULE_ERR) {
-            match = QUERY_FAIL;
-            break;
+        n = 0;
+        if (step_spent(qry)) {
+            qry->next_job = (uint64_t)batch[JOB_BLOCK_SZ - 1] + 1;
+            return QUERY_PASS;
+        }
+    }
+    return n ? match_batch(qry, batch, n, matchset) : QUERY_OK;
+}
+
+/*
+ * Helper function which matches a batch of up to JOB_BLOCK_SZ jobs.  The
+ * typed members of the job values are decoded into a block and run through
+ * the block kernel; the jobs it selects are added to the matchset, or
+ * checked in full when there are criteria on partition or job name.  Jobs
+ * without a job value holding the typed members are matched one by one
+ */
+static int match_batch(const job_query_t qry, const uint32_t *ids,
+    uint32_t n, RedisModuleKey *matchset)
+{
+    int64_t start_time[JOB_BLOCK_SZ], end_time[JOB_BLOCK_SZ];
+    uint32_t uid[JOB_BLOCK_SZ], gid[JOB_BLOCK_SZ], nnodes[JOB_BLOCK_SZ];
+    uint32_t state[JOB_BLOCK_SZ], job_id[JOB_BLOCK_SZ];
+    job_block_t blk = {
+        .start_time = start_time,
+        .end_time = end_time,
+        .uid = uid,
+        .gid = gid,
+        .nnodes = nnodes,
+        .state = state
+    };
+
+    uint32_t i = 0;
+    qry->examined += n;
+    for (; i < n; ++i) {
+        AUTO_RMSTR redis_module_string_t job_keyname = {
+            .ctx = qry->ctx,
+            .str = redis_module_arena_keyname(&qry->arena, ids[i])
+        };
+        AUTO_RMKEY RedisModuleKey *job_key = open_key(qry,
+            job_keyname.str, REDISMODULE_READ);
+        const job_value_t *v = job_value_get(job_key);
+        if (!v || ((v->typed & BLOCK_TYPED) != BLOCK_TYPED) ||
+            (v->uid < 0) || (v->uid > UINT32_MAX) ||
+            (v->gid < 0) || (v->gid > UINT32_MAX) ||
+            (v->nnodes < 0) || (v->nnodes > UINT32_MAX) ||
+            (v->state < 0) || (v->state > UINT32_MAX)) {
+            int job_match = match_job_key(qry, job_key);
+            if (job_match == QUERY_ERR) {
+                return QUERY_ERR;
+            }
+            if (job_match == QUERY_PASS) {
+                match_add(qry, matchset, ids[i]);
+            }
+            continue;
+        }
+        start_time[blk.n] = v->start_time;
+        end_time[blk.n] = v->end_time;
+        uid[blk.n] = (uint32_t)v->uid;
+        gid[blk.n] = (uint32_t)v->gid;
+        nnodes[blk.n] = (uint32_t)v->nnodes;
+        state[blk.n] = (uint32_t)v->state;
+        job_id[blk.n++] = ids[i];
+    }
+    if (!blk.n) {
+        return QUERY_OK;
+    }
+
+    uint64_t mask[JOB_BLOCK_WORDS];
+    qry->scanned += blk.n;
+    if (!job_block_match(&qry->block, &blk, mask)) {
+        return QUERY_OK;
+    }
+    int strings = qry->partitions_sz || qry->jobnames_sz;
+    for (i = 0; i < blk.n; ++i) {
+        if (!(mask[i / 64] & ((uint64_t)1 << (i % 64)))) {
+            continue;
+        }
+        if (strings) {
+            if (match_candidate(qry, job_id[i], matchset) == QUERY_ERR) {
+                return QUERY_ERR;
+            }
+        } else {
+            match_add(qry, matchset, job_id[i]);
+        }
+    }
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which marks the dictionary codes of a job segment named
+ * by string criteria on a partition or job name.  Returns NULL without
+ * criteria; the count of codes marked is returned byref
+ */
+static uint8_t *segment_codes(const job_query_t qry, const job_segment_t seg,
+    int field, RedisModuleString **arr, size_t sz, uint32_t dict_sz,
+    size_t *marked)
+{
+    *marked = 0;
+    if (!sz) {
+        return NULL;
+    }
+    uint8_t *codes = redis_module_arena_alloc(&qry->arena,
+        dict_sz ? dict_sz : 1);
+    size_t i = 0;
+    for (; i < sz; ++i) {
+        size_t len;
+        const char *str = RedisModule_StringPtrLen(arr[i], &len);
+        uint32_t code = job_segment_code(seg, field, str, len);
+        if ((code != JOB_SEGMENT_NONE) && !codes[code]) {
+            codes[code] = 1;
+            ++*marked;
+        }
+    }
+    return codes;
+}
+
+/*
+ * Helper function which matches the jobs of a job segment a block at a
+ * time, running the block kernel over its columns in place with the same
+ * criteria as job_query_match_job, from the next job id of the query.  A
+ * job which matches is added to the matchset only if its key still exists,
+ * since jobs may be deleted after their day was frozen.  Returns
+ * QUERY_PASS if the time slice ran out first
+ */
+static int match_segment(const job_query_t qry, const job_segment_t seg,
+    RedisModuleKey *matchset)
+{
+    job_segment_columns_t col;
+    job_segment_columns(seg, &col);
+
+    size_t prt_marked, jnm_marked;
+    uint8_t *prt = segment_codes(qry, seg, kPartition, qry->partitions,
+        qry->partitions_sz, col.partitions.n, &prt_marked);
+    uint8_t *jnm = segment_codes(qry, seg, kJobName, qry->jobnames,
+        qry->jobnames_sz, col.job_names.n, &jnm_marked);
+    if ((prt && !prt_marked) || (jnm && !jnm_marked) ||
+        (qry->uids_sz && !qry->uid_ints.sz) ||
+        (qry->gids_sz && !qry->gid_ints.sz) ||
+        (qry->states_sz && !qry->state_ints.sz)) {
+        return QUERY_OK;
+    }
+    job_block_criteria_t crit = qry->block;
+    crit.partitions = (job_block_codes_t){ prt, col.partitions.n };
+    crit.job_names = (job_block_codes_t){ jnm, col.job_names.n };
+
+    // The jobs of a segment are in job id order
+    uint32_t base = 0, hi = col.n;
+    while (base < hi) {
+        uint32_t mid = base + (hi - base) / 2;
+        if (col.job_id[mid] < qry->next_job) {
+            base = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    const uint32_t first = base;
+    for (; base < col.n; base += JOB_BLOCK_SZ) {
+        if ((base > first) && step_spent(qry)) {
+            qry->next_job = col.job_id[base];
+            return QUERY_PASS;
+        }
+        const job_block_t blk = {
+            .n = (col.n - base < JOB_BLOCK_SZ) ? col.n - base : JOB_BLOCK_SZ,
+            .start_time = col.start_time + base,
+            .end_time = col.end_time + base,
+            .uid = col.uid + base,
+            .gid = col.gid + base,
+            .nnodes = col.nnodes + base,
+            .state = col.state + base,
+            .partition = col.partition + base,
+            .job_name = col.job_name + base
+        };
+        uint64_t mask[JOB_BLOCK_WORDS];
+        qry->scanned += blk.n;
+        qry->examined += blk.n;
+        if (!job_block_match(&crit, &blk, mask)) {
+            continue;
         }
-        if (qry->start_time > start_time || qry->end_time < end_time) {
-            match = QUERY_FAIL;
+        uint32_t i = 0;
+        for (; i < blk.n; ++i) {
+            if (!(mask[i / 64] & ((uint64_t)1 << (i % 64)))) {
+                continue;
+            }
+            const long long jobid = col.job_id[base + i];
+            AUTO_RMSTR redis_module_string_t job_keyname = {
+                .ctx = qry->ctx,
+                .str = redis_module_arena_keyname(&qry->arena, jobid)
+            };
+            AUTO_RMKEY RedisModuleKey *job_key = open_key(qry,
+                job_keyname.str, REDISMODULE_READ);
+            if (RedisModule_KeyType(job_key) != REDISMODULE_KEYTYPE_EMPTY) {
+                match_add(qry, matchset, jobid);
+            }
         }
-    } while (0);
-    if (match == QUERY_FAIL) {
-        return match;
+    }
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which matches the user-specified job ids and job id
+ * ranges.  The candidates are read off the job id index: short ranges are
+ * probed id by id, longer ones are sliced out of it a container at a time,
+ * so large id lists and wide ranges cost a pass over the index rather than
+ * a key lookup per id.  Ids below the lowest indexed one, which may belong
+ * to jobs stored by an earlier release, are looked up one by one when
+ * there are few of them, and otherwise read off the day indices of the
+ * time range, see legacy_jobs.  The candidates are kept on the query for
+ * the steps which follow
+ */
+static int match_jobs(const job_query_t qry,
+    RedisModuleKey *matchset)
+{
+    if (qry->candidates) {
+        return match_bitmap(qry, qry->candidates, matchset);
+    }
+
+    int rc = QUERY_OK;
+    uint64_t indexed_from;
+    job_bitmap_t indexed = read_job_index(qry, &indexed_from, &rc);
+    if (rc == QUERY_ERR) {
+        return QUERY_ERR;
     }
 
-    // Check gid
-    if (qry->gids_sz) {
-        match = QUERY_FAIL;
-        if (gid.str) {
-            for (i = 0; i < qry->gids_sz; ++i) {
-                if (strcmp(RedisModule_StringPtrLen(qry->gids[i], NULL),
-                        RedisModule_StringPtrLen(gid.str, NULL)) == 0 ) {
-                    match = QUERY_PASS;
-                    break;
+    // Slurm has no job 0
+    uint64_t unindexed = 0;
+    size_t i = 0;
+    for (; i < qry->jobs_sz; ++i) {
+        uint64_t lo = qry->jobs[i].lo ? qry->jobs[i].lo : 1;
+        uint64_t hi = (qry->jobs[i].hi < indexed_from) ?
+            qry->jobs[i].hi : indexed_from - 1;
+        if (lo <= hi) {
+            unindexed += hi - lo + 1;
+        }
+    }
+    AUTO_PTR(destroy_job_bitmap) job_bitmap_t legacy = NULL;
+    if (unindexed > JOB_RANGE_PROBE_MAX) {
+        rc = legacy_jobs(qry, indexed_from);
+        if (rc != QUERY_OK) {
+            return rc;
+        }
+        legacy = qry->legacy;
+        qry->legacy = NULL;
+    }
+
+    AUTO_PTR(destroy_job_bitmap) job_bitmap_t candidates = create_job_bitmap();
+    for (i = 0; i < qry->jobs_sz; ++i) {
+        uint64_t id = qry->jobs[i].lo ? qry->jobs[i].lo : 1;
+        uint64_t hi = qry->jobs[i].hi;
+        if (id > hi) {
+            continue;
+        }
+        if (legacy && (id < indexed_from)) {
+            AUTO_PTR(destroy_job_bitmap) job_bitmap_t range =
+                job_bitmap_range(legacy, (uint32_t)id,
+                    (uint32_t)((hi < indexed_from) ? hi : indexed_from - 1));
+            job_bitmap_t tmp = job_bitmap_or(candidates, range);
+            destroy_job_bitmap(&candidates);
+            candidates = tmp;
+            id = indexed_from;
+        }
+        for (; (id <= hi) && (id < indexed_from); ++id) {
+            AUTO_RMSTR redis_module_string_t job_keyname = {
+                .ctx = qry->ctx,
+                .str = redis_module_arena_keyname(&qry->arena, (long long)id)
+            };
+            AUTO_RMKEY RedisModuleKey *job_key = open_key(qry,
+                job_keyname.str, REDISMODULE_READ);
+            ++qry->examined;
+            if (RedisModule_KeyType(job_key) != REDISMODULE_KEYTYPE_EMPTY) {
+                job_bitmap_add(candidates, (uint32_t)id);
+            }
+        }
+        if (id > hi) {
+            continue;
+        }
+        if (hi - id < JOB_BITMAP_ARRAY_MAX) {
+            for (; id <= hi; ++id) {
+                if (job_bitmap_contains(indexed, (uint32_t)id)) {
+                    job_bitmap_add(candidates, (uint32_t)id);
                 }
             }
+        } else {
+            AUTO_PTR(destroy_job_bitmap) job_bitmap_t range =
+                job_bitmap_range(indexed, (uint32_t)id, (uint32_t)hi);
+            job_bitmap_t tmp = job_bitmap_or(candidates, range);
+            destroy_job_bitmap(&candidates);
+            candidates = tmp;
         }
     }
-    if (match == QUERY_FAIL) {
-        return match;
+
+    qry->candidates = candidates;
+    candidates = NULL;
+    return match_bitmap(qry, qry->candidates, matchset);
+}
+
+/*
+ * Helper function which reads the job id index, see read_index, with its
+ * lowest job id byref, or 2^32 if nothing was indexed.  Slurm hands out
+ * job ids in increasing order, so every job from the lowest indexed id on
+ * went through the index, and the jobs below it were stored by an earlier
+ * release
+ */
+static job_bitmap_t read_job_index(const job_query_t qry,
+    uint64_t *indexed_from, int *rc)
+{
+    AUTO_RMSTR redis_module_string_t ids = {
+        .ctx = qry->ctx,
+        .str = RedisModule_CreateStringPrintf(qry->ctx, "%s:idx:job",
+            qry->prefix)
+    };
+    job_bitmap_t indexed = read_index(qry, ids.str, rc);
+    uint32_t lowest;
+    *indexed_from = UINT64_C(1) << 32;
+    if (indexed && job_bitmap_min(indexed, &lowest)) {
+        *indexed_from = lowest;
     }
+    return indexed;
+}
 
-    // Check nnodes_min/max
-    if ((qry->nnodes_min > 0) || (qry->nnodes_max > 0)) {
-        match = QUERY_FAIL;
-        if (nnodes.str) {
-            long long nds;
-            if (RedisModule_StringToLongLong(nnodes.str, &nds)
-                == REDISMODULE_OK) {
-                if (qry->nnodes_min <= nds) {
-                    match = QUERY_PASS;
+/*
+ * Helper function which reads the jobs below the job id index off the day
+ * indices a query can match them in, a day per pass, into the legacy jobs
+ * of the query: the days of the time range, and for an overlap query the
+ * days since, on which jobs running during the time range ended.  No job
+ * below the index ended after the lowest indexed job, which was stored
+ * once the earlier release was gone, so the days after its end are not
+ * read.  Days held in a set of job ids are read whole.  Returns QUERY_PASS
+ * if the time slice ran out first; the budget of the query is left to the
+ * steps which follow, as a continuation token cannot hold the jobs read so
+ * far
+ */
+static int legacy_jobs(const job_query_t qry, uint64_t indexed_from)
+{
+    long long last_day = (long long)time(NULL) / SECONDS_PER_DAY;
+    if (indexed_from <= UINT32_MAX) {
+        AUTO_RMSTR redis_module_string_t job_keyname = {
+            .ctx = qry->ctx,
+            .str = redis_module_arena_keyname(&qry->arena,
+                (long long)indexed_from)
+        };
+        AUTO_RMKEY RedisModuleKey *job_key = open_key(qry, job_keyname.str,
+            REDISMODULE_READ);
+        const job_value_t *v = job_value_get(job_key);
+        if (v && (v->typed & JOB_FIELD_BIT(kEnd))) {
+            last_day = v->end_time / SECONDS_PER_DAY;
+        }
+    }
+    long long end_day = qry->end_time / SECONDS_PER_DAY;
+    if (qry->overlap || (last_day < end_day)) {
+        end_day = last_day;
+    }
+    if (!qry->legacy) {
+        qry->legacy = create_job_bitmap();
+        qry->legacy_day = qry->start_time / SECONDS_PER_DAY;
+    }
+
+    while (qry->legacy_day <= end_day) {
+        AUTO_RMSTR redis_module_string_t idx = {
+            .ctx = qry->ctx,
+            .str = RedisModule_CreateStringPrintf(qry->ctx,
+                "%s:idx:end:%lld", qry->prefix, qry->legacy_day)
+        };
+        AUTO_RMKEY RedisModuleKey *idx_key = open_key(qry, idx.str,
+            REDISMODULE_READ);
+        int type = RedisModule_KeyType(idx_key);
+        job_bitmap_t day_jobs = job_bitmap_get(idx_key);
+        if (day_jobs) {
+            AUTO_PTR(destroy_job_bitmap) job_bitmap_t below =
+                job_bitmap_range(day_jobs, 1, (uint32_t)(indexed_from - 1));
+            job_bitmap_t tmp = job_bitmap_or(qry->legacy, below);
+            destroy_job_bitmap(&qry->legacy);
+            qry->legacy = tmp;
+        } else if (type == REDISMODULE_KEYTYPE_SET) {
+            sscan_cursor_init_t init = {
+                .ctx = qry->ctx,
+                .set = idx.str,
+                .count = JCR_FETCH_COUNT
+            };
+            AUTO_PTR(destroy_sscan_cursor) sscan_cursor_t scan =
+                create_sscan_cursor(&init);
+            const char *job, *err = NULL;
+            long long jobid;
+            int rc;
+            while ((rc = sscan_next_buffer(scan, &job, NULL)) == SSCAN_OK) {
+                if ((sr_strtoll(job, &jobid) < 0) || (jobid <= 0) ||
+                    (jobid > UINT32_MAX)) {
+                    qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                        "invalid job id");
+                    return QUERY_ERR;
                 }
-                if ((qry->nnodes_max > 0) && (nds > qry->nnodes_max)) {
-                    match = QUERY_FAIL;
+                if ((uint64_t)jobid < indexed_from) {
+                    job_bitmap_add(qry->legacy, (uint32_t)jobid);
                 }
             }
+            if (rc == SSCAN_ERR) {
+                sscan_error(scan, &err, NULL);
+                qry->err = RedisModule_CreateStringPrintf(qry->ctx, err);
+                return QUERY_ERR;
+            }
+        } else if (type != REDISMODULE_KEYTYPE_EMPTY) {
+            qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                REDISMODULE_ERRORMSG_WRONGTYPE);
+            return QUERY_ERR;
+        }
+        ++qry->legacy_day;
+        if ((qry->legacy_day <= end_day) && slice_spent(qry)) {
+            return QUERY_PASS;
         }
     }
-    if (match == QUERY_FAIL) {
-        return match;
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which matches jobs for an overlap query.  The candidates
+ * are the jobs which ran on the days of the time range, from the daily run
+ * indices, and the jobs which ran too long to be indexed by day; visiting
+ * them does not scan the days after the range, where jobs still running at
+ * its end are indexed by end time.  Jobs stored by an earlier release are
+ * missing from the run indices, and are read off the day indices instead,
+ * see legacy_jobs.  The candidates are kept on the query for the steps
+ * which follow
+ */
+static int match_overlap(const job_query_t qry,
+    RedisModuleKey *matchset)
+{
+    if (qry->candidates) {
+        return match_bitmap(qry, qry->candidates, matchset);
     }
 
-    // Check jobname
-    if (qry->jobnames_sz) {
-        match = QUERY_FAIL;
-        if (jobname.str) {
-            for (i = 0; i < qry->jobnames_sz; ++i) {
-                if (strcmp(RedisModule_StringPtrLen(qry->jobnames[i], NULL),
-                        RedisModule_StringPtrLen(jobname.str, NULL)) == 0 ) {
-                    match = QUERY_PASS;
-                    break;
-                }
+    long long start_day = qry->start_time / SECONDS_PER_DAY;
+    long long end_day = qry->end_time / SECONDS_PER_DAY;
+    long long day;
+    int rc = QUERY_OK;
+
+    uint64_t indexed_from;
+    read_job_index(qry, &indexed_from, &rc);
+    if (rc == QUERY_ERR) {
+        return QUERY_ERR;
+    }
+    if (indexed_from > 1) {
+        rc = legacy_jobs(qry, indexed_from);
+        if (rc != QUERY_OK) {
+            return rc;
+        }
+    }
+
+    AUTO_RMSTR redis_module_string_t lng = {
+        .ctx = qry->ctx,
+        .str = RedisModule_CreateStringPrintf(qry->ctx, "%s:idx:lng",
+            qry->prefix)
+    };
+    job_bitmap_t long_jobs = read_index(qry, lng.str, &rc);
+    if (rc == QUERY_ERR) {
+        return QUERY_ERR;
+    }
+    AUTO_PTR(destroy_job_bitmap) job_bitmap_t candidates = qry->legacy ?
+        qry->legacy : create_job_bitmap();
+    qry->legacy = NULL;
+    if (long_jobs) {
+        job_bitmap_t tmp = job_bitmap_or(candidates, long_jobs);
+        destroy_job_bitmap(&candidates);
+        candidates = tmp;
+    }
+
+    for (day = start_day; (day <= end_day) && (rc == QUERY_OK); ++day) {
+        AUTO_RMSTR redis_module_string_t run = {
+            .ctx = qry->ctx,
+            .str = RedisModule_CreateStringPrintf(qry->ctx, "%s:idx:run:%lld",
+                qry->prefix, day)
+        };
+        job_bitmap_t day_jobs = read_index(qry, run.str, &rc);
+        if (day_jobs) {
+            job_bitmap_t tmp = job_bitmap_or(candidates, day_jobs);
+            destroy_job_bitmap(&candidates);
+            candidates = tmp;
+        }
+    }
+    if (rc == QUERY_ERR) {
+        return QUERY_ERR;
+    }
+
+    qry->candidates = candidates;
+    candidates = NULL;
+    return match_bitmap(qry, qry->candidates, matchset);
+}
+
+/*
+ * Helper function which tells if the zone map of a day rules out every job
+ * of the day: no job started late enough, ended early enough, ran on a
+ * fitting number of nodes, or had one of the states or partitions asked
+ * for.  The zone map is trusted only if it covers every job of the day
+ * index, and a zone map which cannot be read rules out nothing
+ */
+static int zone_excludes(const job_query_t qry, long long day,
+    const job_bitmap_t day_jobs)
+{
+    AUTO_RMSTR redis_module_string_t zon = {
+        .ctx = qry->ctx,
+        .str = RedisModule_CreateStringPrintf(qry->ctx, "%s:idx:zon:%lld",
+            qry->prefix, day)
+    };
+    AUTO_RMKEY RedisModuleKey *key = open_key(qry, zon.str,
+        REDISMODULE_READ);
+    job_zone_t zone;
+    if ((job_zone_get(qry->ctx, key, &zone) != QUERY_OK) ||
+        ((uint64_t)zone.jobs != job_bitmap_cardinality(day_jobs))) {
+        return 0;
+    }
+
+    if ((zone.has[ZONE_START] && (zone.max[ZONE_START] < qry->start_time)) ||
+        (zone.has[ZONE_END] && (zone.min[ZONE_END] > qry->end_time)) ||
+        (zone.has[ZONE_NNODES] && (qry->nnodes_min > 0) &&
+            (zone.max[ZONE_NNODES] < qry->nnodes_min)) ||
+        (zone.has[ZONE_NNODES] && (qry->nnodes_max > 0) &&
+            (zone.min[ZONE_NNODES] > qry->nnodes_max))) {
+        return 1;
+    }
+
+    struct {
+        RedisModuleString **arr;
+        size_t sz;
+    } crit[ZONE_SETS] = {
+        { qry->states, qry->states_sz },
+        { qry->partitions, qry->partitions_sz }
+    };
+    int i = 0;
+    for (; i < ZONE_SETS; ++i) {
+        if (!crit[i].sz) {
+            continue;
+        }
+        size_t j = 0;
+        for (; j < crit[i].sz; ++j) {
+            size_t len;
+            const char *value = RedisModule_StringPtrLen(crit[i].arr[j], &len);
+            if (job_zone_distinct(&zone, i, value, len)) {
+                break;
             }
         }
+        if (j == crit[i].sz) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Helper function which tells if the bloom filter of a day rules out every
+ * job of the day: for one of uid, gid, partition or job name, the filter
+ * holds none of the values asked for.  The filter is trusted only if it has
+ * seen every job of the day index
+ */
+static int bloom_excludes(const job_query_t qry, long long day,
+    const job_bitmap_t day_jobs)
+{
+    struct {
+        int field;
+        RedisModuleString **arr;
+        size_t sz;
+    } crit[] = {
+        { kUID, qry->uids, qry->uids_sz },
+        { kGID, qry->gids, qry->gids_sz },
+        { kPartition, qry->partitions, qry->partitions_sz },
+        { kJobName, qry->jobnames, qry->jobnames_sz }
+    };
+    if (!qry->uids_sz && !qry->gids_sz && !qry->partitions_sz &&
+        !qry->jobnames_sz) {
+        return 0;
     }
-    if (match == QUERY_FAIL) {
-        return match;
+
+    AUTO_RMSTR redis_module_string_t blm = {
+        .ctx = qry->ctx,
+        .str = RedisModule_CreateStringPrintf(qry->ctx, "%s:idx:blm:%lld",
+            qry->prefix, day)
+    };
+    AUTO_RMKEY RedisModuleKey *key = open_key(qry, blm.str,
+        REDISMODULE_READ);
+    job_bloom_t bloom = job_bloom_get(key);
+    if (!bloom ||
+        (job_bloom_jobs(bloom) != job_bitmap_cardinality(day_jobs))) {
+        return 0;
     }
 
-    // Check partition
-    if (qry->partitions_sz) {
-        match = QUERY_FAIL;
-        if (partition.str) {
-            for (i = 0; i < qry->partitions_sz; ++i) {
-                if (strcmp(RedisModule_StringPtrLen(qry->partitions[i], NULL),
-                        RedisModule_StringPtrLen(partition.str, NULL)) == 0 ) {
-                    match = QUERY_PASS;
-                    break;
-                }
+    size_t i = 0;
+    for (; i < sizeof(crit) / sizeof(crit[0]); ++i) {
+        if (!crit[i].sz) {
+            continue;
+        }
+        size_t j = 0;
+        for (; j < crit[i].sz; ++j) {
+            size_t len;
+            const char *value = RedisModule_StringPtrLen(crit[i].arr[j], &len);
+            if (job_bloom_contains(bloom, crit[i].field, value, len)) {
+                break;
             }
         }
+        if (j == crit[i].sz) {
+            return 1;
+        }
     }
-    if (match == QUERY_FAIL) {
-        return match;
+    return 0;
+}
+
+/*
+ * Helper function which matches the jobs of a day held in a set of job ids,
+ * as written by an earlier release.  The set is scanned in place and its
+ * job ids matched in batches, as those of a job bitmap.  The scan is kept
+ * on the query when the time slice runs out, for the next step to resume
+ */
+static int scan_day(const job_query_t qry, RedisModuleString *idx,
+    RedisModuleKey *matchset)
+{
+    int rc;
+    const char *err = NULL;
+    if (!qry->scan) {
+        qry->scan_set = RedisModule_CreateStringFromString(qry->ctx, idx);
+        sscan_cursor_init_t init = {
+            .ctx = qry->ctx,
+            .set = qry->scan_set,
+            .count = JCR_FETCH_COUNT
+        };
+        qry->scan = create_sscan_cursor(&init);
     }
+    uint32_t batch[JOB_BLOCK_SZ];
+    uint32_t n = 0;
+    do {
+        const char *job;
+        rc = sscan_next_buffer(qry->scan, &job, NULL);
+        if (rc == SSCAN_ERR) {
+            sscan_error(qry->scan, &err, NULL);
+            qry->err = RedisModule_CreateStringPrintf(qry->ctx, err);
+            end_scan(qry);
+            return QUERY_ERR;
+        }
+        if (rc == SSCAN_OK) {
+            long long jobid;
+            if ((sr_strtoll(job, &jobid) < 0) || (jobid <= 0) ||
+                (jobid > UINT32_MAX)) {
+                qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                    "invalid job id");
+                end_scan(qry);
+                return QUERY_ERR;
+            }
+            batch[n++] = (uint32_t)jobid;
+        }
+        if ((n == JOB_BLOCK_SZ) || ((rc == SSCAN_EOF) && n)) {
+            if (match_batch(qry, batch, n, matchset) == QUERY_ERR) {
+                end_scan(qry);
+                return QUERY_ERR;
+            }
+            n = 0;
+            if ((rc != SSCAN_EOF) && slice_spent(qry)) {
+                return QUERY_PASS;
+            }
+        }
+    } while (rc != SSCAN_EOF);
+    end_scan(qry);
+    return QUERY_OK;
+}
 
-    // Check job state
-    if (qry->states_sz) {
-        match = QUERY_FAIL;
-        if (state.str) {
-            for (i = 0; i < qry->states_sz; ++i) {
-                if (strcmp(RedisModule_StringPtrLen(qry->states[i], NULL),
-                        RedisModule_StringPtrLen(state.str, NULL)) == 0 ) {
-                    match = QUERY_PASS;
-                    break;
-                }
+/*
+ * Helper function which ends the scan of a day held in a set of job ids
+ */
+static void end_scan(const job_query_t qry)
+{
+    if (qry->scan) {
+        destroy_sscan_cursor(&qry->scan);
+        RedisModule_FreeString(qry->ctx, qry->scan_set);
+        qry->scan_set = NULL;
+    }
+}
+
+/*
+ * Helper function which reads the job bitmap of an index key; NULL is
+ * returned if the key does not exist, with QUERY_ERR byref if it holds
+ * another type
+ */
+static job_bitmap_t read_index(const job_query_t qry, RedisModuleString *name,
+    int *rc)
+{
+    AUTO_RMKEY RedisModuleKey *key = open_key(qry, name,
+        REDISMODULE_READ);
+    job_bitmap_t bitmap = job_bitmap_get(key);
+    if (!bitmap && (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY)) {
+        qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+            REDISMODULE_ERRORMSG_WRONGTYPE);
+        *rc = QUERY_ERR;
+    }
+    return bitmap;
+}
+
+/*
+ * Helper function which computes the candidate jobs of a day from the
+ * attribute indices, as bitmap algebra: the union of the bitmaps of the
+ * values of each attribute in the criteria, intersected across attributes.
+ * The candidates are returned byref
+ */
+static int attr_candidates(const job_query_t qry, long long day,
+    job_bitmap_t *candidates)
+{
+    struct {
+        RedisModuleString **arr;
+        size_t sz;
+    } crit[MAX_ATTR_INDEXES] = {
+        { qry->uids, qry->uids_sz },
+        { qry->gids, qry->gids_sz },
+        { qry->partitions, qry->partitions_sz },
+        { qry->states, qry->states_sz },
+        { qry->jobnames, qry->jobnames_sz }
+    };
+    job_bitmap_t result = NULL, tmp;
+    int rc = QUERY_OK;
+    size_t i, j;
+
+    for (i = 0; i < MAX_ATTR_INDEXES; ++i) {
+        if (!crit[i].sz) {
+            continue;
+        }
+        job_bitmap_t any = create_job_bitmap();
+        for (j = 0; (j < crit[i].sz) && (rc == QUERY_OK); ++j) {
+            size_t len;
+            const char *value = RedisModule_StringPtrLen(crit[i].arr[j],
+                &len);
+            AUTO_RMSTR redis_module_string_t name = {
+                .ctx = qry->ctx,
+                .str = RedisModule_CreateStringPrintf(qry->ctx,
+                    "%s:idx:%s:%lld:%.*s", qry->prefix, attr_index_tag[i],
+                    day, (int)len, value)
+            };
+            job_bitmap_t value_jobs = read_index(qry, name.str, &rc);
+            if (value_jobs) {
+                tmp = job_bitmap_or(any, value_jobs);
+                destroy_job_bitmap(&any);
+                any = tmp;
+            }
+        }
+        if (result) {
+            tmp = job_bitmap_and(result, any);
+            destroy_job_bitmap(&result);
+            destroy_job_bitmap(&any);
+            result = tmp;
+        } else {
+            result = any;
+        }
+        if (rc == QUERY_ERR) {
+            destroy_job_bitmap(&result);
+            return QUERY_ERR;
+        }
+    }
+    *candidates = result;
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which reads the jobs of a day ending within the time
+ * range of the query off the end time index of the day.  A job which starts
+ * no earlier than the range and ends within it is the only kind that can
+ * match.  The candidates are returned byref
+ */
+static int time_candidates(const job_query_t qry, long long day,
+    job_bitmap_t *candidates)
+{
+    AUTO_RMSTR redis_module_string_t tme = {
+        .ctx = qry->ctx,
+        .str = RedisModule_CreateStringPrintf(qry->ctx, "%s:idx:tme:%lld",
+            qry->prefix, day)
+    };
+    AUTO_RMKEY RedisModuleKey *key = open_key(qry, tme.str,
+        REDISMODULE_READ);
+    int type = RedisModule_KeyType(key);
+    if ((type != REDISMODULE_KEYTYPE_EMPTY) &&
+        (type != REDISMODULE_KEYTYPE_ZSET)) {
+        qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+            "error reading time index");
+        return QUERY_ERR;
+    }
+    job_bitmap_t window = create_job_bitmap();
+    if ((type == REDISMODULE_KEYTYPE_EMPTY) ||
+        (RedisModule_ZsetFirstInScoreRange(key, qry->start_time,
+        qry->end_time, 0, 0) == REDISMODULE_ERR)) {
+        *candidates = window;
+        return QUERY_OK;
+    }
+    for (; !RedisModule_ZsetRangeEndReached(key);
+        RedisModule_ZsetRangeNext(key)) {
+        AUTO_RMSTR redis_module_string_t job = {
+            .ctx = qry->ctx,
+            .str = RedisModule_ZsetRangeCurrentElement(key, NULL)
+        };
+        long long jobid;
+        if (!job.str ||
+            (RedisModule_StringToLongLong(job.str, &jobid) == REDISMODULE_ERR)
+            || (jobid <= 0) || (jobid > UINT32_MAX)) {
+            RedisModule_ZsetRangeStop(key);
+            destroy_job_bitmap(&window);
+            qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                "invalid job id");
+            return QUERY_ERR;
+        }
+        job_bitmap_add(window, (uint32_t)jobid);
+    }
+    RedisModule_ZsetRangeStop(key);
+    *candidates = window;
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which reads a key of job criteria containing a set
+ * of strings.  The provided string array and array size variable are
+ * loaded with those strings
+ */
+static int add_criteria(job_query_t qry, const RedisModuleString *key,
+    RedisModuleString ***arr, size_t *len)
+{
+    assert(qry != NULL);
+    assert(key != NULL);
+    assert(arr != NULL);
+    assert(len != NULL);
+
+    if (qry->err) {
+        RedisModule_FreeString(qry->ctx, qry->err);
+        qry->err = NULL;
+    }
+
+    AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(qry->ctx,
+        "SMEMBERS", "s", key);
+    if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_NULL) {
+        return QUERY_OK;
+    }
+    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY) {
+        qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+            REDISMODULE_ERRORMSG_WRONGTYPE);
+        return QUERY_ERR;
+    }
+    *len = RedisModule_CallReplyLength(reply);
+    if (*len > 0) {
+        *arr = RedisModule_Calloc(*len, sizeof(RedisModuleString *));
+    }
+
+    size_t i = 0;
+    for (; i < *len; ++i) {
+        RedisModuleCallReply *subreply =
+            RedisModule_CallReplyArrayElement(reply, i); // no AUTO_RMREPLY
+        if (RedisModule_CallReplyType(subreply) != REDISMODULE_REPLY_STRING) {
+            qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                REDISMODULE_ERRORMSG_WRONGTYPE);
+            return QUERY_ERR;
+        }
+        (*arr)[i] = RedisModule_CreateStringFromCallReply(subreply);
+    }
+
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which converts string criteria on an integer field to a
+ * set of integers, hashed when there are many.  Only the decimal text a job record gives the
+ * field can match it, so other strings are left out
+ */
+static void compile_int_criteria(RedisModuleString **arr, size_t sz,
+    int_criteria_t *ints)
+{
+    ints->v = sz ? RedisModule_Alloc(sz * sizeof(uint32_t)) : NULL;
+    ints->sz = 0;
+    size_t i = 0;
+    for (; i < sz; ++i) {
+        size_t len, j = 0;
+        const char *str = RedisModule_StringPtrLen(arr[i], &len);
+        uint64_t value = 0;
+        if ((len == 0) || (len > 10) || ((len > 1) && (str[0] == '0'))) {
+            continue;
+        }
+        for (; (j < len) && (str[j] >= '0') && (str[j] <= '9'); ++j) {
+            value = value * 10 + (uint64_t)(str[j] - '0');
+        }
+        if ((j == len) && (value <= UINT32_MAX)) {
+            ints->v[ints->sz++] = (uint32_t)value;
+        }
+    }
+    ints->slots = NULL;
+    if (ints->sz > JOB_BLOCK_SET_LINEAR_MAX) {
+        job_block_set_t set = { 1, ints->v, ints->sz, NULL, 0 };
+        ints->slots = RedisModule_Alloc(job_block_set_slots(ints->sz) *
+            sizeof(uint32_t));
+        job_block_set_hash(&set, ints->slots);
+    }
+}
+
+/*
+ * Helper function which reads a key of job criteria containing a set of job
+ * ids and job id ranges, "<id>" or "<lo>-<hi>".  The provided array and
+ * array size variable are loaded with the ranges
+ */
+static int add_job_criteria(job_query_t qry, const RedisModuleString *key,
+    job_range_t **arr, size_t *len)
+{
+    assert(qry != NULL);
+    assert(key != NULL);
+    assert(arr != NULL);
+    assert(len != NULL);
+
+    if (qry->err) {
+        RedisModule_FreeString(qry->ctx, qry->err);
+        qry->err = NULL;
+    }
+
+    AUTO_RMREPLY RedisModuleCallReply *reply = RedisModule_Call(qry->ctx,
+        "SMEMBERS", "s", key);
+    if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_NULL) {
+        return QUERY_OK;
+    }
+    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY) {
+        qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+            REDISMODULE_ERRORMSG_WRONGTYPE);
+        return QUERY_ERR;
+    }
+    *len = RedisModule_CallReplyLength(reply);
+    if (*len > 0) {
+        *arr = RedisModule_Calloc(*len, sizeof(job_range_t));
+    }
+
+    size_t i = 0;
+    for (; i < *len; ++i) {
+        RedisModuleCallReply *subreply =
+            RedisModule_CallReplyArrayElement(reply, i); // no AUTO_RMREPLY
+        if (RedisModule_CallReplyType(subreply) != REDISMODULE_REPLY_STRING) {
+            qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                REDISMODULE_ERRORMSG_WRONGTYPE);
+            return QUERY_ERR;
+        }
+        AUTO_RMSTR redis_module_string_t job = {
+            .ctx = qry->ctx,
+            .str = RedisModule_CreateStringFromCallReply(subreply)
+        };
+        if (parse_job_range(job.str, (*arr)+i) == QUERY_ERR) {
+            qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                "invalid job id");
+            return QUERY_ERR;
+        }
+    }
+
+    return QUERY_OK;
+}
+
+/*
+ * Helper function which parses a job id, "<id>", or an inclusive job id
+ * range, "<lo>-<hi>"; job ids are unsigned 32 bit integers
+ */
+static int parse_job_range(const RedisModuleString *str, job_range_t *range)
+{
+    size_t len;
+    const char *p = RedisModule_StringPtrLen(str, &len);
+    const char *end = p + len;
+    uint64_t bound[2] = { 0, 0 };
+    int n = 0;
+
+    for (; n < 2; ++n) {
+        const char *digits = p;
+        for (; (p < end) && (*p >= '0') && (*p <= '9'); ++p) {
+            bound[n] = bound[n] * 10 + (uint64_t)(*p - '0');
+            if (bound[n] > UINT32_MAX) {
+                return QUERY_ERR;
             }
         }
+        if (p == digits) {
+            return QUERY_ERR;
+        }
+        if ((p == end) || (*p != '-') || (n == 1)) {
+            break;
+        }
+        ++p;
     }
-    if (match == QUERY_FAIL) {
-        return match;
+    if (p != end) {
+        return QUERY_ERR;
     }
+    range->lo = (uint32_t)bound[0];
+    range->hi = (uint32_t)(n ? bound[1] : bound[0]);
+    return (range->lo <= range->hi) ? QUERY_OK : QUERY_ERR;
+}
 
-    // Check uid
-    if (qry->uids_sz) {
-        match = QUERY_FAIL;
-        if (uid.str) {
-            for (i = 0; i < qry->uids_sz; ++i) {
-                if (strcmp(RedisModule_StringPtrLen(qry->uids[i], NULL),
-                        RedisModule_StringPtrLen(uid.str, NULL)) == 0 ) {
-                    match = QUERY_PASS;
-                    break;
-                }
+/*
+ * Helper function which hashes a string, with 32 bit FNV-1a
+ */
+static uint32_t text_hash(const char *str, size_t len)
+{
+    uint32_t h = 2166136261u;
+    size_t i = 0;
+    for (; i < len; ++i) {
+        h = (h ^ (unsigned char)str[i]) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Helper function which adds a predicate on a job field with set-based
+ * criteria, hashing long lists of strings
+ */
+static void add_predicate(job_query_t qry, int field, RedisModuleString **arr,
+    size_t sz, const int_criteria_t *ints, double share)
+{
+    if (!sz) {
+        return;
+    }
+    field_pred_t *pred = &qry->preds[qry->preds_sz++];
+    pred->field = field;
+    pred->arr = arr;
+    pred->sz = sz;
+    pred->ints = ints;
+    pred->pass = (sz * share < 1.0) ? sz * share : 1.0;
+    qry->need |= JOB_FIELD_BIT(field);
+    if (sz <= TEXT_SET_LINEAR_MAX) {
+        return;
+    }
+    pred->nslots = job_block_set_slots(sz);
+    pred->slots = RedisModule_Calloc(pred->nslots, sizeof(uint32_t));
+    size_t i = 0;
+    for (; i < sz; ++i) {
+        size_t len;
+        const char *str = RedisModule_StringPtrLen(arr[i], &len);
+        size_t h = text_hash(str, len) & (pred->nslots - 1);
+        while (pred->slots[h]) {
+            h = (h + 1) & (pred->nslots - 1);
+        }
+        pred->slots[h] = (uint32_t)(i + 1);
+    }
+}
+
+/*
+ * Helper function which compiles the set-based criteria of a query into
+ * predicates, in order of their estimated selectivity: the share of jobs
+ * one value of a field typically holds on a cluster, times the number of
+ * values asked for.  The block kernel evaluates its integer sets in the
+ * same order, and a job hash is read for the fields the query needs only
+ */
+static void compile_predicates(job_query_t qry)
+{
+    qry->need = JOB_FIELD_BIT(kABI) | JOB_FIELD_BIT(kTimeFormat) |
+        JOB_FIELD_BIT(kStart) | JOB_FIELD_BIT(kEnd);
+    if ((qry->nnodes_min > 0) || (qry->nnodes_max > 0)) {
+        qry->need |= JOB_FIELD_BIT(kNNodes);
+    }
+    add_predicate(qry, kUID, qry->uids, qry->uids_sz, &qry->uid_ints, 0.01);
+    add_predicate(qry, kJobName, qry->jobnames, qry->jobnames_sz, NULL,
+        0.01);
+    add_predicate(qry, kGID, qry->gids, qry->gids_sz, &qry->gid_ints, 0.1);
+    add_predicate(qry, kPartition, qry->partitions, qry->partitions_sz, NULL,
+        0.25);
+    add_predicate(qry, kState, qry->states, qry->states_sz,
+        &qry->state_ints, 0.3);
+
+    // A stable insertion sort of the few predicates
+    size_t i = 1, j;
+    for (; i < qry->preds_sz; ++i) {
+        field_pred_t pred = qry->preds[i];
+        for (j = i; (j > 0) && (qry->preds[j - 1].pass > pred.pass); --j) {
+            qry->preds[j] = qry->preds[j - 1];
+        }
+        qry->preds[j] = pred;
+    }
+
+    qry->block = (job_block_criteria_t){
+        .overlap = qry->overlap,
+        .start_time = qry->start_time,
+        .end_time = qry->end_time,
+        .nnodes_min = qry->nnodes_min,
+        .nnodes_max = qry->nnodes_max
+    };
+    const struct {
+        int field;
+        size_t sz;
+        const int_criteria_t *ints;
+    } sets[JOB_BLOCK_SETS] = {
+        [JOB_BLOCK_UID] = { kUID, qry->uids_sz, &qry->uid_ints },
+        [JOB_BLOCK_GID] = { kGID, qry->gids_sz, &qry->gid_ints },
+        [JOB_BLOCK_STATE] = { kState, qry->states_sz, &qry->state_ints }
+    };
+    int k, n = 0;
+    for (k = 0; k < JOB_BLOCK_SETS; ++k) {
+        qry->block.sets[k] = (job_block_set_t){
+            .active = sets[k].sz > 0,
+            .v = sets[k].ints->v,
+            .sz = sets[k].ints->sz,
+            .slots = sets[k].ints->slots,
+            .nslots = sets[k].ints->slots ?
+                job_block_set_slots(sets[k].ints->sz) : 0
+        };
+    }
+    for (i = 0; i < qry->preds_sz; ++i) {
+        for (k = 0; k < JOB_BLOCK_SETS; ++k) {
+            if (qry->preds[i].field == sets[k].field) {
+                qry->block.order[n++] = k;
+            }
+        }
+    }
+    for (k = 0; k < JOB_BLOCK_SETS; ++k) {
+        if (!sets[k].sz) {
+            qry->block.order[n++] = k;
+        }
+    }
+}
+
+/*
+ * Helper function which checks the text of a job field against a predicate
+ */
+static int match_pred(const field_pred_t *pred, const job_record_t *rec)
+{
+    char buf[JOB_RECORD_TEXT_SZ];
+    const char *text = NULL;
+    int len = job_record_text(rec, pred->field, buf, &text);
+    if (len < 0) {
+        return QUERY_FAIL;
+    }
+    size_t i, str_len;
+    if (pred->slots) {
+        i = text_hash(text, len) & (pred->nslots - 1);
+        for (; pred->slots[i]; i = (i + 1) & (pred->nslots - 1)) {
+            const char *str = RedisModule_StringPtrLen(
+                pred->arr[pred->slots[i] - 1], &str_len);
+            if ((str_len == (size_t)len) && (memcmp(str, text, len) == 0)) {
+                return QUERY_PASS;
+            }
+        }
+        return QUERY_FAIL;
+    }
+    for (i = 0; i < pred->sz; ++i) {
+        const char *str = RedisModule_StringPtrLen(pred->arr[i], &str_len);
+        if ((str_len == (size_t)len) && (memcmp(str, text, len) == 0)) {
+            return QUERY_PASS;
+        }
+    }
+    return QUERY_FAIL;
+}
+
+/*
+ * Helper function which tells if a field a job value holds typed is in
+ * integer criteria; -1 is returned if it is not typed or out of range, so
+ * the text of the field is checked instead
+ */
+static int match_typed(const job_value_t *v, const field_pred_t *pred)
+{
+    long long value;
+    uint32_t bit = JOB_FIELD_BIT(pred->field);
+    if (!pred->ints || !(v->typed & bit)) {
+        return -1;
+    }
+    switch (pred->field) {
+    case kUID:
+        value = v->uid;
+        break;
+    case kGID:
+        value = v->gid;
+        break;
+    case kState:
+        value = v->state;
+        break;
+    default:
+        return -1;
+    }
+    if ((value < 0) || (value > UINT32_MAX)) {
+        return -1;
+    }
+    job_block_set_t set = {
+        .active = 1,
+        .v = pred->ints->v,
+        .sz = pred->ints->sz,
+        .slots = pred->ints->slots,
+        .nslots = pred->ints->slots ? job_block_set_slots(pred->ints->sz) : 0
+    };
+    return job_block_set_has(&set, (uint32_t)value);
+}
+
+/*
+ * Helper function which checks the start and end time of a job against the
+ * time range of the query: the job must lie within the range or, for an
+ * overlap query, have run at some time during it
+ */
+static int match_time(const job_query_t qry, long long start_time,
+    long long end_time)
+{
+    if (qry->overlap) {
+        return (start_time <= qry->end_time) && (end_time >= qry->start_time);
+    }
+    return (start_time >= qry->start_time) && (end_time <= qry->end_time);
+}
+
+/*
+ * Helper function which looks at an individual job and determines if it
+ * matches the query criteria or not
+ */
+static int job_query_match_job(const job_query_t qry, long long jobid)
+{
+    assert(qry != NULL);
+    assert(jobid > 0);
+
+    // Open job key
+    AUTO_RMSTR redis_module_string_t job_keyname = {
+        .ctx = qry->ctx,
+        .str = redis_module_arena_keyname(&qry->arena, jobid)
+    };
+    AUTO_RMKEY RedisModuleKey *job_key = open_key(qry, job_keyname.str,
+        REDISMODULE_READ);
+    return match_job_key(qry, job_key);
+}
+
+/*
+ * Helper function which determines if the job on an open job key matches
+ * the query criteria or not
+ */
+static int match_job_key(const job_query_t qry, RedisModuleKey *job_key)
+{
+    if (qry->err) {
+        RedisModule_FreeString(qry->ctx, qry->err);
+        qry->err = NULL;
+    }
+
+    int rc = job_record_key(job_key);
+    if (rc == QUERY_NULL) {
+        return QUERY_NULL;
+    }
+    if (rc == QUERY_ERR) {
+        qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+            REDISMODULE_ERRORMSG_WRONGTYPE);
+        return QUERY_ERR;
+    }
+
+    // A job value has the job times, node count, uid, gid and state typed,
+    // so most jobs are matched without unpacking the record
+    const job_value_t *v = job_value_get(job_key);
+    job_record_t rec;
+    AUTO_RMFIELDS redis_module_fields_t fields = { .ctx = qry->ctx };
+    int loaded = 0;
+    if (v) {
+        const uint32_t need = JOB_FIELD_BIT(kStart) | JOB_FIELD_BIT(kEnd);
+        if (((v->typed & need) != need) ||
+            !match_time(qry, v->start_time, v->end_time)) {
+            return QUERY_FAIL;
+        }
+        if ((qry->nnodes_min > 0) || (qry->nnodes_max > 0)) {
+            if (!(v->typed & JOB_FIELD_BIT(kNNodes)) ||
+                (qry->nnodes_min > v->nnodes) ||
+                ((qry->nnodes_max > 0) && (v->nnodes > qry->nnodes_max))) {
+                return QUERY_FAIL;
             }
         }
+    } else {
+        // Fetch the fields the query needs: packed records are read in
+        // place, job hashes field by field
+        if (job_record_load_fields(job_key, &rec, &fields, qry->need)
+            != QUERY_OK) {
+            qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                "error fetching job data");
+            return QUERY_ERR;
+        }
+        loaded = 1;
+
+        // Check job time
+        long long start_time, end_time;
+        if ((job_record_time(&rec, kStart, &start_time) != 0) ||
+            (job_record_time(&rec, kEnd, &end_time) != 0) ||
+            !match_time(qry, start_time, end_time)) {
+            return QUERY_FAIL;
+        }
+
+        // Check nnodes_min/max
+        if ((qry->nnodes_min > 0) || (qry->nnodes_max > 0)) {
+            long long nds;
+            if ((job_record_int(&rec, kNNodes, &nds) != 0) ||
+                (qry->nnodes_min > nds) ||
+                ((qry->nnodes_max > 0) && (nds > qry->nnodes_max))) {
+                return QUERY_FAIL;
+            }
+        }
+    }
+
+    // Check the set-based criteria, most selective first; typed fields of
+    // a job value are compared as integers
+    size_t i = 0;
+    for (; i < qry->preds_sz; ++i) {
+        const field_pred_t *pred = &qry->preds[i];
+        int typed = v ? match_typed(v, pred) : -1;
+        if (typed == 0) {
+            return QUERY_FAIL;
+        }
+        if (typed == 1) {
+            continue;
+        }
+        if (!loaded) {
+            if (job_record_load(job_key, &rec, &fields) != QUERY_OK) {
+                qry->err = RedisModule_CreateStringPrintf(qry->ctx,
+                    "error fetching job data");
+                return QUERY_ERR;
+            }
+            loaded = 1;
+        }
+        if (match_pred(pred, &rec) == QUERY_FAIL) {
+            return QUERY_FAIL;
+        }
     }
-    return match;
+    return QUERY_PASS;
 }
@@ -42,6 +42,30 @@ enum {
     QUERY_FAIL = 2
 };
 
+// Job attributes with daily indices of their own, see SLURMJC.INDEX.  The
+// jobs which end on a day with a given attribute value are kept in the job
+// bitmap <prefix>:idx:<tag>:<days>:<value>, and the jobs of the day which
+// are in these indices in <prefix>:idx:att:<days>
+#define MAX_ATTR_INDEXES 5
+extern const int attr_index_field[MAX_ATTR_INDEXES];
+extern const char *attr_index_tag[MAX_ATTR_INDEXES];
+
+// The jobs which ran at any time during a day are kept in the job bitmap
+// <prefix>:idx:run:<days>, for overlap queries.  Jobs which ran for more
+// than JOB_RUN_DAYS_MAX days are kept in <prefix>:idx:lng instead
+#define JOB_RUN_DAYS_MAX 366
+
+// Units of the work budget of a job query: jobs examined, keys opened or
+// milliseconds since matching began
+enum {
+    QUERY_BUDGET_JOBS = 0,
+    QUERY_BUDGET_KEYS,
+    QUERY_BUDGET_MS
+};
+
+// Size of a buffer for a continuation token, see job_query_token
+#define QUERY_TOKEN_SZ 96
+
 // A job query is an opaque pointer
 typedef struct job_query *job_query_t;
 
@@ -50,6 +74,11 @@ typedef struct {
     RedisModuleCtx *ctx;
     const char *prefix;
     const char *uuid;
+    // time slice of job_query_match_next in ms, 0 for none
+    long long slice;
+    // work budget of the query in budget units, 0 for none
+    long long budget;
+    int budget_unit;
 } job_query_init_t;
 
 // Create a job query
@@ -61,10 +90,26 @@ void destroy_job_query(job_query_t *qry);
 // Prepare the job query; return status
 int job_query_prepare(job_query_t qry);
 
+// Resume a prepared job query from a continuation token; return status
+int job_query_resume(job_query_t qry, const char *token);
+
+// Return the continuation token of a job query whose budget ran out in a
+// buffer of QUERY_TOKEN_SZ; return QUERY_PASS if there is one, else QUERY_OK
+int job_query_token(job_query_t qry, char *token);
+
+// Give the query keys a ttl in ms; return status
+int job_query_expire(job_query_t qry, long long ttl);
+
 // Return last error and error size byref; return status
 int job_query_error(job_query_t qry, const char **err, size_t *len);
 
 // Find job matches and place their ids in matchset; return status
 int job_query_match(job_query_t qry, const RedisModuleString *matchset);
 
+// Find job matches for up to one time slice, resuming where the last call
+// left off, and place their ids in matchset; return QUERY_PASS while jobs
+// remain to be matched, else status.  A query whose budget ran out is done
+// and has a continuation token
+int job_query_match_next(job_query_t qry, const RedisModuleString *matchset);
+
 #endif /* JOBCOMP_QUERY_H */
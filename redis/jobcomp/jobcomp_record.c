@@ -0,0 +1,546 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_record.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/iso8601_format.h"
+#include "jobcomp_command.h"
+#include "jobcomp_query.h"
+
+_Static_assert(MAX_REDIS_FIELDS <= 32, "field bitmaps must fit 32 bits");
+
+#define FIELD_BIT(f) JOB_FIELD_BIT(f)
+
+RedisModuleType *job_record_type = NULL;
+
+// Fields which are date/times, in the job's time format (_tmf)
+static const uint32_t time_fields = FIELD_BIT(kStart) | FIELD_BIT(kEnd) |
+    FIELD_BIT(kSubmit) | FIELD_BIT(kEligible);
+
+// Fields which are usually integers
+static const uint32_t int_fields = FIELD_BIT(kABI) | FIELD_BIT(kTimeFormat) |
+    FIELD_BIT(kJobID) | FIELD_BIT(kElapsed) | FIELD_BIT(kUID) |
+    FIELD_BIT(kGID) | FIELD_BIT(kNNodes) | FIELD_BIT(kNCPUs) |
+    FIELD_BIT(kState) | FIELD_BIT(kTimeLimit);
+
+/*
+ * Append an unsigned LEB128 varint; return the bytes written
+ */
+static size_t put_varint(char *buf, unsigned long long v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (char)((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (char)v;
+    return n;
+}
+
+/*
+ * Read an unsigned LEB128 varint; return the bytes read, 0 if truncated
+ */
+static size_t get_varint(const char *buf, size_t len, unsigned long long *v)
+{
+    size_t n = 0;
+    int shift = 0;
+    *v = 0;
+    while ((n < len) && (shift < 64)) {
+        unsigned char c = (unsigned char)buf[n++];
+        *v |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return n;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+static unsigned long long zigzag(long long v)
+{
+    return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+static long long unzigzag(unsigned long long v)
+{
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+/*
+ * Parse a value as the number it represents, only if printing that number
+ * gives back the very same text.  Returns 0 on success
+ */
+static int parse_exact(const char *value, size_t len, int iso8601,
+    long long *num)
+{
+    char buf[JOB_RECORD_TEXT_SZ];
+    if ((len == 0) || (len >= sizeof(buf))) {
+        return -1;
+    }
+    memcpy(buf, value, len);
+    buf[len] = '\0';
+    if (iso8601) {
+        char check[ISO8601_SZ];
+        time_t t = mk_time(buf);
+        if ((t == (time_t)(-1)) || !mk_iso8601(t, check) ||
+            strcmp(check, buf)) {
+            return -1;
+        }
+        *num = t;
+        return 0;
+    }
+    char *end = NULL;
+    char check[JOB_RECORD_TEXT_SZ];
+    *num = strtoll(buf, &end, 10);
+    if (*end || (snprintf(check, sizeof(check), "%lld", *num) != (int)len) ||
+        memcmp(check, buf, len)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Pack the field values into buf.  The time format must be known to pack
+ * ISO8601 date/times as numbers, so it is read first
+ */
+size_t job_record_pack(const char **value, const size_t *len, char *buf)
+{
+    assert(value != NULL);
+    assert(len != NULL);
+    assert(buf != NULL);
+
+    uint32_t present = 0, numeric = 0;
+    long long num[MAX_REDIS_FIELDS];
+    long long tmf = -1;
+    int i;
+
+    if (value[kTimeFormat]) {
+        parse_exact(value[kTimeFormat], len[kTimeFormat], 0, &tmf);
+    }
+    for (i = 0; i < MAX_REDIS_FIELDS; ++i) {
+        if (!value[i]) {
+            continue;
+        }
+        present |= FIELD_BIT(i);
+        if ((time_fields & FIELD_BIT(i)) && ((tmf == 0) || (tmf == 1))) {
+            if (parse_exact(value[i], len[i], tmf == 1, &num[i]) == 0) {
+                numeric |= FIELD_BIT(i);
+            }
+        } else if (int_fields & FIELD_BIT(i)) {
+            if (parse_exact(value[i], len[i], 0, &num[i]) == 0) {
+                numeric |= FIELD_BIT(i);
+            }
+        }
+    }
+
+    size_t n = put_varint(buf, SLURM_REDIS_ABI);
+    n += put_varint(buf + n, present);
+    n += put_varint(buf + n, numeric);
+    for (i = 0; i < MAX_REDIS_FIELDS; ++i) {
+        if (numeric & FIELD_BIT(i)) {
+            n += put_varint(buf + n, zigzag(num[i]));
+        } else if (present & FIELD_BIT(i)) {
+            n += put_varint(buf + n, len[i]);
+            memcpy(buf + n, value[i], len[i]);
+            n += len[i];
+        }
+    }
+    return n;
+}
+
+/*
+ * Unpack a job record without copying: text fields point into buf
+ */
+int job_record_unpack(const char *buf, size_t len, job_record_t *rec)
+{
+    assert(buf != NULL);
+    assert(rec != NULL);
+
+    unsigned long long abi, present, numeric, v;
+    size_t n, off = 0;
+    int i;
+
+    memset(rec, 0, sizeof(*rec));
+    if (!(n = get_varint(buf, len, &abi)) ||
+        (abi < JOB_RECORD_ABI) || (abi > SLURM_REDIS_ABI)) {
+        return -1;
+    }
+    off += n;
+    if (!(n = get_varint(buf + off, len - off, &present)) ||
+        (present >> MAX_REDIS_FIELDS)) {
+        return -1;
+    }
+    off += n;
+    if (!(n = get_varint(buf + off, len - off, &numeric)) ||
+        (numeric & ~present)) {
+        return -1;
+    }
+    off += n;
+    rec->present = (uint32_t)present;
+    rec->numeric = (uint32_t)numeric;
+    for (i = 0; i < MAX_REDIS_FIELDS; ++i) {
+        if (!(present & FIELD_BIT(i))) {
+            continue;
+        }
+        if (!(n = get_varint(buf + off, len - off, &v))) {
+            return -1;
+        }
+        off += n;
+        if (numeric & FIELD_BIT(i)) {
+            rec->num[i] = unzigzag(v);
+        } else {
+            if (v > len - off) {
+                return -1;
+            }
+            rec->str[i] = buf + off;
+            rec->len[i] = v;
+            off += v;
+        }
+    }
+    return (off == len) ? 0 : -1;
+}
+
+/*
+ * Helper function which fills the typed members of a job value from its
+ * packed record; returns 0 on success, -1 if the record is invalid
+ */
+static int job_value_type(job_value_t *v)
+{
+    job_record_t rec;
+    if (job_record_unpack(v->packed, v->packed_sz, &rec) != 0) {
+        return -1;
+    }
+    v->typed = 0;
+    if (job_record_int(&rec, kJobID, &v->job_id) == 0) {
+        v->typed |= FIELD_BIT(kJobID);
+    }
+    if (job_record_time(&rec, kStart, &v->start_time) == 0) {
+        v->typed |= FIELD_BIT(kStart);
+    }
+    if (job_record_time(&rec, kEnd, &v->end_time) == 0) {
+        v->typed |= FIELD_BIT(kEnd);
+    }
+    if (job_record_int(&rec, kUID, &v->uid) == 0) {
+        v->typed |= FIELD_BIT(kUID);
+    }
+    if (job_record_int(&rec, kGID, &v->gid) == 0) {
+        v->typed |= FIELD_BIT(kGID);
+    }
+    if (job_record_int(&rec, kNNodes, &v->nnodes) == 0) {
+        v->typed |= FIELD_BIT(kNNodes);
+    }
+    if (job_record_int(&rec, kState, &v->state) == 0) {
+        v->typed |= FIELD_BIT(kState);
+    }
+    return 0;
+}
+
+/*
+ * Pack the field values straight into a new job value, sized for the worst
+ * case and then trimmed to the packed size
+ */
+job_value_t *job_value_pack(const char **value, const size_t *len)
+{
+    assert(value != NULL);
+    assert(len != NULL);
+
+    size_t sz = JOB_RECORD_OVERHEAD;
+    int i = 0;
+    for (; i < MAX_REDIS_FIELDS; ++i) {
+        if (value[i]) {
+            sz += len[i];
+        }
+    }
+    job_value_t *v = RedisModule_Alloc(sizeof(job_value_t) + sz);
+    v->packed_sz = job_record_pack(value, len, v->packed);
+    if (job_value_type(v) != 0) {
+        RedisModule_Free(v);
+        return NULL;
+    }
+    return RedisModule_Realloc(v, sizeof(job_value_t) + v->packed_sz);
+}
+
+/*
+ * Create a job value holding a copy of a packed job record
+ */
+job_value_t *job_value_create(const char *buf, size_t len)
+{
+    assert(buf != NULL);
+
+    if (len > UINT32_MAX) {
+        return NULL;
+    }
+    job_value_t *v = RedisModule_Alloc(sizeof(job_value_t) + len);
+    memcpy(v->packed, buf, len);
+    v->packed_sz = (uint32_t)len;
+    if (job_value_type(v) != 0) {
+        RedisModule_Free(v);
+        return NULL;
+    }
+    return v;
+}
+
+/*
+ * The job value of an open job key, read in place
+ */
+const job_value_t *job_value_get(RedisModuleKey *key)
+{
+    if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_MODULE) ||
+        (RedisModule_ModuleTypeGetType(key) != job_record_type)) {
+        return NULL;
+    }
+    return RedisModule_ModuleTypeGetValue(key);
+}
+
+/*
+ * Tell whether an open key may hold a job record
+ */
+int job_record_key(RedisModuleKey *key)
+{
+    switch (RedisModule_KeyType(key)) {
+    case REDISMODULE_KEYTYPE_EMPTY:
+        return QUERY_NULL;
+    case REDISMODULE_KEYTYPE_STRING:
+    case REDISMODULE_KEYTYPE_HASH:
+        return QUERY_OK;
+    case REDISMODULE_KEYTYPE_MODULE:
+        return (RedisModule_ModuleTypeGetType(key) == job_record_type) ?
+            QUERY_OK : QUERY_ERR;
+    default:
+        return QUERY_ERR;
+    }
+}
+
+/*
+ * Load the job record of an open job key.  Job values and packed strings
+ * are read in place; a job hash written by an earlier release is read field
+ * by field
+ */
+int job_record_load(RedisModuleKey *key, job_record_t *rec,
+    redis_module_fields_t *fields)
+{
+    return job_record_load_fields(key, rec, fields, JOB_FIELDS_ALL);
+}
+
+/*
+ * Load the job record of an open job key, fetching only the needed fields
+ * of a job hash; job values and packed strings are read in place whole
+ */
+int job_record_load_fields(RedisModuleKey *key, job_record_t *rec,
+    redis_module_fields_t *fields, uint32_t need)
+{
+    assert(rec != NULL);
+    assert(fields != NULL);
+
+    int type = RedisModule_KeyType(key);
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        return QUERY_NULL;
+    }
+    if (type == REDISMODULE_KEYTYPE_MODULE) {
+        const job_value_t *v = job_value_get(key);
+        return (v && (job_record_unpack(v->packed, v->packed_sz, rec) == 0)) ?
+            QUERY_OK : QUERY_ERR;
+    }
+    if (type == REDISMODULE_KEYTYPE_STRING) {
+        size_t len = 0;
+        const char *buf = RedisModule_StringDMA(key, &len, REDISMODULE_READ);
+        return (buf && (job_record_unpack(buf, len, rec) == 0)) ?
+            QUERY_OK : QUERY_ERR;
+    }
+    if (type != REDISMODULE_KEYTYPE_HASH) {
+        return QUERY_ERR;
+    }
+    memset(rec, 0, sizeof(*rec));
+    int i = 0;
+    for (; i < MAX_REDIS_FIELDS; ++i) {
+        if (!(need & FIELD_BIT(i))) {
+            continue;
+        }
+        if (RedisModule_HashGet(key, REDISMODULE_HASH_CFIELDS,
+            redis_field_labels[i], &fields->str[i], NULL) == REDISMODULE_ERR) {
+            return QUERY_ERR;
+        }
+        if (fields->str[i]) {
+            rec->present |= FIELD_BIT(i);
+            rec->str[i] = RedisModule_StringPtrLen(fields->str[i],
+                &rec->len[i]);
+        }
+    }
+    return QUERY_OK;
+}
+
+/*
+ * Text of a field as it was sent by slurm
+ */
+int job_record_text(const job_record_t *rec, int field, char *buf,
+    const char **text)
+{
+    assert(rec != NULL);
+    assert(buf != NULL);
+    assert(text != NULL);
+
+    if (!(rec->present & FIELD_BIT(field))) {
+        return -1;
+    }
+    if (!(rec->numeric & FIELD_BIT(field))) {
+        *text = rec->str[field];
+        return (int)rec->len[field];
+    }
+    *text = buf;
+    if ((time_fields & FIELD_BIT(field)) && (rec->numeric &
+        FIELD_BIT(kTimeFormat)) && (rec->num[kTimeFormat] == 1)) {
+        if (!mk_iso8601((time_t)rec->num[field], buf)) {
+            return -1;
+        }
+        return ISO8601_SZ - 1;
+    }
+    return snprintf(buf, JOB_RECORD_TEXT_SZ, "%lld", rec->num[field]);
+}
+
+/*
+ * Value of an integer field, whether held as a number or as text
+ */
+int job_record_int(const job_record_t *rec, int field, long long *value)
+{
+    assert(rec != NULL);
+    assert(value != NULL);
+
+    if (!(rec->present & FIELD_BIT(field))) {
+        return -1;
+    }
+    if (rec->numeric & FIELD_BIT(field)) {
+        *value = rec->num[field];
+        return 0;
+    }
+    char buf[JOB_RECORD_TEXT_SZ], *end = NULL;
+    if ((rec->len[field] == 0) || (rec->len[field] >= sizeof(buf))) {
+        return -1;
+    }
+    memcpy(buf, rec->str[field], rec->len[field]);
+    buf[rec->len[field]] = '\0';
+    *value = strtoll(buf, &end, 10);
+    return *end ? -1 : 0;
+}
+
+/*
+ * Value of a date/time field in secs since the unix epoch, whatever the
+ * time format of the job
+ */
+int job_record_time(const job_record_t *rec, int field, long long *value)
+{
+    assert(rec != NULL);
+    assert(value != NULL);
+
+    long long tmf;
+    if (!(rec->present & FIELD_BIT(field)) ||
+        (job_record_int(rec, kTimeFormat, &tmf) != 0)) {
+        return -1;
+    }
+    if ((rec->numeric & FIELD_BIT(field)) || (tmf != 1)) {
+        return job_record_int(rec, field, value);
+    }
+    char buf[ISO8601_SZ];
+    if (rec->len[field] != ISO8601_SZ - 1) {
+        return -1;
+    }
+    memcpy(buf, rec->str[field], ISO8601_SZ - 1);
+    buf[ISO8601_SZ - 1] = '\0';
+    time_t t = mk_time(buf);
+    if (t == (time_t)(-1)) {
+        return -1;
+    }
+    *value = t;
+    return 0;
+}
+
+/*
+ * Module type callbacks.  A job value is persisted as its packed record,
+ * which carries its own abi; the typed members are rebuilt on load
+ */
+void *job_record_rdb_load(RedisModuleIO *rdb, int encver)
+{
+    if (encver != JOB_RECORD_TYPE_ENCVER) {
+        RedisModule_LogIOError(rdb, "warning",
+            "unsupported job record encoding version %d", encver);
+        return NULL;
+    }
+    size_t len = 0;
+    char *buf = RedisModule_LoadStringBuffer(rdb, &len);
+    if (!buf) {
+        return NULL;
+    }
+    job_value_t *v = job_value_create(buf, len);
+    RedisModule_Free(buf);
+    if (!v) {
+        RedisModule_LogIOError(rdb, "warning", "invalid job record");
+    }
+    return v;
+}
+
+void job_record_rdb_save(RedisModuleIO *rdb, void *value)
+{
+    const job_value_t *v = value;
+    RedisModule_SaveStringBuffer(rdb, v->packed, v->packed_sz);
+}
+
+/*
+ * The rewritten AOF restores each job value with SLURMJC.LOAD; the job
+ * indices are rewritten as the sets they are and the key ttl by redis
+ */
+void job_record_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key,
+    void *value)
+{
+    const job_value_t *v = value;
+    RedisModule_EmitAOF(aof, JOBCOMP_COMMAND_LOAD, "sb", key, v->packed,
+        (size_t)v->packed_sz);
+}
+
+size_t job_record_mem_usage(const void *value)
+{
+    const job_value_t *v = value;
+    return sizeof(job_value_t) + v->packed_sz;
+}
+
+void job_record_digest(RedisModuleDigest *md, void *value)
+{
+    job_value_t *v = value;
+    RedisModule_DigestAddStringBuffer(md, (unsigned char *)v->packed,
+        v->packed_sz);
+    RedisModule_DigestEndSequence(md);
+}
+
+void job_record_free(void *value)
+{
+    RedisModule_Free(value);
+}
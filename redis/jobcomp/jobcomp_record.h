@@ -0,0 +1,160 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_RECORD_H
+#define JOBCOMP_RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <redismodule.h>
+
+#include "common/redis_fields.h"
+#include "jobcomp_auto.h"
+
+/*
+ * The packed encoding of a job record: one string value per job instead of
+ * a hash of MAX_REDIS_FIELDS labelled fields.  The value is
+ *
+ *   varint abi          SLURM_REDIS_ABI of the module that packed it
+ *   varint present      bitmap of the fields present
+ *   varint numeric      bitmap of the present fields held as numbers
+ *   field ...           each present field in enum redis_field_index order:
+ *                       a zigzag varint if numeric, else a varint length
+ *                       followed by the bytes
+ *
+ * Integer fields, and date/times in either time format, are held as numbers
+ * whenever the number reproduces the original text exactly; anything else is
+ * kept as text, so a record always unpacks to the values it was packed from
+ */
+
+// Oldest abi whose job records are packed
+#define JOB_RECORD_ABI 1
+
+// Most bytes needed to pack the fields on top of their values
+#define JOB_RECORD_OVERHEAD (3 * 5 + MAX_REDIS_FIELDS * 10)
+
+// Size of a buffer for the text of a field held as a number
+#define JOB_RECORD_TEXT_SZ 24
+
+// Bit of a field in the field bitmaps
+#define JOB_FIELD_BIT(f) (1u << (f))
+
+// Bits of all the fields
+#define JOB_FIELDS_ALL ((uint32_t)((1ull << MAX_REDIS_FIELDS) - 1))
+
+// Name and encoding version of the job record module type
+#define JOB_RECORD_TYPE_NAME "slurmjcjr"
+#define JOB_RECORD_TYPE_ENCVER 0
+
+// A job record unpacked for reading.  Text fields point into the packed
+// value (or the hash values) they came from and are not NUL-terminated
+typedef struct job_record {
+    // Bitmap of the fields present
+    uint32_t present;
+    // Bitmap of the present fields held in num
+    uint32_t numeric;
+    long long num[MAX_REDIS_FIELDS];
+    const char *str[MAX_REDIS_FIELDS];
+    size_t len[MAX_REDIS_FIELDS];
+} job_record_t;
+
+/*
+ * The value of a job key of the job record module type: the fields used to
+ * match and index jobs, held as typed members, followed by the packed record
+ * which holds every field.  A member is valid only if the bit of its field
+ * is set in typed; date/times are secs since the unix epoch whatever the
+ * time format of the job
+ */
+typedef struct job_value {
+    uint32_t typed;
+    uint32_t packed_sz;
+    long long job_id;
+    long long start_time;
+    long long end_time;
+    long long uid;
+    long long gid;
+    long long nnodes;
+    long long state;
+    char packed[];
+} job_value_t;
+
+// The job record module type, created on module load
+extern RedisModuleType *job_record_type;
+
+// Pack field values (NULL if absent) into buf, which must hold the sum of
+// the value lengths plus JOB_RECORD_OVERHEAD bytes; return the packed size
+size_t job_record_pack(const char **value, const size_t *len, char *buf);
+
+// Unpack a packed job record; return 0 on success, -1 if it is invalid
+int job_record_unpack(const char *buf, size_t len, job_record_t *rec);
+
+// Pack field values into a new job value; return NULL if the record is
+// invalid.  The value is freed by job_record_free
+job_value_t *job_value_pack(const char **value, const size_t *len);
+
+// Create a job value from a packed job record; return NULL if it is invalid
+job_value_t *job_value_create(const char *buf, size_t len);
+
+// The job value of an open job key, NULL if the key holds no job value
+const job_value_t *job_value_get(RedisModuleKey *key);
+
+// Tell whether an open key may hold a job record: QUERY_OK if it does,
+// QUERY_NULL if the key is empty and QUERY_ERR if it holds another type
+int job_record_key(RedisModuleKey *key);
+
+// Load the job record of an open job key: a job value, a packed string or a
+// (legacy) hash; hash values are held in fields.  Return QUERY_OK,
+// QUERY_NULL or QUERY_ERR
+int job_record_load(RedisModuleKey *key, job_record_t *rec,
+    redis_module_fields_t *fields);
+
+// Load a job record like job_record_load, fetching only the fields of a job
+// hash whose bits (JOB_FIELD_BIT) are set in need
+int job_record_load_fields(RedisModuleKey *key, job_record_t *rec,
+    redis_module_fields_t *fields, uint32_t need);
+
+// Text of a field, formatted into buf (JOB_RECORD_TEXT_SZ) if it is held as
+// a number; return its length, or -1 if the field is absent
+int job_record_text(const job_record_t *rec, int field, char *buf,
+    const char **text);
+
+// Value of an integer field; return 0 on success, -1 if absent or not a
+// number
+int job_record_int(const job_record_t *rec, int field, long long *value);
+
+// Value of a date/time field in secs since the unix epoch; return 0 on
+// success, -1 if absent or invalid
+int job_record_time(const job_record_t *rec, int field, long long *value);
+
+// Module type callbacks of job values
+void *job_record_rdb_load(RedisModuleIO *rdb, int encver);
+void job_record_rdb_save(RedisModuleIO *rdb, void *value);
+void job_record_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key,
+    void *value);
+size_t job_record_mem_usage(const void *value);
+void job_record_digest(RedisModuleDigest *md, void *value);
+void job_record_free(void *value);
+
+#endif /* JOBCOMP_RECORD_H */
@@ -0,0 +1,631 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_segment.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Serialized size of a job: seven 32 bit and two 64 bit columns
+#define SEGMENT_JOB_SZ (7 * sizeof(uint32_t) + 2 * sizeof(int64_t))
+
+// Typed members a job value needs to be compacted
+#define SEGMENT_TYPED (JOB_FIELD_BIT(kJobID) | JOB_FIELD_BIT(kStart) | \
+    JOB_FIELD_BIT(kEnd) | JOB_FIELD_BIT(kUID) | JOB_FIELD_BIT(kGID) | \
+    JOB_FIELD_BIT(kNNodes) | JOB_FIELD_BIT(kState))
+
+// A dictionary of distinct strings and an open addressing hash of them
+typedef struct dict {
+    uint32_t n;
+    uint32_t cap;
+    char **str;
+    uint32_t *len;
+    // Code + 1 of the string in each slot, 0 for an empty slot
+    uint32_t *slots;
+    uint32_t nslots;
+} dict_t;
+
+struct job_segment {
+    uint32_t n;
+    uint32_t cap;
+    uint32_t *job_id;
+    int64_t *start_time;
+    int64_t *end_time;
+    uint32_t *uid;
+    uint32_t *gid;
+    uint32_t *nnodes;
+    uint32_t *state;
+    uint32_t *partition;
+    uint32_t *job_name;
+    dict_t partitions;
+    dict_t job_names;
+    job_bitmap_t jobs;
+};
+
+RedisModuleType *job_segment_type = NULL;
+
+/*
+ * Helper function which hashes a string, FNV-1a
+ */
+static uint32_t dict_hash(const char *str, size_t len)
+{
+    uint32_t h = 2166136261u;
+    size_t i = 0;
+    for (; i < len; ++i) {
+        h = (h ^ (unsigned char)str[i]) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Helper function which finds the code of a string, JOB_SEGMENT_NONE if it
+ * is not in the dictionary
+ */
+static uint32_t dict_find(const dict_t *d, const char *str, size_t len)
+{
+    if (!d->nslots) {
+        return JOB_SEGMENT_NONE;
+    }
+    uint32_t mask = d->nslots - 1, i = dict_hash(str, len) & mask;
+    for (; d->slots[i]; i = (i + 1) & mask) {
+        uint32_t code = d->slots[i] - 1;
+        if ((d->len[code] == len) && !memcmp(d->str[code], str, len)) {
+            return code;
+        }
+    }
+    return JOB_SEGMENT_NONE;
+}
+
+/*
+ * Helper function which places a code in the hash
+ */
+static void dict_slot(dict_t *d, uint32_t code)
+{
+    uint32_t mask = d->nslots - 1;
+    uint32_t i = dict_hash(d->str[code], d->len[code]) & mask;
+    while (d->slots[i]) {
+        i = (i + 1) & mask;
+    }
+    d->slots[i] = code + 1;
+}
+
+/*
+ * Helper function which returns the code of a string, adding it to the
+ * dictionary if it is new.  The hash is kept at most half full
+ */
+static uint32_t dict_add(dict_t *d, const char *str, size_t len)
+{
+    uint32_t code = dict_find(d, str, len);
+    if (code != JOB_SEGMENT_NONE) {
+        return code;
+    }
+    if (d->n == d->cap) {
+        d->cap = d->cap ? d->cap * 2 : 16;
+        d->str = RedisModule_Realloc(d->str, d->cap * sizeof(char *));
+        d->len = RedisModule_Realloc(d->len, d->cap * sizeof(uint32_t));
+    }
+    code = d->n++;
+    d->str[code] = RedisModule_Alloc(len + 1);
+    memcpy(d->str[code], str, len);
+    d->str[code][len] = '\0';
+    d->len[code] = (uint32_t)len;
+    if (d->n * 2 > d->nslots) {
+        uint32_t i = 0;
+        RedisModule_Free(d->slots);
+        d->nslots = d->nslots ? d->nslots * 2 : 32;
+        d->slots = RedisModule_Calloc(d->nslots, sizeof(uint32_t));
+        for (; i < d->n; ++i) {
+            dict_slot(d, i);
+        }
+    } else {
+        dict_slot(d, code);
+    }
+    return code;
+}
+
+static void dict_free(dict_t *d)
+{
+    uint32_t i = 0;
+    for (; i < d->n; ++i) {
+        RedisModule_Free(d->str[i]);
+    }
+    RedisModule_Free(d->str);
+    RedisModule_Free(d->len);
+    RedisModule_Free(d->slots);
+}
+
+/*
+ * Create an empty job segment
+ */
+job_segment_t create_job_segment(void)
+{
+    job_segment_t seg = RedisModule_Calloc(1, sizeof(struct job_segment));
+    seg->jobs = create_job_bitmap();
+    return seg;
+}
+
+/*
+ * Destroy a job segment
+ */
+void destroy_job_segment(job_segment_t *seg)
+{
+    if (!seg || !*seg) {
+        return;
+    }
+    job_segment_t s = *seg;
+    RedisModule_Free(s->job_id);
+    RedisModule_Free(s->start_time);
+    RedisModule_Free(s->end_time);
+    RedisModule_Free(s->uid);
+    RedisModule_Free(s->gid);
+    RedisModule_Free(s->nnodes);
+    RedisModule_Free(s->state);
+    RedisModule_Free(s->partition);
+    RedisModule_Free(s->job_name);
+    dict_free(&s->partitions);
+    dict_free(&s->job_names);
+    destroy_job_bitmap(&s->jobs);
+    RedisModule_Free(s);
+    *seg = NULL;
+}
+
+/*
+ * Helper function which makes room for one more job in the columns
+ */
+static void grow_columns(job_segment_t seg)
+{
+    if (seg->n < seg->cap) {
+        return;
+    }
+    seg->cap = seg->cap ? seg->cap * 2 : 64;
+    seg->job_id = RedisModule_Realloc(seg->job_id,
+        seg->cap * sizeof(uint32_t));
+    seg->start_time = RedisModule_Realloc(seg->start_time,
+        seg->cap * sizeof(int64_t));
+    seg->end_time = RedisModule_Realloc(seg->end_time,
+        seg->cap * sizeof(int64_t));
+    seg->uid = RedisModule_Realloc(seg->uid, seg->cap * sizeof(uint32_t));
+    seg->gid = RedisModule_Realloc(seg->gid, seg->cap * sizeof(uint32_t));
+    seg->nnodes = RedisModule_Realloc(seg->nnodes,
+        seg->cap * sizeof(uint32_t));
+    seg->state = RedisModule_Realloc(seg->state, seg->cap * sizeof(uint32_t));
+    seg->partition = RedisModule_Realloc(seg->partition,
+        seg->cap * sizeof(uint32_t));
+    seg->job_name = RedisModule_Realloc(seg->job_name,
+        seg->cap * sizeof(uint32_t));
+}
+
+static int fits_u32(long long v)
+{
+    return (v >= 0) && (v <= UINT32_MAX);
+}
+
+/*
+ * Append a job value and its unpacked record.  Jobs missing a typed member,
+ * or with one out of the range of its column, are left out
+ */
+int job_segment_append(job_segment_t seg, const job_value_t *v,
+    const job_record_t *rec)
+{
+    assert(seg != NULL);
+    assert(v != NULL);
+    assert(rec != NULL);
+
+    if (((v->typed & SEGMENT_TYPED) != SEGMENT_TYPED) ||
+        (v->job_id <= 0) || !fits_u32(v->job_id) || !fits_u32(v->uid) ||
+        !fits_u32(v->gid) || !fits_u32(v->nnodes) || !fits_u32(v->state) ||
+        (seg->n && (v->job_id <= seg->job_id[seg->n - 1]))) {
+        return -1;
+    }
+
+    grow_columns(seg);
+    uint32_t i = seg->n;
+    seg->job_id[i] = (uint32_t)v->job_id;
+    seg->start_time[i] = v->start_time;
+    seg->end_time[i] = v->end_time;
+    seg->uid[i] = (uint32_t)v->uid;
+    seg->gid[i] = (uint32_t)v->gid;
+    seg->nnodes[i] = (uint32_t)v->nnodes;
+    seg->state[i] = (uint32_t)v->state;
+
+    char buf[JOB_RECORD_TEXT_SZ];
+    const char *text = NULL;
+    int len = job_record_text(rec, kPartition, buf, &text);
+    seg->partition[i] = (len < 0) ? JOB_SEGMENT_NONE :
+        dict_add(&seg->partitions, text, (size_t)len);
+    len = job_record_text(rec, kJobName, buf, &text);
+    seg->job_name[i] = (len < 0) ? JOB_SEGMENT_NONE :
+        dict_add(&seg->job_names, text, (size_t)len);
+
+    job_bitmap_add(seg->jobs, seg->job_id[i]);
+    ++seg->n;
+    return 0;
+}
+
+/*
+ * The ids of the jobs in the segment
+ */
+job_bitmap_t job_segment_jobs(const job_segment_t seg)
+{
+    assert(seg != NULL);
+    return seg->jobs;
+}
+
+/*
+ * Fill in a view of the columns
+ */
+void job_segment_columns(const job_segment_t seg, job_segment_columns_t *col)
+{
+    assert(seg != NULL);
+    assert(col != NULL);
+
+    col->n = seg->n;
+    col->job_id = seg->job_id;
+    col->start_time = seg->start_time;
+    col->end_time = seg->end_time;
+    col->uid = seg->uid;
+    col->gid = seg->gid;
+    col->nnodes = seg->nnodes;
+    col->state = seg->state;
+    col->partition = seg->partition;
+    col->job_name = seg->job_name;
+    col->partitions.n = seg->partitions.n;
+    col->partitions.str = seg->partitions.str;
+    col->partitions.len = seg->partitions.len;
+    col->job_names.n = seg->job_names.n;
+    col->job_names.str = seg->job_names.str;
+    col->job_names.len = seg->job_names.len;
+}
+
+/*
+ * Dictionary code of a partition or job name
+ */
+uint32_t job_segment_code(const job_segment_t seg, int field,
+    const char *str, size_t len)
+{
+    assert(seg != NULL);
+    assert((field == kPartition) || (field == kJobName));
+
+    return dict_find((field == kPartition) ? &seg->partitions :
+        &seg->job_names, str, len);
+}
+
+static void put_u32(char *buf, uint32_t v)
+{
+    buf[0] = (char)v;
+    buf[1] = (char)(v >> 8);
+    buf[2] = (char)(v >> 16);
+    buf[3] = (char)(v >> 24);
+}
+
+static uint32_t get_u32(const char *buf)
+{
+    const unsigned char *b = (const unsigned char *)buf;
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static void put_u64(char *buf, uint64_t v)
+{
+    put_u32(buf, (uint32_t)v);
+    put_u32(buf + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get_u64(const char *buf)
+{
+    return get_u32(buf) | ((uint64_t)get_u32(buf + 4) << 32);
+}
+
+static size_t dict_serialized_size(const dict_t *d)
+{
+    size_t sz = sizeof(uint32_t);
+    uint32_t i = 0;
+    for (; i < d->n; ++i) {
+        sz += sizeof(uint32_t) + d->len[i];
+    }
+    return sz;
+}
+
+/*
+ * Serialized size of a segment
+ */
+size_t job_segment_serialized_size(const job_segment_t seg)
+{
+    assert(seg != NULL);
+    return sizeof(uint32_t) + seg->n * SEGMENT_JOB_SZ +
+        dict_serialized_size(&seg->partitions) +
+        dict_serialized_size(&seg->job_names);
+}
+
+static char *serialize_u32(char *buf, const uint32_t *col, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i < n; ++i, buf += 4) {
+        put_u32(buf, col[i]);
+    }
+    return buf;
+}
+
+static char *serialize_i64(char *buf, const int64_t *col, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i < n; ++i, buf += 8) {
+        put_u64(buf, (uint64_t)col[i]);
+    }
+    return buf;
+}
+
+static char *serialize_dict(char *buf, const dict_t *d)
+{
+    uint32_t i = 0;
+    put_u32(buf, d->n);
+    buf += 4;
+    for (; i < d->n; ++i) {
+        put_u32(buf, d->len[i]);
+        memcpy(buf + 4, d->str[i], d->len[i]);
+        buf += 4 + d->len[i];
+    }
+    return buf;
+}
+
+/*
+ * Serialize a segment into a buffer of job_segment_serialized_size()
+ */
+void job_segment_serialize(const job_segment_t seg, char *buf)
+{
+    assert(seg != NULL);
+    assert(buf != NULL);
+
+    put_u32(buf, seg->n);
+    buf = serialize_u32(buf + 4, seg->job_id, seg->n);
+    buf = serialize_i64(buf, seg->start_time, seg->n);
+    buf = serialize_i64(buf, seg->end_time, seg->n);
+    buf = serialize_u32(buf, seg->uid, seg->n);
+    buf = serialize_u32(buf, seg->gid, seg->n);
+    buf = serialize_u32(buf, seg->nnodes, seg->n);
+    buf = serialize_u32(buf, seg->state, seg->n);
+    buf = serialize_u32(buf, seg->partition, seg->n);
+    buf = serialize_u32(buf, seg->job_name, seg->n);
+    buf = serialize_dict(buf, &seg->partitions);
+    serialize_dict(buf, &seg->job_names);
+}
+
+static const char *deserialize_u32(const char *buf, uint32_t *col,
+    uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i < n; ++i, buf += 4) {
+        col[i] = get_u32(buf);
+    }
+    return buf;
+}
+
+static const char *deserialize_i64(const char *buf, int64_t *col,
+    uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i < n; ++i, buf += 8) {
+        col[i] = (int64_t)get_u64(buf);
+    }
+    return buf;
+}
+
+/*
+ * Helper function which reads a dictionary, checking that it fits in the
+ * buffer and holds distinct strings; returns NULL if it is invalid
+ */
+static const char *deserialize_dict(const char *buf, const char *end,
+    dict_t *d)
+{
+    if (end - buf < 4) {
+        return NULL;
+    }
+    uint32_t n = get_u32(buf), i = 0;
+    buf += 4;
+    for (; i < n; ++i) {
+        if (end - buf < 4) {
+            return NULL;
+        }
+        uint32_t len = get_u32(buf);
+        if ((size_t)(end - buf - 4) < len) {
+            return NULL;
+        }
+        if (dict_add(d, buf + 4, len) != i) {
+            return NULL;
+        }
+        buf += 4 + len;
+    }
+    return buf;
+}
+
+/*
+ * Helper function which checks the codes of a column against its
+ * dictionary
+ */
+static int valid_codes(const uint32_t *col, uint32_t n, const dict_t *d)
+{
+    uint32_t i = 0;
+    for (; i < n; ++i) {
+        if ((col[i] != JOB_SEGMENT_NONE) && (col[i] >= d->n)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Create a segment from its serialization, validating the job ids, which
+ * must ascend, and the dictionary codes
+ */
+job_segment_t job_segment_deserialize(const char *buf, size_t len)
+{
+    assert(buf != NULL);
+
+    const char *end = buf + len;
+    if (len < 4) {
+        return NULL;
+    }
+    uint32_t n = get_u32(buf), i = 0;
+    buf += 4;
+    if ((size_t)(end - buf) / SEGMENT_JOB_SZ < n) {
+        return NULL;
+    }
+
+    job_segment_t seg = create_job_segment();
+    if (n) {
+        seg->n = seg->cap = n;
+        seg->job_id = RedisModule_Alloc(n * sizeof(uint32_t));
+        seg->start_time = RedisModule_Alloc(n * sizeof(int64_t));
+        seg->end_time = RedisModule_Alloc(n * sizeof(int64_t));
+        seg->uid = RedisModule_Alloc(n * sizeof(uint32_t));
+        seg->gid = RedisModule_Alloc(n * sizeof(uint32_t));
+        seg->nnodes = RedisModule_Alloc(n * sizeof(uint32_t));
+        seg->state = RedisModule_Alloc(n * sizeof(uint32_t));
+        seg->partition = RedisModule_Alloc(n * sizeof(uint32_t));
+        seg->job_name = RedisModule_Alloc(n * sizeof(uint32_t));
+    }
+    buf = deserialize_u32(buf, seg->job_id, n);
+    buf = deserialize_i64(buf, seg->start_time, n);
+    buf = deserialize_i64(buf, seg->end_time, n);
+    buf = deserialize_u32(buf, seg->uid, n);
+    buf = deserialize_u32(buf, seg->gid, n);
+    buf = deserialize_u32(buf, seg->nnodes, n);
+    buf = deserialize_u32(buf, seg->state, n);
+    buf = deserialize_u32(buf, seg->partition, n);
+    buf = deserialize_u32(buf, seg->job_name, n);
+    buf = deserialize_dict(buf, end, &seg->partitions);
+    if (buf) {
+        buf = deserialize_dict(buf, end, &seg->job_names);
+    }
+    if ((buf != end) ||
+        !valid_codes(seg->partition, n, &seg->partitions) ||
+        !valid_codes(seg->job_name, n, &seg->job_names)) {
+        destroy_job_segment(&seg);
+        return NULL;
+    }
+    for (; i < n; ++i) {
+        if (!seg->job_id[i] || (i && (seg->job_id[i] <= seg->job_id[i - 1]))) {
+            destroy_job_segment(&seg);
+            return NULL;
+        }
+        job_bitmap_add(seg->jobs, seg->job_id[i]);
+    }
+    return seg;
+}
+
+/*
+ * The job segment of an open key, NULL if the key holds none
+ */
+job_segment_t job_segment_get(RedisModuleKey *key)
+{
+    if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_MODULE) ||
+        (RedisModule_ModuleTypeGetType(key) != job_segment_type)) {
+        return NULL;
+    }
+    return RedisModule_ModuleTypeGetValue(key);
+}
+
+/*
+ * Module type callbacks.  A job segment is persisted in its serialized form
+ */
+void *job_segment_rdb_load(RedisModuleIO *rdb, int encver)
+{
+    if (encver != JOB_SEGMENT_TYPE_ENCVER) {
+        RedisModule_LogIOError(rdb, "warning",
+            "unsupported job segment encoding version %d", encver);
+        return NULL;
+    }
+    size_t len = 0;
+    char *buf = RedisModule_LoadStringBuffer(rdb, &len);
+    if (!buf) {
+        return NULL;
+    }
+    job_segment_t seg = job_segment_deserialize(buf, len);
+    RedisModule_Free(buf);
+    if (!seg) {
+        RedisModule_LogIOError(rdb, "warning", "invalid job segment");
+    }
+    return seg;
+}
+
+void job_segment_rdb_save(RedisModuleIO *rdb, void *value)
+{
+    size_t len = job_segment_serialized_size(value);
+    char *buf = RedisModule_Alloc(len);
+    job_segment_serialize(value, buf);
+    RedisModule_SaveStringBuffer(rdb, buf, len);
+    RedisModule_Free(buf);
+}
+
+/*
+ * A segment is derived from the job values and the daily index, which are
+ * rewritten on their own, so nothing is emitted; compaction builds the
+ * segment again
+ */
+void job_segment_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key,
+    void *value)
+{
+    (void)aof;
+    (void)key;
+    (void)value;
+}
+
+static size_t dict_mem_usage(const dict_t *d)
+{
+    size_t sz = d->cap * (sizeof(char *) + sizeof(uint32_t)) +
+        d->nslots * sizeof(uint32_t);
+    uint32_t i = 0;
+    for (; i < d->n; ++i) {
+        sz += d->len[i] + 1;
+    }
+    return sz;
+}
+
+size_t job_segment_mem_usage(const void *value)
+{
+    const struct job_segment *seg = value;
+    return sizeof(*seg) + seg->cap * SEGMENT_JOB_SZ +
+        dict_mem_usage(&seg->partitions) + dict_mem_usage(&seg->job_names) +
+        job_bitmap_mem_usage(seg->jobs);
+}
+
+void job_segment_digest(RedisModuleDigest *md, void *value)
+{
+    size_t len = job_segment_serialized_size(value);
+    char *buf = RedisModule_Alloc(len);
+    job_segment_serialize(value, buf);
+    RedisModule_DigestAddStringBuffer(md, (unsigned char *)buf, len);
+    RedisModule_DigestEndSequence(md);
+    RedisModule_Free(buf);
+}
+
+void job_segment_free(void *value)
+{
+    job_segment_t seg = value;
+    destroy_job_segment(&seg);
+}
@@ -0,0 +1,125 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_SEGMENT_H
+#define JOBCOMP_SEGMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <redismodule.h>
+
+#include "jobcomp_bitmap.h"
+#include "jobcomp_record.h"
+
+/*
+ * An immutable columnar segment of the jobs which ended on a closed day,
+ * frozen by compaction from the daily job index.  The typed members of the
+ * job values are held as arrays in job id order, and partition and job name
+ * as codes into dictionaries of the distinct values of the day, so MATCH
+ * scans a frozen day sequentially instead of opening every job key.  Only
+ * job values with all of their typed members are compacted; the other jobs
+ * of the day are matched key by key
+ */
+
+// Name and encoding version of the job segment module type
+#define JOB_SEGMENT_TYPE_NAME "slurmjcsg"
+#define JOB_SEGMENT_TYPE_ENCVER 0
+
+// Dictionary code of an absent partition or job name
+#define JOB_SEGMENT_NONE UINT32_MAX
+
+// A job segment is an opaque pointer
+typedef struct job_segment *job_segment_t;
+
+// A dictionary of distinct strings, coded by position
+typedef struct {
+    uint32_t n;
+    char *const *str;
+    const uint32_t *len;
+} job_segment_dict_t;
+
+// Read-only view of the columns of a segment, n jobs in job id order
+typedef struct {
+    uint32_t n;
+    const uint32_t *job_id;
+    const int64_t *start_time;
+    const int64_t *end_time;
+    const uint32_t *uid;
+    const uint32_t *gid;
+    const uint32_t *nnodes;
+    const uint32_t *state;
+    const uint32_t *partition;
+    const uint32_t *job_name;
+    job_segment_dict_t partitions;
+    job_segment_dict_t job_names;
+} job_segment_columns_t;
+
+// The job segment module type, created on module load
+extern RedisModuleType *job_segment_type;
+
+// Create an empty job segment
+job_segment_t create_job_segment(void);
+
+// Destroy a job segment
+void destroy_job_segment(job_segment_t *seg);
+
+// Append a job value and its unpacked record, in ascending job id order;
+// return 0 on success, -1 if the job cannot be compacted
+int job_segment_append(job_segment_t seg, const job_value_t *v,
+    const job_record_t *rec);
+
+// The ids of the jobs in the segment
+job_bitmap_t job_segment_jobs(const job_segment_t seg);
+
+// Fill in a view of the columns
+void job_segment_columns(const job_segment_t seg, job_segment_columns_t *col);
+
+// Dictionary code of a partition (kPartition) or job name (kJobName),
+// JOB_SEGMENT_NONE if no job of the segment has it
+uint32_t job_segment_code(const job_segment_t seg, int field,
+    const char *str, size_t len);
+
+// Serialized size of a segment, and its serialization into a buffer of that
+// size: the columns in turn, then the dictionaries, all integers
+// little-endian
+size_t job_segment_serialized_size(const job_segment_t seg);
+void job_segment_serialize(const job_segment_t seg, char *buf);
+
+// Create a segment from its serialization; return NULL if it is invalid
+job_segment_t job_segment_deserialize(const char *buf, size_t len);
+
+// The job segment of an open key, NULL if the key holds none
+job_segment_t job_segment_get(RedisModuleKey *key);
+
+// Module type callbacks of job segments
+void *job_segment_rdb_load(RedisModuleIO *rdb, int encver);
+void job_segment_rdb_save(RedisModuleIO *rdb, void *value);
+void job_segment_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key,
+    void *value);
+size_t job_segment_mem_usage(const void *value);
+void job_segment_digest(RedisModuleDigest *md, void *value);
+void job_segment_free(void *value);
+
+#endif /* JOBCOMP_SEGMENT_H */
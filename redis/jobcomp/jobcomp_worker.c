@@ -0,0 +1,192 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_worker.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+
+// Work queued for the worker threads, oldest first
+typedef struct work {
+    jobcomp_work_fn fn;
+    void *arg;
+    struct work *next;
+} work_t;
+
+// Time a worker steps aside after it releases the redis module lock, for
+// the main thread to take it, in microseconds
+#define WORKER_YIELD_USEC 100
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static work_t *queue_head = NULL;
+static work_t *queue_tail = NULL;
+static int workers = 0;
+
+// The workers take turns at the redis module lock in FIFO order, so only
+// one of them at a time competes with the main thread for it
+static pthread_mutex_t turn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turn_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long long turn_next = 0;
+static unsigned long long turn_serving = 0;
+
+/*
+ * Wait for the turn of the calling worker at the redis module lock
+ */
+static void turn_take(void)
+{
+    pthread_mutex_lock(&turn_lock);
+    unsigned long long ticket = turn_next++;
+    while (ticket != turn_serving) {
+        pthread_cond_wait(&turn_cond, &turn_lock);
+    }
+    pthread_mutex_unlock(&turn_lock);
+}
+
+/*
+ * End the turn of the calling worker at the redis module lock
+ */
+static void turn_give(void)
+{
+    pthread_mutex_lock(&turn_lock);
+    ++turn_serving;
+    pthread_cond_broadcast(&turn_cond);
+    pthread_mutex_unlock(&turn_lock);
+}
+
+/*
+ * Worker thread main loop: run queued work until redis exits
+ */
+static void *worker_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (!queue_head) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        work_t *work = queue_head;
+        queue_head = work->next;
+        if (!queue_head) {
+            queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&queue_lock);
+
+        work->fn(work->arg);
+        RedisModule_Free(work);
+    }
+    return NULL;
+}
+
+/*
+ * Start the worker threads, unless JCR_MATCH_THREADS is 0.  The threads
+ * are detached: the module exports data types, so redis never unloads it
+ */
+int jobcomp_worker_start(RedisModuleCtx *ctx)
+{
+    int i = 0;
+    for (; i < JCR_MATCH_THREADS; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, NULL) != 0) {
+            RedisModule_Log(ctx, "warning",
+                "started %d of %d match threads", i, JCR_MATCH_THREADS);
+            break;
+        }
+        pthread_detach(thread);
+        ++workers;
+    }
+    return REDISMODULE_OK;
+}
+
+/*
+ * Return the number of worker threads; without any, callers are expected
+ * to do their work on the main thread
+ */
+int jobcomp_worker_threads(void)
+{
+    return workers;
+}
+
+/*
+ * Queue work for the worker threads
+ */
+void jobcomp_worker_submit(jobcomp_work_fn fn, void *arg)
+{
+    work_t *work = RedisModule_Alloc(sizeof(work_t));
+    work->fn = fn;
+    work->arg = arg;
+    work->next = NULL;
+
+    pthread_mutex_lock(&queue_lock);
+    if (queue_tail) {
+        queue_tail->next = work;
+    } else {
+        queue_head = work;
+    }
+    queue_tail = work;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+/*
+ * Take the redis module lock through a thread safe context, in turn with
+ * the other workers
+ */
+void jobcomp_worker_lock(RedisModuleCtx *ctx)
+{
+    turn_take();
+    RedisModule_ThreadSafeContextLock(ctx);
+}
+
+/*
+ * Release the redis module lock taken by jobcomp_worker_lock
+ */
+void jobcomp_worker_unlock(RedisModuleCtx *ctx)
+{
+    RedisModule_ThreadSafeContextUnlock(ctx);
+    turn_give();
+}
+
+/*
+ * Release the redis module lock and take it back.  The main thread holds
+ * the lock except while it waits for events, and the lock is not fair, so
+ * the worker steps aside before it gives up its turn: a main thread woken
+ * by the release takes the lock meanwhile, and the next worker then waits
+ * for the end of its event loop turn
+ */
+void jobcomp_worker_yield(RedisModuleCtx *ctx)
+{
+    struct timespec ts = { 0, WORKER_YIELD_USEC * 1000 };
+    RedisModule_ThreadSafeContextUnlock(ctx);
+    nanosleep(&ts, NULL);
+    turn_give();
+    turn_take();
+    RedisModule_ThreadSafeContextLock(ctx);
+}
@@ -0,0 +1,64 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_WORKER_H
+#define JOBCOMP_WORKER_H
+
+#include <redismodule.h>
+
+/*
+ * A pool of JCR_MATCH_THREADS worker threads which run long commands off the
+ * redis main thread.  The command blocks its client (RedisModule_BlockClient)
+ * and queues its work; a worker touches the keyspace only while it holds the
+ * redis module lock through a thread safe context, and hands the lock back to
+ * the event loop between batches of work, see jobcomp_worker_yield.  Redis
+ * lets one thread at a time into the keyspace, so the workers serve
+ * concurrent commands rather than speed up one
+ */
+
+// Work run on a worker thread
+typedef void (*jobcomp_work_fn)(void *arg);
+
+// Start the worker threads, unless JCR_MATCH_THREADS is 0; return status
+int jobcomp_worker_start(RedisModuleCtx *ctx);
+
+// Return the number of worker threads
+int jobcomp_worker_threads(void);
+
+// Queue work for the worker threads
+void jobcomp_worker_submit(jobcomp_work_fn fn, void *arg);
+
+// Take the redis module lock through a thread safe context, in turn with the
+// other workers
+void jobcomp_worker_lock(RedisModuleCtx *ctx);
+
+// Release the redis module lock taken by jobcomp_worker_lock
+void jobcomp_worker_unlock(RedisModuleCtx *ctx);
+
+// Release the redis module lock taken by jobcomp_worker_lock, let the event
+// loop take it, then lock again
+void jobcomp_worker_yield(RedisModuleCtx *ctx);
+
+#endif /* JOBCOMP_WORKER_H */
@@ -0,0 +1,282 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_zone.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common/redis_fields.h"
+#include "jobcomp_auto.h"
+#include "jobcomp_query.h"
+
+// Job fields of the ranges and distinct value sets of a zone map
+static const int zone_range_field[ZONE_RANGES] = {
+    kStart, kEnd, kNNodes, kNCPUs
+};
+
+static const int zone_set_field[ZONE_SETS] = {
+    kState, kPartition
+};
+
+// Field of the zone map hash holding the number of jobs covered
+#define ZONE_JOBS "Jobs"
+
+#define ZONE_LABEL_SZ 32
+
+/*
+ * Helper function which formats the hash field names of the ranges of a
+ * zone map, <Label>Min and <Label>Max
+ */
+static void zone_labels(char min[][ZONE_LABEL_SZ], char max[][ZONE_LABEL_SZ])
+{
+    int i = 0;
+    for (; i < ZONE_RANGES; ++i) {
+        snprintf(min[i], ZONE_LABEL_SZ, "%sMin",
+            redis_field_labels[zone_range_field[i]]);
+        snprintf(max[i], ZONE_LABEL_SZ, "%sMax",
+            redis_field_labels[zone_range_field[i]]);
+    }
+}
+
+/*
+ * Read the zone map of an open key
+ */
+int job_zone_get(RedisModuleCtx *ctx, RedisModuleKey *key, job_zone_t *zone)
+{
+    memset(zone, 0, sizeof(*zone));
+    int type = RedisModule_KeyType(key);
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        return QUERY_NULL;
+    }
+    if (type != REDISMODULE_KEYTYPE_HASH) {
+        return QUERY_ERR;
+    }
+
+    char min[ZONE_RANGES][ZONE_LABEL_SZ], max[ZONE_RANGES][ZONE_LABEL_SZ];
+    zone_labels(min, max);
+    RedisModuleString *jobs = NULL;
+    RedisModuleString *lo[ZONE_RANGES] = {0}, *hi[ZONE_RANGES] = {0};
+    RedisModuleString *set[ZONE_SETS] = {0};
+    if (RedisModule_HashGet(key, REDISMODULE_HASH_CFIELDS,
+        ZONE_JOBS, &jobs,
+        min[ZONE_START], &lo[ZONE_START], max[ZONE_START], &hi[ZONE_START],
+        min[ZONE_END], &lo[ZONE_END], max[ZONE_END], &hi[ZONE_END],
+        min[ZONE_NNODES], &lo[ZONE_NNODES],
+        max[ZONE_NNODES], &hi[ZONE_NNODES],
+        min[ZONE_NCPUS], &lo[ZONE_NCPUS], max[ZONE_NCPUS], &hi[ZONE_NCPUS],
+        redis_field_labels[kState], &set[ZONE_STATE],
+        redis_field_labels[kPartition], &set[ZONE_PARTITION],
+        NULL) == REDISMODULE_ERR) {
+        return QUERY_ERR;
+    }
+
+    // Hash values are returned as new strings, freed whatever the outcome
+    int rc = QUERY_OK;
+    if (!jobs ||
+        (RedisModule_StringToLongLong(jobs, &zone->jobs) == REDISMODULE_ERR)) {
+        rc = QUERY_ERR;
+    }
+    int i = 0;
+    for (; i < ZONE_RANGES; ++i) {
+        if (lo[i] && hi[i] &&
+            (RedisModule_StringToLongLong(lo[i], &zone->min[i])
+                == REDISMODULE_OK) &&
+            (RedisModule_StringToLongLong(hi[i], &zone->max[i])
+                == REDISMODULE_OK)) {
+            zone->has[i] = 1;
+        }
+        if (lo[i]) {
+            RedisModule_FreeString(ctx, lo[i]);
+        }
+        if (hi[i]) {
+            RedisModule_FreeString(ctx, hi[i]);
+        }
+    }
+    for (i = 0; i < ZONE_SETS; ++i) {
+        size_t len = 0;
+        const char *s = set[i] ? RedisModule_StringPtrLen(set[i], &len) : "";
+        if (len >= ZONE_DISTINCT_SZ) {
+            rc = QUERY_ERR;
+        } else {
+            memcpy(zone->distinct[i], s, len);
+            zone->distinct[i][len] = '\0';
+        }
+        if (set[i]) {
+            RedisModule_FreeString(ctx, set[i]);
+        }
+    }
+    if (jobs) {
+        RedisModule_FreeString(ctx, jobs);
+    }
+    return rc;
+}
+
+/*
+ * Write a zone map to an open key
+ */
+int job_zone_set(RedisModuleCtx *ctx, RedisModuleKey *key,
+    const job_zone_t *zone)
+{
+    char min[ZONE_RANGES][ZONE_LABEL_SZ], max[ZONE_RANGES][ZONE_LABEL_SZ];
+    zone_labels(min, max);
+    int rc = QUERY_OK;
+
+    // Ranges no job had a value for are left out of the hash
+    int i = 0;
+    for (; (i < ZONE_RANGES) && (rc == QUERY_OK); ++i) {
+        if (!zone->has[i]) {
+            continue;
+        }
+        RedisModuleString *lo = RedisModule_CreateStringFromLongLong(ctx,
+            zone->min[i]);
+        RedisModuleString *hi = RedisModule_CreateStringFromLongLong(ctx,
+            zone->max[i]);
+        if (RedisModule_HashSet(key, REDISMODULE_HASH_CFIELDS,
+            min[i], lo, max[i], hi, NULL) == REDISMODULE_ERR) {
+            rc = QUERY_ERR;
+        }
+        RedisModule_FreeString(ctx, lo);
+        RedisModule_FreeString(ctx, hi);
+    }
+    if (rc == QUERY_ERR) {
+        return QUERY_ERR;
+    }
+
+    // The job count goes last, so an interrupted update leaves it short
+    RedisModuleString *set[ZONE_SETS];
+    for (i = 0; i < ZONE_SETS; ++i) {
+        set[i] = RedisModule_CreateString(ctx, zone->distinct[i],
+            strlen(zone->distinct[i]));
+    }
+    RedisModuleString *jobs = RedisModule_CreateStringFromLongLong(ctx,
+        zone->jobs);
+    if (RedisModule_HashSet(key, REDISMODULE_HASH_CFIELDS,
+        redis_field_labels[kState], set[ZONE_STATE],
+        redis_field_labels[kPartition], set[ZONE_PARTITION],
+        ZONE_JOBS, jobs,
+        NULL) == REDISMODULE_ERR) {
+        rc = QUERY_ERR;
+    }
+    for (i = 0; i < ZONE_SETS; ++i) {
+        RedisModule_FreeString(ctx, set[i]);
+    }
+    RedisModule_FreeString(ctx, jobs);
+    return rc;
+}
+
+/*
+ * Helper function which tells if a value is in a ",a,b," list
+ */
+static int zone_listed(const char *list, const char *value, size_t len)
+{
+    const char *p = list;
+    while ((p = strchr(p, ',')) != NULL) {
+        if ((strncmp(p + 1, value, len) == 0) && (p[len + 1] == ',')) {
+            return 1;
+        }
+        ++p;
+    }
+    return 0;
+}
+
+/*
+ * Helper function which adds a value to a distinct value set, held as a
+ * ",a,b," list; a set which outgrows the list, or a value which cannot be
+ * listed, turns the set into ZONE_DISTINCT_ANY
+ */
+static void zone_distinct_add(char *list, const char *value, size_t len)
+{
+    if (!strcmp(list, ZONE_DISTINCT_ANY) ||
+        zone_listed(list, value, len)) {
+        return;
+    }
+    size_t sz = strlen(list);
+    size_t n = 0;
+    const char *p = list;
+    while ((p = strchr(p + 1, ',')) != NULL) {
+        ++n;
+    }
+    if (memchr(value, ',', len) || (n >= ZONE_DISTINCT_MAX) ||
+        (sz + len + 2 >= ZONE_DISTINCT_SZ)) {
+        strcpy(list, ZONE_DISTINCT_ANY);
+        return;
+    }
+    if (!sz) {
+        list[sz++] = ',';
+    }
+    memcpy(list + sz, value, len);
+    list[sz + len] = ',';
+    list[sz + len + 1] = '\0';
+}
+
+/*
+ * Widen a zone map to cover a job
+ */
+void job_zone_add(job_zone_t *zone, const job_record_t *rec, int added)
+{
+    int i = 0;
+    for (; i < ZONE_RANGES; ++i) {
+        long long v;
+        int field = zone_range_field[i];
+        if (((field == kStart) || (field == kEnd)) ?
+            (job_record_time(rec, field, &v) != 0) :
+            (job_record_int(rec, field, &v) != 0)) {
+            continue;
+        }
+        if (!zone->has[i] || (v < zone->min[i])) {
+            zone->min[i] = v;
+        }
+        if (!zone->has[i] || (v > zone->max[i])) {
+            zone->max[i] = v;
+        }
+        zone->has[i] = 1;
+    }
+    for (i = 0; i < ZONE_SETS; ++i) {
+        char buf[JOB_RECORD_TEXT_SZ];
+        const char *text = NULL;
+        int len = job_record_text(rec, zone_set_field[i], buf, &text);
+        if (len >= 0) {
+            zone_distinct_add(zone->distinct[i], text, len);
+        }
+    }
+    if (added) {
+        ++zone->jobs;
+    }
+}
+
+/*
+ * Tell if a value may be in a distinct value set of a zone map
+ */
+int job_zone_distinct(const job_zone_t *zone, int set, const char *value,
+    size_t len)
+{
+    const char *list = zone->distinct[set];
+    return !strcmp(list, ZONE_DISTINCT_ANY) || zone_listed(list, value, len);
+}
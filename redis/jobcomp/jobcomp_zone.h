@@ -0,0 +1,89 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_ZONE_H
+#define JOBCOMP_ZONE_H
+
+#include <redismodule.h>
+
+#include "jobcomp_record.h"
+
+/*
+ * Zone maps summarize the jobs of a day, so MATCH can skip days where no
+ * job could meet the criteria.  The zone map of a day is the hash
+ * <prefix>:idx:zon:<days>, maintained by SLURMJC.INDEX as jobs are indexed:
+ * the number of jobs it covers, the min and max of their start and end
+ * times, node and cpu counts, and their distinct states and partitions.  A
+ * zone map only speaks for the day when it covers every job of the day
+ * index, so days with jobs indexed by an earlier release are never skipped
+ */
+
+// Ranges of a zone map, each held as the fields <Label>Min and <Label>Max
+enum {
+    ZONE_START,
+    ZONE_END,
+    ZONE_NNODES,
+    ZONE_NCPUS,
+    ZONE_RANGES
+};
+
+// Distinct value sets of a zone map, each held as the field <Label>
+enum {
+    ZONE_STATE,
+    ZONE_PARTITION,
+    ZONE_SETS
+};
+
+// Most distinct values of a set, and most bytes of its ",a,b," list; a set
+// which outgrows either holds ZONE_DISTINCT_ANY
+#define ZONE_DISTINCT_MAX 16
+#define ZONE_DISTINCT_SZ 256
+#define ZONE_DISTINCT_ANY "*"
+
+typedef struct {
+    long long jobs;
+    int has[ZONE_RANGES];
+    long long min[ZONE_RANGES];
+    long long max[ZONE_RANGES];
+    char distinct[ZONE_SETS][ZONE_DISTINCT_SZ];
+} job_zone_t;
+
+// Read the zone map of an open key; return QUERY_OK, QUERY_NULL if the key
+// is empty or QUERY_ERR if it holds something else
+int job_zone_get(RedisModuleCtx *ctx, RedisModuleKey *key,
+    job_zone_t *zone);
+
+// Write a zone map to an open key; return QUERY_OK or QUERY_ERR
+int job_zone_set(RedisModuleCtx *ctx, RedisModuleKey *key,
+    const job_zone_t *zone);
+
+// Widen a zone map to cover a job; a job new to the day is counted
+void job_zone_add(job_zone_t *zone, const job_record_t *rec, int added);
+
+// Tell if a value may be in a distinct value set of a zone map
+int job_zone_distinct(const job_zone_t *zone, int set, const char *value,
+    size_t len);
+
+#endif /* JOBCOMP_ZONE_H */
@@ -29,7 +29,13 @@
 
 #include <redismodule.h>
 
+#include "jobcomp_bitmap.h"
+#include "jobcomp_bloom.h"
 #include "jobcomp_command.h"
+#include "jobcomp_compact.h"
+#include "jobcomp_record.h"
+#include "jobcomp_segment.h"
+#include "jobcomp_worker.h"
 
 const char *module_name = "slurm_jobcomp";
 const int module_version = 1;
@@ -45,6 +51,70 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx)
         return REDISMODULE_ERR;
     }
 
+    // Register the job record module type
+    RedisModuleTypeMethods job_record_methods = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = job_record_rdb_load,
+        .rdb_save = job_record_rdb_save,
+        .aof_rewrite = job_record_aof_rewrite,
+        .mem_usage = job_record_mem_usage,
+        .digest = job_record_digest,
+        .free = job_record_free
+    };
+    job_record_type = RedisModule_CreateDataType(ctx, JOB_RECORD_TYPE_NAME,
+        JOB_RECORD_TYPE_ENCVER, &job_record_methods);
+    if (!job_record_type) {
+        return REDISMODULE_ERR;
+    }
+
+    // Register the job index module type
+    RedisModuleTypeMethods job_bitmap_methods = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = job_bitmap_rdb_load,
+        .rdb_save = job_bitmap_rdb_save,
+        .aof_rewrite = job_bitmap_aof_rewrite,
+        .mem_usage = job_bitmap_mem_usage,
+        .digest = job_bitmap_digest,
+        .free = job_bitmap_free
+    };
+    job_bitmap_type = RedisModule_CreateDataType(ctx, JOB_BITMAP_TYPE_NAME,
+        JOB_BITMAP_TYPE_ENCVER, &job_bitmap_methods);
+    if (!job_bitmap_type) {
+        return REDISMODULE_ERR;
+    }
+
+    // Register the job segment module type
+    RedisModuleTypeMethods job_segment_methods = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = job_segment_rdb_load,
+        .rdb_save = job_segment_rdb_save,
+        .aof_rewrite = job_segment_aof_rewrite,
+        .mem_usage = job_segment_mem_usage,
+        .digest = job_segment_digest,
+        .free = job_segment_free
+    };
+    job_segment_type = RedisModule_CreateDataType(ctx, JOB_SEGMENT_TYPE_NAME,
+        JOB_SEGMENT_TYPE_ENCVER, &job_segment_methods);
+    if (!job_segment_type) {
+        return REDISMODULE_ERR;
+    }
+
+    // Register the job bloom filter module type
+    RedisModuleTypeMethods job_bloom_methods = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = job_bloom_rdb_load,
+        .rdb_save = job_bloom_rdb_save,
+        .aof_rewrite = job_bloom_aof_rewrite,
+        .mem_usage = job_bloom_mem_usage,
+        .digest = job_bloom_digest,
+        .free = job_bloom_free
+    };
+    job_bloom_type = RedisModule_CreateDataType(ctx, JOB_BLOOM_TYPE_NAME,
+        JOB_BLOOM_TYPE_ENCVER, &job_bloom_methods);
+    if (!job_bloom_type) {
+        return REDISMODULE_ERR;
+    }
+
     // Register the SLURMJC.INDEX command
     if (RedisModule_CreateCommand(ctx, JOBCOMP_COMMAND_INDEX, jobcomp_cmd_index,
             "write", 1, 1, 1)
@@ -52,6 +122,27 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx)
         return REDISMODULE_ERR;
     }
 
+    // Register the SLURMJC.STORE command
+    if (RedisModule_CreateCommand(ctx, JOBCOMP_COMMAND_STORE, jobcomp_cmd_store,
+            "write deny-oom", 1, 1, 1)
+        == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
+    // Register the SLURMJC.LOAD command
+    if (RedisModule_CreateCommand(ctx, JOBCOMP_COMMAND_LOAD, jobcomp_cmd_load,
+            "write deny-oom", 1, 1, 1)
+        == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
+    // Register the SLURMJC.IDXLOAD command
+    if (RedisModule_CreateCommand(ctx, JOBCOMP_COMMAND_IDXLOAD,
+            jobcomp_cmd_idxload, "write deny-oom", 1, 1, 1)
+        == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
     // Register the SLURMJC.MATCH command
     if (RedisModule_CreateCommand(ctx, JOBCOMP_COMMAND_MATCH, jobcomp_cmd_match,
             "write", 1, 1, 1)
@@ -66,5 +157,20 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx)
         return REDISMODULE_ERR;
     }
 
+    // Register the SLURMJC.BLOOM command
+    if (RedisModule_CreateCommand(ctx, JOBCOMP_COMMAND_BLOOM, jobcomp_cmd_bloom,
+            "readonly", 1, 1, 1)
+        == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
+    // Freeze closed days into job segments in the background
+    jobcomp_compact_start(ctx);
+
+    // Run job queries off the main thread
+    if (jobcomp_worker_start(ctx) == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
     return REDISMODULE_OK;
 }
@@ -0,0 +1,176 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ring_queue.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <src/common/xmalloc.h> /* xmalloc, ... */
+
+#define RING_QUEUE_CACHELINE 64
+
+/*
+ * Each slot carries a sequence number which tells producers and consumers
+ * whether the slot is free for the current lap around the ring or holds an
+ * item published during it
+ */
+typedef struct ring_queue_slot {
+    atomic_size_t seq;
+    void *item;
+} *ring_queue_slot_t;
+
+/*
+ * The ring queue.  Producers and consumers only contend on their own
+ * position counter, so keep those on separate cache lines
+ */
+typedef struct ring_queue {
+    size_t mask;
+    ring_queue_slot_t slots;
+    char pad0[RING_QUEUE_CACHELINE];
+    atomic_size_t push_pos;
+    char pad1[RING_QUEUE_CACHELINE];
+    atomic_size_t pop_pos;
+    char pad2[RING_QUEUE_CACHELINE];
+} *ring_queue_t;
+
+/*
+ * Create a ring queue
+ */
+ring_queue_t create_ring_queue(const ring_queue_init_t *init)
+{
+    assert(init != NULL);
+    size_t sz = 2;
+    while (sz < init->queue_sz) {
+        sz <<= 1;
+    }
+    ring_queue_t queue = xmalloc(sizeof(struct ring_queue));
+    queue->slots = xmalloc(sz * sizeof(struct ring_queue_slot));
+    queue->mask = sz - 1;
+    size_t i = 0;
+    for (; i < sz; ++i) {
+        atomic_init(&queue->slots[i].seq, i);
+        queue->slots[i].item = NULL;
+    }
+    atomic_init(&queue->push_pos, 0);
+    atomic_init(&queue->pop_pos, 0);
+    return queue;
+}
+
+/*
+ * Destroy a ring queue
+ */
+void destroy_ring_queue(ring_queue_t *queue)
+{
+    if (!queue || !*queue) {
+        return;
+    }
+    xfree((*queue)->slots);
+    xfree((*queue));
+}
+
+/*
+ * Push an item onto the queue.  Returns QUEUE_OK on success or QUEUE_FULL
+ * if every slot is occupied
+ */
+int ring_queue_push(ring_queue_t queue, void *item)
+{
+    ring_queue_slot_t slot;
+    size_t pos = atomic_load_explicit(&queue->push_pos, memory_order_relaxed);
+    for (;;) {
+        slot = &queue->slots[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->push_pos, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return QUEUE_FULL;
+        } else {
+            pos = atomic_load_explicit(&queue->push_pos, memory_order_relaxed);
+        }
+    }
+    slot->item = item;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return QUEUE_OK;
+}
+
+/*
+ * Pop an item from the queue.  Returns QUEUE_OK on success or QUEUE_EMPTY
+ * if there is nothing to pop
+ */
+int ring_queue_pop(ring_queue_t queue, void **item)
+{
+    ring_queue_slot_t slot;
+    size_t pos = atomic_load_explicit(&queue->pop_pos, memory_order_relaxed);
+    for (;;) {
+        slot = &queue->slots[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->pop_pos, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return QUEUE_EMPTY;
+        } else {
+            pos = atomic_load_explicit(&queue->pop_pos, memory_order_relaxed);
+        }
+    }
+    if (item) {
+        *item = slot->item;
+    }
+    slot->item = NULL;
+    atomic_store_explicit(&slot->seq, pos + queue->mask + 1,
+        memory_order_release);
+    return QUEUE_OK;
+}
+
+/*
+ * Return the approximate number of queued items.  The value is exact when
+ * no pushes or pops are in flight
+ */
+size_t ring_queue_depth(ring_queue_t queue)
+{
+    size_t pop = atomic_load_explicit(&queue->pop_pos, memory_order_relaxed);
+    size_t push = atomic_load_explicit(&queue->push_pos, memory_order_relaxed);
+    return (push > pop) ? (push - pop) : 0;
+}
+
+/*
+ * Return the number of slots in the queue
+ */
+size_t ring_queue_size(ring_queue_t queue)
+{
+    return queue->mask + 1;
+}
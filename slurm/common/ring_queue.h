@@ -0,0 +1,69 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <stddef.h>
+
+/*
+ * A bounded, lock-free, multi-producer/multi-consumer queue of pointers
+ */
+
+// Queue return codes
+enum {
+    QUEUE_OK = 0,
+    QUEUE_FULL = 2,
+    QUEUE_EMPTY = 3
+};
+
+// Queue is an opaque pointer
+typedef struct ring_queue *ring_queue_t;
+
+// Queue initialization
+typedef struct {
+    // Number of queue slots, rounded up to a power of two
+    size_t queue_sz;
+} ring_queue_init_t;
+
+// Create a ring queue
+ring_queue_t create_ring_queue(const ring_queue_init_t *init);
+
+// Destroy a ring queue; items still queued are not freed
+void destroy_ring_queue(ring_queue_t *queue);
+
+// Push an item onto the queue without blocking
+int ring_queue_push(ring_queue_t queue, void *item);
+
+// Pop an item from the queue without blocking
+int ring_queue_pop(ring_queue_t queue, void **item);
+
+// Approximate number of items in the queue
+size_t ring_queue_depth(ring_queue_t queue);
+
+// Number of queue slots
+size_t ring_queue_size(ring_queue_t queue);
+
+#endif /* RING_QUEUE_H */
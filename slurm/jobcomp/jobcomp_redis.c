@@ -27,8 +27,11 @@
 #include "config.h"
 #endif
 
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <hiredis.h>
 #include <uuid.h>
 
@@ -40,70 +43,79 @@
 
 #include "common/redis_fields.h"
 #include "jobcomp_redis_auto.h"
+#include "jobcomp_redis_conn.h"
 #include "jobcomp_redis_format.h"
+#include "jobcomp_redis_writer.h"
 
 const char plugin_name[] = "Job completion logging redis plugin";
 const char plugin_type[] = "jobcomp/redis";
 const uint32_t plugin_version = SLURM_VERSION_NUMBER;
 
+// Most job ids or job id ranges sent in one command of query criteria
+#define QUERY_JOBS_PER_SADD 1024
+
 const unsigned int _tmf = JCR_TMF;
 
 static const char *host = NULL;
 static uint32_t port = 0;
 static const char *pass = NULL;
 static const char *prefix = NULL;
-static redisContext *ctx = NULL;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static int writer_started = 0;
 
 /*
- * Connect to redis and try to authorize if we have a password
+ * Start the background writer on first use, so that only slurmctld (and not
+ * clients such as sacct) runs a writer thread
  */
-static int redis_connect(void)
+static int redis_writer_start(void)
 {
-    if (ctx) {
-        redisFree(ctx);
-        ctx = NULL;
-    }
-    ctx = redisConnect(host, port);
-    if (!ctx || ctx->err) {
-        slurm_error("redis connect error: %s", ctx->errstr);
-        return SLURM_ERROR;
-    }
-    if (pass) {
-        AUTO_REPLY redisReply *reply = redisCommand(ctx, "AUTH %s", pass);
-        if (reply && (reply->type == REDIS_REPLY_ERROR)) {
-            slurm_debug("redis error: %s", reply->str);
-            return SLURM_ERROR;
-        }
-    }
-    return SLURM_SUCCESS;
+    int rc = SLURM_SUCCESS;
+    pthread_mutex_lock(&writer_lock);
+    if (!writer_started) {
+        // The spool lives with the rest of the slurmctld state
+        AUTO_STR char *state_dir = slurm_get_state_save_location();
+        AUTO_STR char *spool_path = state_dir ?
+            xstrdup_printf("%s/jobcomp_redis.spool", state_dir) : NULL;
+        jobcomp_redis_writer_init_t writer_init = {
+            .prefix = prefix,
+            .queue_sz = JCR_QUEUE_SIZE,
+            .batch_sz = JCR_BATCH_SIZE,
+            .batch_wait = JCR_BATCH_WAIT,
+            .spool_path = spool_path,
+            .spool_sz = (size_t)JCR_SPOOL_SIZE * 1024 * 1024
+        };
+        rc = jobcomp_redis_writer_init(&writer_init);
+        writer_started = (rc == SLURM_SUCCESS);
+    }
+    pthread_mutex_unlock(&writer_lock);
+    return rc;
 }
 
 /*
- * Check if we are connected to redis. Give me a ping. One ping only please.
+ * Run a single redis command and count its round trip latency
  */
-static int redis_connected(void)
+static redisReply *redis_timed_command(redisContext *ctx, const char *fmt, ...)
 {
-    if (!ctx) {
-        return 0;
-    }
-    AUTO_REPLY redisReply *reply = redisCommand(ctx, "PING");
+    va_list ap;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    va_start(ap, fmt);
+    redisReply *reply = redisvCommand(ctx, fmt, ap);
+    va_end(ap);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
     if (reply) {
-        if (reply->type == REDIS_REPLY_ERROR) {
-            slurm_debug("redis error: %s", reply->str);
-            return 0;
-        }
-        if (reply->type == REDIS_REPLY_STATUS) {
-            return strcmp(reply->str, "PONG") == 0;
-        }
+        jobcomp_redis_latency_add(ctx, (t1.tv_sec - t0.tv_sec) * 1000000ULL +
+            (t1.tv_nsec - t0.tv_nsec) / 1000);
     }
-    return 0;
+    return reply;
 }
 
 /*
  * Add strings from one of the char-based job_cond sub-lists to the criteria
  * key: gid, job name, partition, uid, etc.
  */
-static int redis_add_job_criteria(const char *key, const List list) {
+static int redis_add_job_criteria(redisContext *ctx, const char *key,
+    const List list) {
     int pipeline = 0;
     const char *value;
     AUTO_LITER ListIterator it = slurm_list_iterator_create(list);
@@ -116,21 +128,54 @@ static int redis_add_job_criteria(const char *key, const List list) {
     return pipeline;
 }
 
+/*
+ * Helper function which orders job ids for qsort
+ */
+static int redis_cmp_job_id(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
 /*
  * Add integer job ids from the job_cond steps sub-list to the criteria key.
- * The user is asking for specific job ids.
+ * The user is asking for specific job ids.  The ids are sorted and runs of
+ * consecutive ids collapsed into "<lo>-<hi>" ranges, sent many to a
+ * command, so that a long list of job ids costs
+ * a few commands rather than one per id
  */
-static int redis_add_job_steps(const char *key, const List list) {
+static int redis_add_job_steps(redisContext *ctx, const char *key,
+    const List list) {
     int pipeline = 0;
-    char buf[32];
+    size_t n = 0, i = 0, argc = 2;
+    const char *argv[QUERY_JOBS_PER_SADD + 2] = { "SADD", key };
+    char buf[QUERY_JOBS_PER_SADD][24];
     const slurmdb_selected_step_t *step;
+    uint32_t *ids = xmalloc(slurm_list_count(list) * sizeof(uint32_t));
     AUTO_LITER ListIterator it = slurm_list_iterator_create(list);
     while ((step = slurm_list_next(it))) {
-        memset(buf, 0, sizeof(buf));
-        snprintf(buf, sizeof(buf)-1, "%u", step->jobid);
-        redisAppendCommand(ctx, "SADD %s %s", key, buf);
-        ++pipeline;
+        ids[n++] = step->jobid;
     }
+    qsort(ids, n, sizeof(uint32_t), redis_cmp_job_id);
+    while (i < n) {
+        uint32_t lo = ids[i], hi = ids[i];
+        for (++i; (i < n) && (ids[i] - hi <= 1); ++i) {
+            hi = ids[i];
+        }
+        char *arg = buf[argc - 2];
+        if (lo == hi) {
+            snprintf(arg, sizeof(buf[0]), "%u", lo);
+        } else {
+            snprintf(arg, sizeof(buf[0]), "%u-%u", lo, hi);
+        }
+        argv[argc++] = arg;
+        if ((argc == QUERY_JOBS_PER_SADD + 2) || (i == n)) {
+            redisAppendCommandArgv(ctx, (int)argc, argv, NULL);
+            ++pipeline;
+            argc = 2;
+        }
+    }
+    xfree(ids);
     redisAppendCommand(ctx, "EXPIRE %s %u", key, JCR_QUERY_TTL);
     ++pipeline;
     return pipeline;
@@ -159,6 +204,17 @@ int init(void)
     if (!pass) {
         pass = slurm_get_jobcomp_pass();
     }
+    jobcomp_redis_conn_init_t conn_init = {
+        .host = host,
+        .port = port,
+        .pass = pass,
+        .connect_timeout = JCR_CONNECT_TIMEOUT,
+        .command_timeout = JCR_COMMAND_TIMEOUT,
+        .keepalive = JCR_KEEPALIVE,
+        .nodelay = JCR_NODELAY
+    };
+    jobcomp_redis_conn_init(&conn_init);
+    jobcomp_redis_pool_init(JCR_POOL_SIZE);
     jobcomp_redis_format_init_t format_init = {
         .user_cache_sz = JCR_CACHE_SIZE,
         .user_cache_ttl = JCR_CACHE_TTL,
@@ -174,14 +230,18 @@ int init(void)
  */
 int fini(void)
 {
-    if (ctx) {
-        slurm_debug("%s finished", plugin_name);
-        redisFree(ctx);
-        ctx = NULL;
-    }
+    pthread_mutex_lock(&writer_lock);
+    if (writer_started) {
+        jobcomp_redis_writer_fini();
+        writer_started = 0;
+    }
+    pthread_mutex_unlock(&writer_lock);
+    jobcomp_redis_pool_fini();
+    slurm_debug("%s finished", plugin_name);
     xfree(host);
     xfree(pass);
     xfree(prefix);
+    jobcomp_redis_conn_fini();
     jobcomp_redis_format_fini();
     return SLURM_SUCCESS;
 }
@@ -199,22 +259,20 @@ int fini(void)
  */
 int slurm_jobcomp_set_location(char *location)
 {
-    if (redis_connected()) {
-        return SLURM_SUCCESS;
+    if (!prefix) {
+        AUTO_STR char *loc = location ? xstrdup(location) :
+            slurm_get_jobcomp_loc();
+        if (!loc || strcmp(loc, DEFAULT_JOB_COMP_LOC) == 0) {
+            prefix = xstrdup("job");
+        } else if (loc) {
+            prefix = xstrdup_printf("%s:job", loc);
+        }
     }
-    if (redis_connect() != SLURM_SUCCESS) {
+    jobcomp_redis_conn_t *conn = jobcomp_redis_pool_acquire();
+    if (!conn) {
         return SLURM_ERROR;
     }
-    if (prefix) {
-        return SLURM_SUCCESS;
-    }
-
-    AUTO_STR char *loc = location ? xstrdup(location) : slurm_get_jobcomp_loc();
-    if (!loc || strcmp(loc, DEFAULT_JOB_COMP_LOC) == 0) {
-        prefix = xstrdup("job");
-    } else if (loc) {
-        prefix = xstrdup_printf("%s:job", loc);
-    }
+    jobcomp_redis_pool_release(conn);
     return SLURM_SUCCESS;
 }
 
@@ -222,80 +280,113 @@ int slurm_jobcomp_set_location(char *location)
  * Log the completed job to redis.
  *
  * Each job is encoded as a redis hash set containing job data as field-value
- * pairs. The members of the hash set are sent as a pipelined, multi-statement
- * transaction, ending with the command SLURMJC.INDEX which indexes the job
- * (opaquely) within redis
+ * pairs.  The calling slurmctld thread only formats the job record and queues
+ * the fields; the background writer sends them to redis from its own thread
+ * and connection, so job completion never waits on redis.  Records which
+ * cannot be sent (redis down, queue full) are spooled to disk and replayed
  */
 int slurm_jobcomp_log_record(struct job_record *job)
 {
     if (!job) {
         return SLURM_SUCCESS;
     }
-    if (!redis_connected()) {
-        redis_connect();
-        if (!redis_connected()) {
-            return SLURM_ERROR;
-        }
+    if (!prefix || (redis_writer_start() != SLURM_SUCCESS)) {
+        return SLURM_ERROR;
     }
 
-    AUTO_FIELDS redis_fields_t fields = {0};
-    int rc = jobcomp_redis_format_fields(_tmf, job, &fields);
-    if (rc != SLURM_SUCCESS) {
+    redis_fields_t *fields = xmalloc(sizeof(redis_fields_t));
+    if ((jobcomp_redis_format_fields(_tmf, job, fields) != SLURM_SUCCESS) ||
+        (jobcomp_redis_writer_submit(fields) != SLURM_SUCCESS)) {
+        destroy_redis_fields(fields);
+        xfree(fields);
         return SLURM_ERROR;
     }
 
-    int i, err = 0, pipeline = 0;
-
-    // Start a multi-statement transaction to cover the creation of the job key
-    // and creation/update of the index
-    redisAppendCommand(ctx, "MULTI");
-    ++pipeline;
+    return SLURM_SUCCESS;
+}
 
-    // Add the job's field-value pairs to a redis hash set
-    for (i = 0; i < MAX_REDIS_FIELDS; ++i) {
-        if (fields.value[i]) {
-            redisAppendCommand(ctx, "HSET %s:%s %s %s", prefix,
-                fields.value[kJobID], redis_field_labels[i],
-                fields.value[i]);
-            ++pipeline;
+/*
+ * Use SLURMJC.MATCH to create a match set for the job criteria.  With a
+ * budget of JCR_MATCH_BUDGET ms, the match set holds the matches of the
+ * next part of the query, which resumes from the continuation token if one
+ * is given, and the token of the part after it is returned in token, which
+ * is emptied if there is none.  Returns 1 if there are matches to fetch
+ */
+static int redis_match_jobs(redisContext *ctx, const char *uuid_s,
+    char *token, size_t token_sz)
+{
+    AUTO_REPLY redisReply *reply = NULL;
+    const redisReply *matchset = NULL; // do not AUTO_REPLY
+    if (!JCR_MATCH_BUDGET) {
+        reply = redis_timed_command(ctx, "SLURMJC.MATCH %s %s", prefix,
+            uuid_s);
+        matchset = reply;
+    } else if (token[0]) {
+        reply = redis_timed_command(ctx, "SLURMJC.MATCH %s %s %u MS %s",
+            prefix, uuid_s, JCR_MATCH_BUDGET, token);
+    } else {
+        reply = redis_timed_command(ctx, "SLURMJC.MATCH %s %s %u MS",
+            prefix, uuid_s, JCR_MATCH_BUDGET);
+    }
+    token[0] = '\0';
+    if (JCR_MATCH_BUDGET && reply && (reply->type == REDIS_REPLY_ARRAY) &&
+        (reply->elements == 2)) {
+        matchset = reply->element[0];
+        const redisReply *next = reply->element[1]; // do not AUTO_REPLY
+        if (next->type == REDIS_REPLY_STRING) {
+            if (next->len < token_sz) {
+                memcpy(token, next->str, next->len + 1);
+            } else {
+                slurm_error("redis continuation token too long");
+            }
         }
     }
-    if (JCR_TTL > 0) {
-        redisAppendCommand(ctx, "EXPIRE %s:%s %lld", prefix,
-            fields.value[kJobID], JCR_TTL);
-        ++pipeline;
+    if (matchset && (matchset->type == REDIS_REPLY_STRING) && matchset->len) {
+        slurm_debug("redis job matches placed in %s", matchset->str);
+        return 1;
     }
+    if (reply && (reply->type == REDIS_REPLY_ERROR)) {
+        slurm_debug("redis error: %s", reply->str);
+    }
+    slurm_debug("redis job matches not found");
+    return 0;
+}
 
-    // Use SLURMJC.INDEX to index the job on the redis server
-    redisAppendCommand(ctx, "SLURMJC.INDEX %s %s", prefix,
-        fields.value[kJobID]);
-    ++pipeline;
-
-    // Pop the pipeline replies
-    for (i = 0; i < pipeline; ++i) {
-        AUTO_REPLY redisReply *reply = NULL;
-        redisGetReply(ctx, (void **)&reply);
-        if (reply && (reply->type == REDIS_REPLY_ERROR)) {
-            if (!err) {
-                slurm_debug("redis error: %s", reply->str);
+/*
+ * Use SLURMJC.FETCH to pull down the jobs of the match set in chunks and
+ * append them to the jobcomp list for slurm
+ */
+static void redis_fetch_jobs(redisContext *ctx, const char *uuid_s,
+    List job_list)
+{
+    do {
+        redis_fields_t fields; // do not AUTO_FIELDS
+        AUTO_REPLY redisReply *reply = redis_timed_command(ctx,
+            "SLURMJC.FETCH %s %s %u", prefix, uuid_s, JCR_FETCH_COUNT);
+        if (!reply || (reply->type == REDIS_REPLY_NIL) ||
+            (reply->type != REDIS_REPLY_ARRAY) ||
+            (reply->elements == 0)) {
+            break;
+        }
+        size_t i = 0;
+        for (; i < reply->elements; ++i) {
+            size_t j = 0;
+            const redisReply *subreply = reply->element[i]; // do not AUTO_REPLY
+            for (; j < subreply->elements; ++j) {
+                if (subreply->element[j]->type == REDIS_REPLY_STRING) {
+                    fields.value[j] = subreply->element[j]->str;
+                } else {
+                    fields.value[j] = NULL;
+                }
             }
-            err = 1;
+            jobcomp_job_rec_t *job = xmalloc(sizeof(jobcomp_job_rec_t));
+            if (jobcomp_redis_format_job(&fields, job) != SLURM_SUCCESS) {
+                jobcomp_destroy_job(job);
+                continue;
+            }
+            slurm_list_append(job_list, job);
         }
-    }
-
-    // Commit or rollback the transaction
-    AUTO_REPLY redisReply *reply = NULL;
-    if (err) {
-        slurm_debug("discarding redis transaction for job %s",
-            fields.value[kJobID]);
-        reply = redisCommand(ctx, "DISCARD");
-    } else {
-        slurm_debug("committing redis transaction for job %s",
-            fields.value[kJobID]);
-        reply = redisCommand(ctx, "EXEC");
-    }
-
-    return SLURM_SUCCESS;
+    } while (1);
 }
 
 /*
@@ -309,20 +400,12 @@ int slurm_jobcomp_log_record(struct job_record *job)
  * which searches for jobs matching the criteria and returns the name of a
  * key containing matching job ids.  If we get a matchset name, we then
  * issue the command SLURMJC.FETCH in order to receive the job data which
- * is then formatted and returned to slurm as the job list it requires
+ * is then formatted and returned to slurm as the job list it requires.
+ * With a match budget, the match and fetch are repeated for each part of
+ * the query until redis returns no continuation token
  */
-List slurm_jobcomp_get_jobs(slurmdb_job_cond_t *job_cond)
+static List redis_get_jobs(redisContext *ctx, slurmdb_job_cond_t *job_cond)
 {
-    if (!job_cond) {
-        return NULL;
-    }
-    if (!redis_connected()) {
-        redis_connect();
-        if (!redis_connected()) {
-            return NULL;
-        }
-    }
-
     int i, err = 0, pipeline = 0;
     char uuid_s[37];
     char key[128];
@@ -345,13 +428,14 @@ List slurm_jobcomp_get_jobs(slurmdb_job_cond_t *job_cond)
         AUTO_STR char *end = jobcomp_redis_format_time(_tmf,
             job_cond->usage_end);
         redisAppendCommand(ctx, "HSET %s:qry:%s %s %u %s %u "
-            "%s %s %s %s %sMin %u %sMax %u", prefix, uuid_s,
+            "%s %s %s %s %sMin %u %sMax %u %s %u", prefix, uuid_s,
             redis_field_labels[kABI], SLURM_REDIS_ABI,
             redis_field_labels[kTimeFormat], _tmf,
             redis_field_labels[kStart], start,
             redis_field_labels[kEnd], end,
             redis_field_labels[kNNodes], job_cond->nodes_min,
-            redis_field_labels[kNNodes], job_cond->nodes_max);
+            redis_field_labels[kNNodes], job_cond->nodes_max,
+            REDIS_QUERY_OVERLAP, JCR_QUERY_OVERLAP);
         redisAppendCommand(ctx, "EXPIRE %s:qry:%s %u", prefix, uuid_s,
             JCR_QUERY_TTL);
         pipeline += 2;
@@ -361,21 +445,21 @@ List slurm_jobcomp_get_jobs(slurmdb_job_cond_t *job_cond)
     if ((job_cond->groupid_list) && slurm_list_count(job_cond->groupid_list)) {
         memset(key, 0, sizeof(key));
         snprintf(key, sizeof(key)-1, "%s:qry:%s:gid", prefix, uuid_s);
-        pipeline += redis_add_job_criteria(key, job_cond->groupid_list);
+        pipeline += redis_add_job_criteria(ctx, key, job_cond->groupid_list);
     }
 
     // Create redis set for job list
     if ((job_cond->step_list) && slurm_list_count(job_cond->step_list)) {
         memset(key, 0, sizeof(key));
         snprintf(key, sizeof(key)-1, "%s:qry:%s:job", prefix, uuid_s);
-        pipeline += redis_add_job_steps(key, job_cond->step_list);
+        pipeline += redis_add_job_steps(ctx, key, job_cond->step_list);
     }
 
     // Create redis set for jobname list
     if ((job_cond->jobname_list) && slurm_list_count(job_cond->jobname_list)) {
         memset(key, 0, sizeof(key));
         snprintf(key, sizeof(key)-1, "%s:qry:%s:jnm", prefix, uuid_s);
-        pipeline += redis_add_job_criteria(key, job_cond->jobname_list);
+        pipeline += redis_add_job_criteria(ctx, key, job_cond->jobname_list);
     }
 
     // Create redis set for partition list
@@ -383,21 +467,21 @@ List slurm_jobcomp_get_jobs(slurmdb_job_cond_t *job_cond)
             slurm_list_count(job_cond->partition_list)) {
         memset(key, 0, sizeof(key));
         snprintf(key, sizeof(key)-1, "%s:qry:%s:prt", prefix, uuid_s);
-        pipeline += redis_add_job_criteria(key, job_cond->partition_list);
+        pipeline += redis_add_job_criteria(ctx, key, job_cond->partition_list);
     }
 
     // Create redis set for state list
     if ((job_cond->state_list) && slurm_list_count(job_cond->state_list)) {
         memset(key, 0, sizeof(key));
         snprintf(key, sizeof(key)-1, "%s:qry:%s:stt", prefix, uuid_s);
-        pipeline += redis_add_job_criteria(key, job_cond->state_list);
+        pipeline += redis_add_job_criteria(ctx, key, job_cond->state_list);
     }
 
     // Create redis set for uid list
     if ((job_cond->userid_list) && slurm_list_count(job_cond->userid_list)) {
         memset(key, 0, sizeof(key));
         snprintf(key, sizeof(key)-1, "%s:qry:%s:uid", prefix, uuid_s);
-        pipeline += redis_add_job_criteria(key, job_cond->userid_list);
+        pipeline += redis_add_job_criteria(ctx, key, job_cond->userid_list);
     }
 
     // Pop the pipeline replies
@@ -424,53 +508,35 @@ List slurm_jobcomp_get_jobs(slurmdb_job_cond_t *job_cond)
         reply = redisCommand(ctx, "EXEC");
     }
 
-    // Use SLURMJC.MATCH to create a match set for the job criteria
+    // Use SLURMJC.MATCH to match jobs to the criteria, a part at a time
+    // with a budget, and SLURMJC.FETCH to pull down the matches of each part
     {
-        int have_matches = 0;
-        AUTO_REPLY redisReply *reply = redisCommand(ctx, "SLURMJC.MATCH %s %s",
-            prefix, uuid_s);
-        if (reply && (reply->type == REDIS_REPLY_STRING)) {
-            slurm_debug("redis job matches placed in %s", reply->str);
-            have_matches = reply->len;
-        } else {
-            slurm_debug("redis job matches not found");
-        }
-        if (!have_matches) {
-            return job_list;
-        }
+        char token[128] = {0};
+        do {
+            if (redis_match_jobs(ctx, uuid_s, token, sizeof(token))) {
+                redis_fetch_jobs(ctx, uuid_s, job_list);
+            }
+        } while (token[0]);
     }
 
-    // Use SLURMJC.FETCH to pull down the matching jobs in chunks and build
-    // the return jobcomp list for slurm
-    do {
-        redis_fields_t fields; // do not AUTO_FIELDS
-        AUTO_REPLY redisReply *reply = redisCommand(ctx,
-            "SLURMJC.FETCH %s %s %u", prefix, uuid_s, JCR_FETCH_COUNT);
-        if (!reply || (reply->type == REDIS_REPLY_NIL) ||
-            (reply->type != REDIS_REPLY_ARRAY) ||
-            (reply->elements == 0)) {
-            break;
-        }
-        size_t i = 0;
-        for (; i < reply->elements; ++i) {
-            size_t j = 0;
-            const redisReply *subreply = reply->element[i]; // do not AUTO_REPLY
-            for (; j < subreply->elements; ++j) {
-                if (subreply->element[j]->type == REDIS_REPLY_STRING) {
-                    fields.value[j] = subreply->element[j]->str;
-                } else {
-                    fields.value[j] = NULL;
-                }
-            }
-            jobcomp_job_rec_t *job = xmalloc(sizeof(jobcomp_job_rec_t));
-            if (jobcomp_redis_format_job(&fields, job) != SLURM_SUCCESS) {
-                jobcomp_destroy_job(job);
-                continue;
-            }
-            slurm_list_append(job_list, job);
-        }
-    } while (1);
+    return job_list;
+}
 
+/*
+ * Run the query on a connection of the pool, so that concurrent queries
+ * neither share a connection nor contend with the writer, which has its own
+ */
+List slurm_jobcomp_get_jobs(slurmdb_job_cond_t *job_cond)
+{
+    if (!job_cond) {
+        return NULL;
+    }
+    jobcomp_redis_conn_t *conn = jobcomp_redis_pool_acquire();
+    if (!conn) {
+        return NULL;
+    }
+    List job_list = redis_get_jobs(conn->ctx, job_cond);
+    jobcomp_redis_pool_release(conn);
     return job_list;
 }
 
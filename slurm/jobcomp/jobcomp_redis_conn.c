@@ -0,0 +1,537 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_redis_conn.h"
+
+#include <assert.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <slurm/slurm.h> /* SLURM_SUCCESS, ... */
+#include <slurm/spank.h> /* slurm_debug, ... */
+#include <src/common/xmalloc.h> /* xmalloc, ... */
+
+#include "jobcomp_redis_auto.h"
+
+// Backoff between failed connection attempts: doubles from the min delay on
+// every failure up to the max delay, with jitter so that many clients do not
+// reconnect in lock step
+#define CONN_BACKOFF_MIN_MSEC 100L
+#define CONN_BACKOFF_MAX_MSEC 30000L
+
+// Round trip latencies are counted in buckets with 8 linear steps per power
+// of two, i.e. within 12.5% of the true value, up to 2^40 microseconds
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((40 - LATENCY_SUB_BITS + 1) * LATENCY_SUB)
+
+static const char *host = NULL;
+static uint32_t port = 0;
+static const char *pass = NULL;
+static long connect_timeout = 0;
+static long command_timeout = 0;
+static int keepalive = 0;
+static int nodelay = 1;
+
+// Latency histograms of the tcp [0] and unix socket [1] transports
+static atomic_size_t latency[2][LATENCY_BUCKETS];
+
+// The connection pool: a fixed array of connections, each either free or
+// handed out to one caller at a time
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_free = PTHREAD_COND_INITIALIZER;
+static jobcomp_redis_conn_t *pool = NULL;
+static int *pool_busy = NULL;
+static size_t pool_sz = 0;
+static size_t pool_in_use = 0;
+static size_t pool_acquired = 0;
+static size_t pool_waited = 0;
+static unsigned long long pool_wait_usec = 0;
+static size_t pool_refused = 0;
+
+/*
+ * Perform one-time initialization of the static data
+ */
+void jobcomp_redis_conn_init(const jobcomp_redis_conn_init_t *init)
+{
+    assert(init != NULL);
+    host = init->host;
+    port = init->port;
+    pass = init->pass;
+    connect_timeout = init->connect_timeout;
+    command_timeout = init->command_timeout;
+    keepalive = init->keepalive;
+    nodelay = init->nodelay;
+}
+
+/*
+ * Log the latency percentiles of every transport that was used
+ */
+static void latency_log()
+{
+    int i;
+    for (i = 0; i < 2; ++i) {
+        if (!jobcomp_redis_latency_percentile(i, 100)) {
+            continue;
+        }
+        slurm_verbose("redis %s round trip latency: p50 %lluus, p90 %lluus, "
+            "p99 %lluus, p99.9 %lluus, max %lluus", i ? "unix" : "tcp",
+            jobcomp_redis_latency_percentile(i, 50),
+            jobcomp_redis_latency_percentile(i, 90),
+            jobcomp_redis_latency_percentile(i, 99),
+            jobcomp_redis_latency_percentile(i, 99.9),
+            jobcomp_redis_latency_percentile(i, 100));
+    }
+}
+
+/*
+ * De-initialize the static data
+ */
+void jobcomp_redis_conn_fini()
+{
+    latency_log();
+    host = NULL;
+    port = 0;
+    pass = NULL;
+}
+
+/*
+ * Apply the command timeout and, on tcp, the keepalive and nodelay settings
+ * to a new context.  A command that runs past the timeout fails the context
+ * with an i/o error, so a hung redis costs at most one timeout per call
+ */
+static int conn_configure(redisContext *ctx, int unix_socket)
+{
+    if (command_timeout) {
+        struct timeval tv = {
+            .tv_sec = command_timeout / 1000,
+            .tv_usec = (command_timeout % 1000) * 1000
+        };
+        if (redisSetTimeout(ctx, tv) != REDIS_OK) {
+            slurm_debug("redis timeout error: %s", ctx->errstr);
+            return SLURM_ERROR;
+        }
+    }
+    if (unix_socket) {
+        return SLURM_SUCCESS;
+    }
+    // hiredis always sets TCP_NODELAY, so only an opt-out needs a call
+    int opt = 0;
+    if (!nodelay &&
+        setsockopt(ctx->fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt))) {
+        slurm_debug("redis nodelay error: %m");
+    }
+    if (keepalive > 0) {
+        opt = 1;
+        if (setsockopt(ctx->fd, SOL_SOCKET, SO_KEEPALIVE, &opt,
+            sizeof(opt))) {
+            slurm_debug("redis keepalive error: %m");
+        }
+#ifdef TCP_KEEPIDLE
+        opt = keepalive;
+        setsockopt(ctx->fd, IPPROTO_TCP, TCP_KEEPIDLE, &opt, sizeof(opt));
+#endif
+#ifdef TCP_KEEPINTVL
+        opt = (keepalive / 3) ? (keepalive / 3) : 1;
+        setsockopt(ctx->fd, IPPROTO_TCP, TCP_KEEPINTVL, &opt, sizeof(opt));
+#endif
+    }
+    return SLURM_SUCCESS;
+}
+
+/*
+ * Connect to redis and try to authorize if we have a password.  Any previous
+ * connection is closed first.  A context is only kept if both succeed
+ */
+static int conn_connect(jobcomp_redis_conn_t *conn)
+{
+    if (conn->ctx) {
+        redisFree(conn->ctx);
+        conn->ctx = NULL;
+    }
+    redisContext *ctx = NULL;
+    int unix_socket = host && (host[0] == '/');
+    struct timeval tv = {
+        .tv_sec = connect_timeout / 1000,
+        .tv_usec = (connect_timeout % 1000) * 1000
+    };
+    if (unix_socket) {
+        ctx = connect_timeout ? redisConnectUnixWithTimeout(host, tv) :
+            redisConnectUnix(host);
+    } else {
+        ctx = connect_timeout ? redisConnectWithTimeout(host, port, tv) :
+            redisConnect(host, port);
+    }
+    if (!ctx || ctx->err) {
+        slurm_debug("redis connect error: %s",
+            ctx ? ctx->errstr : "out of memory");
+        if (ctx) {
+            redisFree(ctx);
+        }
+        return SLURM_ERROR;
+    }
+    if (conn_configure(ctx, unix_socket) != SLURM_SUCCESS) {
+        redisFree(ctx);
+        return SLURM_ERROR;
+    }
+    if (pass) {
+        AUTO_REPLY redisReply *reply = redisCommand(ctx, "AUTH %s", pass);
+        if (!reply || (reply->type == REDIS_REPLY_ERROR)) {
+            slurm_debug("redis auth error: %s",
+                reply ? reply->str : ctx->errstr);
+            redisFree(ctx);
+            return SLURM_ERROR;
+        }
+    }
+    conn->ctx = ctx;
+    return SLURM_SUCCESS;
+}
+
+/*
+ * Schedule the next connection attempt after a failure: the delay doubles
+ * with every consecutive failure and is jittered within its upper half
+ */
+static void conn_backoff(jobcomp_redis_conn_t *conn)
+{
+    long delay = CONN_BACKOFF_MAX_MSEC;
+    if (conn->failures < 16) {
+        delay = CONN_BACKOFF_MIN_MSEC << conn->failures;
+        if (delay > CONN_BACKOFF_MAX_MSEC) {
+            delay = CONN_BACKOFF_MAX_MSEC;
+        }
+    }
+    if (!conn->seed) {
+        conn->seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)conn;
+    }
+    delay -= rand_r(&conn->seed) % (delay / 2 + 1);
+    ++conn->failures;
+
+    clock_gettime(CLOCK_MONOTONIC, &conn->retry_at);
+    conn->retry_at.tv_nsec += (delay % 1000) * 1000000L;
+    conn->retry_at.tv_sec += delay / 1000 +
+        conn->retry_at.tv_nsec / 1000000000L;
+    conn->retry_at.tv_nsec %= 1000000000L;
+
+    if (conn->failures == 1) {
+        slurm_error("redis connect to %s:%u failed, retrying in %ldms",
+            host, port, delay);
+    } else {
+        slurm_debug("redis connect attempt %u failed, retrying in %ldms",
+            conn->failures, delay);
+    }
+}
+
+/*
+ * Return a usable context.  Health is taken from the context itself: hiredis
+ * flags ctx->err whenever a command fails on i/o, so a context without an
+ * error is assumed connected and no PING is needed.  A broken or missing
+ * context is replaced lazily, but not before the backoff delay of the last
+ * failure has passed, so an unreachable redis costs nothing per call.
+ * Returns NULL if there is no connection
+ */
+redisContext *jobcomp_redis_conn_get(jobcomp_redis_conn_t *conn)
+{
+    assert(conn != NULL);
+    if (conn->ctx && !conn->ctx->err) {
+        return conn->ctx;
+    }
+    if (conn->ctx) {
+        slurm_debug("redis connection lost: %s", conn->ctx->errstr);
+    }
+    if (jobcomp_redis_conn_retry_msec(conn) > 0) {
+        return NULL;
+    }
+    if (conn_connect(conn) != SLURM_SUCCESS) {
+        conn_backoff(conn);
+        return NULL;
+    }
+    if (conn->failures) {
+        slurm_info("redis reconnected to %s:%u after %u failed attempt(s)",
+            host, port, conn->failures);
+        conn->failures = 0;
+    }
+    return conn->ctx;
+}
+
+/*
+ * Milliseconds until a connection attempt is allowed, 0 if one is allowed now
+ */
+long jobcomp_redis_conn_retry_msec(const jobcomp_redis_conn_t *conn)
+{
+    assert(conn != NULL);
+    if (!conn->failures) {
+        return 0;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long msec = (conn->retry_at.tv_sec - now.tv_sec) * 1000L +
+        (conn->retry_at.tv_nsec - now.tv_nsec) / 1000000L;
+    return (msec > 0) ? msec : 0;
+}
+
+/*
+ * Close the connection and forget its failure history
+ */
+void jobcomp_redis_conn_close(jobcomp_redis_conn_t *conn)
+{
+    assert(conn != NULL);
+    if (conn->ctx) {
+        redisFree(conn->ctx);
+        conn->ctx = NULL;
+    }
+    conn->failures = 0;
+}
+
+/*
+ * Bucket of a latency: exact below LATENCY_SUB, then LATENCY_SUB linear
+ * steps per power of two
+ */
+static size_t latency_bucket(unsigned long long usec)
+{
+    if (usec < LATENCY_SUB) {
+        return usec;
+    }
+    int msb = 63 - __builtin_clzll(usec);
+    size_t bucket = (msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB +
+        ((usec >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB - 1));
+    return (bucket < LATENCY_BUCKETS) ? bucket : LATENCY_BUCKETS - 1;
+}
+
+/*
+ * Upper bound of the latencies counted in a bucket
+ */
+static unsigned long long latency_bucket_max(size_t bucket)
+{
+    if (bucket < LATENCY_SUB) {
+        return bucket;
+    }
+    int msb = bucket / LATENCY_SUB + LATENCY_SUB_BITS - 1;
+    unsigned long long step = 1ULL << (msb - LATENCY_SUB_BITS);
+    return ((LATENCY_SUB + bucket % LATENCY_SUB) << (msb - LATENCY_SUB_BITS)) +
+        step - 1;
+}
+
+/*
+ * Count one round trip of usec microseconds against the transport of ctx
+ */
+void jobcomp_redis_latency_add(const redisContext *ctx,
+    unsigned long long usec)
+{
+    assert(ctx != NULL);
+    int unix_socket = (ctx->connection_type == REDIS_CONN_UNIX);
+    atomic_fetch_add_explicit(&latency[unix_socket][latency_bucket(usec)], 1,
+        memory_order_relaxed);
+}
+
+/*
+ * Approximate latency percentile of a transport, from its histogram
+ */
+unsigned long long jobcomp_redis_latency_percentile(int unix_socket,
+    double pct)
+{
+    size_t i, total = 0, seen = 0;
+    atomic_size_t *hist = latency[unix_socket ? 1 : 0];
+    for (i = 0; i < LATENCY_BUCKETS; ++i) {
+        total += atomic_load_explicit(&hist[i], memory_order_relaxed);
+    }
+    if (!total) {
+        return 0;
+    }
+    size_t rank = (size_t)(total * pct / 100.0);
+    if (rank >= total) {
+        rank = total - 1;
+    }
+    for (i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += atomic_load_explicit(&hist[i], memory_order_relaxed);
+        if (seen > rank) {
+            break;
+        }
+    }
+    return latency_bucket_max(i < LATENCY_BUCKETS ? i : LATENCY_BUCKETS - 1);
+}
+
+/*
+ * Create a pool of pool_sz connections.  Connections are only opened when
+ * first handed out, so a client that never queries costs nothing
+ */
+int jobcomp_redis_pool_init(size_t sz)
+{
+    pthread_mutex_lock(&pool_lock);
+    if (!pool) {
+        pool_sz = sz ? sz : 1;
+        pool = xmalloc(pool_sz * sizeof(jobcomp_redis_conn_t));
+        pool_busy = xmalloc(pool_sz * sizeof(int));
+        pool_in_use = 0;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return SLURM_SUCCESS;
+}
+
+/*
+ * Close every connection of the pool.  Callers must have released theirs
+ */
+void jobcomp_redis_pool_fini()
+{
+    size_t i;
+    pthread_mutex_lock(&pool_lock);
+    if (pool) {
+        if (pool_in_use) {
+            slurm_error("redis pool closed with %zu connection(s) in use",
+                pool_in_use);
+        }
+        if (pool_acquired) {
+            slurm_debug("redis pool: %zu connection(s), acquired %zu, "
+                "waited %zu (%lluus), refused %zu", pool_sz, pool_acquired,
+                pool_waited, pool_wait_usec, pool_refused);
+        }
+        for (i = 0; i < pool_sz; ++i) {
+            jobcomp_redis_conn_close(&pool[i]);
+        }
+        xfree(pool);
+        xfree(pool_busy);
+        pool_sz = 0;
+        pool_in_use = 0;
+        pthread_cond_broadcast(&pool_free);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Pick a free connection: a healthy one if we have it, otherwise one whose
+ * backoff has expired so that it may reconnect.  Returns pool_sz if every
+ * free connection is still backing off, i.e. redis is known to be down
+ */
+static size_t pool_pick()
+{
+    size_t i, pick = pool_sz;
+    for (i = 0; i < pool_sz; ++i) {
+        if (pool_busy[i]) {
+            continue;
+        }
+        if (pool[i].ctx && !pool[i].ctx->err) {
+            return i;
+        }
+        if ((pick == pool_sz) && !jobcomp_redis_conn_retry_msec(&pool[i])) {
+            pick = i;
+        }
+    }
+    return pick;
+}
+
+/*
+ * Hand out a connection for the exclusive use of the caller, waiting while
+ * every connection is in use.  Returns NULL without waiting or connecting
+ * if redis is known to be unreachable, or if a reconnect fails
+ */
+jobcomp_redis_conn_t *jobcomp_redis_pool_acquire()
+{
+    pthread_mutex_lock(&pool_lock);
+    if (!pool) {
+        pthread_mutex_unlock(&pool_lock);
+        return NULL;
+    }
+    if (pool_in_use == pool_sz) {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        while (pool && (pool_in_use == pool_sz)) {
+            pthread_cond_wait(&pool_free, &pool_lock);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ++pool_waited;
+        pool_wait_usec += (t1.tv_sec - t0.tv_sec) * 1000000ULL +
+            (t1.tv_nsec - t0.tv_nsec) / 1000;
+        if (!pool) {
+            pthread_mutex_unlock(&pool_lock);
+            return NULL;
+        }
+    }
+    size_t i = pool_pick();
+    if (i == pool_sz) {
+        ++pool_refused;
+        pthread_mutex_unlock(&pool_lock);
+        return NULL;
+    }
+    pool_busy[i] = 1;
+    ++pool_in_use;
+    ++pool_acquired;
+    jobcomp_redis_conn_t *conn = &pool[i];
+    pthread_mutex_unlock(&pool_lock);
+
+    // Connect, if need be, outside the lock
+    if (!jobcomp_redis_conn_get(conn)) {
+        jobcomp_redis_pool_release(conn);
+        pthread_mutex_lock(&pool_lock);
+        ++pool_refused;
+        pthread_mutex_unlock(&pool_lock);
+        return NULL;
+    }
+    return conn;
+}
+
+/*
+ * Give a connection back to the pool.  A connection that failed while it was
+ * handed out is closed here; its replacement is opened on next use
+ */
+void jobcomp_redis_pool_release(jobcomp_redis_conn_t *conn)
+{
+    assert(conn != NULL);
+    if (conn->ctx && conn->ctx->err) {
+        slurm_debug("redis connection lost: %s", conn->ctx->errstr);
+        redisFree(conn->ctx);
+        conn->ctx = NULL;
+    }
+    pthread_mutex_lock(&pool_lock);
+    if (pool && (conn >= pool) && (conn < pool + pool_sz)) {
+        pool_busy[conn - pool] = 0;
+        --pool_in_use;
+        pthread_cond_signal(&pool_free);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Fetch a snapshot of the pool counters
+ */
+void jobcomp_redis_pool_stats(jobcomp_redis_pool_stats_t *stats)
+{
+    assert(stats != NULL);
+    pthread_mutex_lock(&pool_lock);
+    stats->size = pool_sz;
+    stats->in_use = pool_in_use;
+    stats->acquired = pool_acquired;
+    stats->waited = pool_waited;
+    stats->wait_usec = pool_wait_usec;
+    stats->refused = pool_refused;
+    pthread_mutex_unlock(&pool_lock);
+}
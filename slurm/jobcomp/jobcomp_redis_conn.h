@@ -0,0 +1,121 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_REDIS_CONN_H
+#define JOBCOMP_REDIS_CONN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <hiredis.h>
+
+// Connection settings shared by every redis connection of the plugin
+typedef struct jobcomp_redis_conn_init {
+    // Redis host (JobCompHost), or the path of a unix socket if it starts
+    // with a slash
+    const char *host;
+    // Redis port (JobCompPort)
+    uint32_t port;
+    // Redis password (JobCompPass), may be NULL
+    const char *pass;
+    // Milliseconds allowed to connect, 0 for no limit
+    long connect_timeout;
+    // Milliseconds allowed for a command to be sent or answered, 0 for no
+    // limit
+    long command_timeout;
+    // Seconds of idle time before tcp keepalive probes, 0 to disable
+    int keepalive;
+    // Non-zero to disable Nagle's algorithm on tcp connections
+    int nodelay;
+} jobcomp_redis_conn_init_t;
+
+// A redis connection whose health is tracked from the results of its i/o.
+// Zero-initialize before first use; one thread at a time
+typedef struct jobcomp_redis_conn {
+    // The hiredis context, NULL until connected
+    redisContext *ctx;
+    // Consecutive failed connection attempts
+    unsigned int failures;
+    // No connection attempt before this time (CLOCK_MONOTONIC)
+    struct timespec retry_at;
+    // Jitter seed
+    unsigned int seed;
+} jobcomp_redis_conn_t;
+
+// Initialize the connection settings
+void jobcomp_redis_conn_init(const jobcomp_redis_conn_init_t *init);
+
+// De-initialize the connection settings
+void jobcomp_redis_conn_fini();
+
+// Return the connected context, reconnecting lazily with backoff, or NULL
+redisContext *jobcomp_redis_conn_get(jobcomp_redis_conn_t *conn);
+
+// Milliseconds until the next connection attempt is allowed
+long jobcomp_redis_conn_retry_msec(const jobcomp_redis_conn_t *conn);
+
+// Close the connection and reset its state
+void jobcomp_redis_conn_close(jobcomp_redis_conn_t *conn);
+
+// Record the latency of one round trip on the context's transport
+void jobcomp_redis_latency_add(const redisContext *ctx,
+    unsigned long long usec);
+
+// Latency percentile (0-100) of a transport in microseconds, 0 if no samples
+unsigned long long jobcomp_redis_latency_percentile(int unix_socket,
+    double pct);
+
+// Connection pool counters
+typedef struct jobcomp_redis_pool_stats {
+    // Connections in the pool
+    size_t size;
+    // Connections currently handed out
+    size_t in_use;
+    // Connections handed out
+    size_t acquired;
+    // Acquisitions which had to wait for a free connection
+    size_t waited;
+    // Microseconds spent waiting for a free connection
+    unsigned long long wait_usec;
+    // Acquisitions refused because redis was unreachable
+    size_t refused;
+} jobcomp_redis_pool_stats_t;
+
+// Create the connection pool; connections are opened on first use
+int jobcomp_redis_pool_init(size_t pool_sz);
+
+// Close every connection of the pool
+void jobcomp_redis_pool_fini();
+
+// Take a connected connection from the pool, NULL if redis is unreachable
+jobcomp_redis_conn_t *jobcomp_redis_pool_acquire();
+
+// Return a connection to the pool
+void jobcomp_redis_pool_release(jobcomp_redis_conn_t *conn);
+
+// Fetch a snapshot of the pool counters
+void jobcomp_redis_pool_stats(jobcomp_redis_pool_stats_t *stats);
+
+#endif /* JOBCOMP_REDIS_CONN_H */
@@ -383,6 +383,40 @@ int jobcomp_redis_format_job(const redis_fields_t *fields,
     return SLURM_SUCCESS;
 }
 
+/*
+ * Build the argument vector of one SLURMJC.STORE holding every non-null
+ * field of the job:
+ *   SLURMJC.STORE <prefix> <job id> <field> <value> [<field> <value> ...]
+ * The argv entries point into the fields and labels, nothing is copied,
+ * and the explicit lengths keep the values binary-safe.  Returns argc
+ */
+int jobcomp_redis_format_argv(const redis_fields_t *fields,
+    const char *prefix, const char **argv, size_t *argvlen)
+{
+    assert(fields != NULL);
+    assert(prefix != NULL);
+    assert(argv != NULL);
+    assert(argvlen != NULL);
+
+    int i, argc = 0;
+    argv[argc] = "SLURMJC.STORE";
+    argvlen[argc] = strlen(argv[argc]);
+    ++argc;
+    argv[argc] = prefix;
+    argvlen[argc++] = strlen(prefix);
+    argv[argc] = fields->value[kJobID];
+    argvlen[argc++] = strlen(fields->value[kJobID]);
+    for (i = 0; i < MAX_REDIS_FIELDS; ++i) {
+        if (fields->value[i]) {
+            argv[argc] = redis_field_labels[i];
+            argvlen[argc++] = strlen(redis_field_labels[i]);
+            argv[argc] = fields->value[i];
+            argvlen[argc++] = strlen(fields->value[i]);
+        }
+    }
+    return argc;
+}
+
 /*
  * Format a time_t into a string matching the requested format:
  * ISO8601 or unix epoch.
@@ -35,6 +35,10 @@
 #include "common/redis_fields.h"
 #include "jobcomp_redis_auto.h"
 
+// Most argv entries of a job's SLURMJC.STORE: command, prefix, job id and
+// field-value pairs
+#define REDIS_FIELDS_ARGC (3 + 2 * MAX_REDIS_FIELDS)
+
 // Job formatter initialization
 typedef struct jobcomp_redis_format_init {
     // Number of uid->user_name cache entries
@@ -61,6 +65,11 @@ int jobcomp_redis_format_fields(unsigned int tmf, const struct job_record *job,
 int jobcomp_redis_format_job(const redis_fields_t *fields,
     jobcomp_job_rec_t *job);
 
+// Build the argv/argvlen of a SLURMJC.STORE of all non-null job fields;
+// return argc.  The arrays must hold REDIS_FIELDS_ARGC entries
+int jobcomp_redis_format_argv(const redis_fields_t *fields,
+    const char *prefix, const char **argv, size_t *argvlen);
+
 // Format time_t into string for redis
 char *jobcomp_redis_format_time(unsigned int tmf, time_t t);
 
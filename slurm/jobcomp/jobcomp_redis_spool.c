@@ -0,0 +1,482 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_redis_spool.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <slurm/slurm.h> /* SLURM_SUCCESS, ... */
+#include <slurm/spank.h> /* slurm_debug, ... */
+#include <src/common/xmalloc.h> /* xmalloc, ... */
+
+#define SPOOL_MAGIC "JCRSPOOL"
+#define SPOOL_VERSION 2
+
+// Offset of the first job record, past the header
+#define SPOOL_DATA 64
+
+_Static_assert(MAX_REDIS_FIELDS <= 32, "field bitmap must fit 32 bits");
+
+/*
+ * The extent of the job records, [head, tail) of the file
+ */
+typedef struct spool_extent {
+    uint64_t head;
+    uint64_t tail;
+} spool_extent_t;
+
+/*
+ * The spool file header.  Job records occupy the extent in the current slot,
+ * each a 32-bit payload length followed by the payload: a 32-bit bitmap of
+ * the fields present and, for each present field, a 32-bit length and its
+ * bytes.  The tail is only advanced once a record is complete, so a crash
+ * while appending leaves no partial record behind.  Moving both ends at once
+ * writes the other slot and then switches to it, see spool_publish
+ */
+typedef struct spool_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t abi;
+    uint64_t slot;
+    spool_extent_t extent[2];
+    uint64_t records;
+} spool_header_t;
+
+_Static_assert(sizeof(spool_header_t) <= SPOOL_DATA,
+    "spool header must fit before the first job record");
+
+static pthread_mutex_t spool_lock = PTHREAD_MUTEX_INITIALIZER;
+static int spool_fd = -1;
+static unsigned char *base = NULL;
+static spool_header_t *header = NULL;
+static spool_extent_t *extent = NULL;
+static size_t spool_sz = 0;
+static uint64_t peek_off = 0;
+static size_t peek_count = 0;
+static size_t appended = 0;
+static size_t rejected = 0;
+
+/*
+ * Check the header of an existing spool file
+ */
+static int spool_valid(const char *path)
+{
+    if (memcmp(header->magic, SPOOL_MAGIC, sizeof(header->magic)) ||
+        (header->version != SPOOL_VERSION)) {
+        slurm_error("redis spool %s is not a spool file", path);
+        return 0;
+    }
+    // Field indexes are only ever appended, so older spools remain readable
+    if (header->abi > SLURM_REDIS_ABI) {
+        slurm_error("redis spool %s has abi %u, expected %u", path,
+            header->abi, SLURM_REDIS_ABI);
+        return 0;
+    }
+    if (header->slot > 1) {
+        slurm_error("redis spool %s is damaged", path);
+        return 0;
+    }
+    extent = &header->extent[header->slot];
+    if ((extent->head < SPOOL_DATA) || (extent->head > extent->tail) ||
+        (extent->tail > spool_sz)) {
+        slurm_error("redis spool %s is damaged", path);
+        return 0;
+    }
+    // A crash between advancing head and counting down records leaves a
+    // count behind for an empty spool
+    if ((extent->head == extent->tail) && header->records) {
+        slurm_info("redis spool %s is empty, dropping a stale count of %zu "
+            "job records", path, (size_t)header->records);
+        header->records = 0;
+    }
+    return 1;
+}
+
+/*
+ * Reset the header of an empty spool
+ */
+static void spool_reset()
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SPOOL_MAGIC, sizeof(header->magic));
+    header->version = SPOOL_VERSION;
+    header->abi = SLURM_REDIS_ABI;
+    header->slot = 0;
+    extent = &header->extent[0];
+    extent->head = SPOOL_DATA;
+    extent->tail = SPOOL_DATA;
+}
+
+/*
+ * Move both ends of the job records at once: the new extent goes to the slot
+ * not in use, which only becomes current once complete.  A crash leaves
+ * either extent in place, never the head of one with the tail of the other
+ */
+static void spool_publish(uint64_t head, uint64_t tail)
+{
+    uint64_t next = !header->slot;
+    header->extent[next].head = head;
+    header->extent[next].tail = tail;
+    atomic_thread_fence(memory_order_release);
+    header->slot = next;
+    extent = &header->extent[next];
+    msync(base, sizeof(*header), MS_ASYNC);
+}
+
+/*
+ * Move the records back to the start of the file to reclaim the space of
+ * replayed records.  Only done when the move does not overlap the records
+ * themselves, so that the old copy stays intact until the header points at
+ * the new one.  The copy is on disk before the header switches to it
+ */
+static void spool_compact()
+{
+    uint64_t shift = extent->head - SPOOL_DATA;
+    uint64_t used = extent->tail - extent->head;
+    if (!shift || (used > shift)) {
+        return;
+    }
+    memcpy(base + SPOOL_DATA, base + extent->head, used);
+    msync(base, SPOOL_DATA + used, MS_SYNC);
+    spool_publish(SPOOL_DATA, SPOOL_DATA + used);
+    peek_off -= shift;
+}
+
+/*
+ * Decode one record payload into heap-allocated job fields, NULL if the
+ * payload is damaged
+ */
+static redis_fields_t *spool_decode(const unsigned char *p, uint32_t payload)
+{
+    const unsigned char *end = p + payload;
+    uint32_t present, vlen;
+    int i;
+
+    if (payload < sizeof(present)) {
+        return NULL;
+    }
+    memcpy(&present, p, sizeof(present));
+    p += sizeof(present);
+    if (!(present & (1u << kJobID))) {
+        return NULL;
+    }
+    redis_fields_t *fields = xmalloc(sizeof(redis_fields_t));
+    for (i = 0; i < MAX_REDIS_FIELDS; ++i) {
+        if (!(present & (1u << i))) {
+            continue;
+        }
+        if ((end - p) < (ptrdiff_t)sizeof(vlen)) {
+            break;
+        }
+        memcpy(&vlen, p, sizeof(vlen));
+        p += sizeof(vlen);
+        if ((uint64_t)(end - p) < vlen) {
+            break;
+        }
+        fields->value[i] = xmalloc(vlen + 1);
+        memcpy(fields->value[i], p, vlen);
+        p += vlen;
+    }
+    if (i < MAX_REDIS_FIELDS) {
+        destroy_redis_fields(fields);
+        xfree(fields);
+        return NULL;
+    }
+    return fields;
+}
+
+/*
+ * Open the spool file, creating it at the configured size if it does not
+ * exist, and map it.  An existing spool keeps its size and its records.  The
+ * file is locked so that a second slurmctld sharing the state directory
+ * cannot replay the same records
+ */
+int jobcomp_redis_spool_init(const jobcomp_redis_spool_init_t *init)
+{
+    assert(init != NULL);
+    if (!init->path || (init->spool_sz <= SPOOL_DATA)) {
+        return SLURM_SUCCESS;
+    }
+
+    int rc = SLURM_ERROR;
+    pthread_mutex_lock(&spool_lock);
+    if (base) {
+        rc = SLURM_SUCCESS;
+        goto done;
+    }
+    spool_fd = open(init->path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (spool_fd < 0) {
+        slurm_error("redis spool %s: %s", init->path, strerror(errno));
+        goto done;
+    }
+    if (flock(spool_fd, LOCK_EX | LOCK_NB)) {
+        slurm_error("redis spool %s is in use: %s", init->path,
+            strerror(errno));
+        goto done;
+    }
+    struct stat st;
+    if (fstat(spool_fd, &st)) {
+        slurm_error("redis spool %s: %s", init->path, strerror(errno));
+        goto done;
+    }
+    int fresh = (st.st_size <= SPOOL_DATA);
+    size_t sz = fresh ? init->spool_sz : (size_t)st.st_size;
+    if (fresh) {
+        // Reserve the blocks up front: a full disk must not turn into a
+        // SIGBUS on a write through the mapping
+        int err = posix_fallocate(spool_fd, 0, sz);
+        if (err) {
+            slurm_error("redis spool %s: %s", init->path, strerror(err));
+            goto done;
+        }
+    }
+    void *map = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, spool_fd,
+        0);
+    if (map == MAP_FAILED) {
+        slurm_error("redis spool %s: %s", init->path, strerror(errno));
+        goto done;
+    }
+    base = map;
+    header = map;
+    spool_sz = sz;
+    if (!fresh && !spool_valid(init->path)) {
+        slurm_error("redis spool %s discarded", init->path);
+        fresh = 1;
+    }
+    if (fresh) {
+        spool_reset();
+    } else if (header->records) {
+        slurm_info("redis spool %s holds %zu job records to replay",
+            init->path, (size_t)header->records);
+    }
+    peek_off = extent->head;
+    peek_count = 0;
+    slurm_debug("redis spool %s mapped, %zu bytes", init->path, spool_sz);
+    rc = SLURM_SUCCESS;
+
+done:
+    if ((rc != SLURM_SUCCESS) && (spool_fd >= 0)) {
+        close(spool_fd);
+        spool_fd = -1;
+    }
+    pthread_mutex_unlock(&spool_lock);
+    return rc;
+}
+
+/*
+ * Flush the spool to disk and unmap it; its records are replayed after the
+ * next start
+ */
+void jobcomp_redis_spool_fini()
+{
+    pthread_mutex_lock(&spool_lock);
+    if (base) {
+        if (header->records) {
+            slurm_info("redis spool closed holding %zu job records",
+                (size_t)header->records);
+        }
+        msync(base, spool_sz, MS_SYNC);
+        munmap(base, spool_sz);
+        base = NULL;
+        header = NULL;
+        extent = NULL;
+        spool_sz = 0;
+    }
+    if (spool_fd >= 0) {
+        close(spool_fd);
+        spool_fd = -1;
+    }
+    pthread_mutex_unlock(&spool_lock);
+}
+
+/*
+ * Append an encoded copy of the job fields at the tail of the spool.  The
+ * record reaches disk through the page cache, so it survives a slurmctld
+ * crash; write-back is started at once to narrow the window of a host crash
+ */
+int jobcomp_redis_spool_append(const redis_fields_t *fields)
+{
+    assert(fields != NULL);
+    uint32_t payload = sizeof(uint32_t), present = 0, vlen;
+    int i;
+
+    for (i = 0; i < MAX_REDIS_FIELDS; ++i) {
+        if (fields->value[i]) {
+            present |= (1u << i);
+            payload += sizeof(vlen) + strlen(fields->value[i]);
+        }
+    }
+    size_t len = sizeof(payload) + payload;
+
+    pthread_mutex_lock(&spool_lock);
+    if (!base) {
+        pthread_mutex_unlock(&spool_lock);
+        return SLURM_ERROR;
+    }
+    if (extent->tail + len > spool_sz) {
+        spool_compact();
+    }
+    if (extent->tail + len > spool_sz) {
+        ++rejected;
+        pthread_mutex_unlock(&spool_lock);
+        return SLURM_ERROR;
+    }
+    unsigned char *rec = base + extent->tail, *p = rec;
+    memcpy(p, &payload, sizeof(payload));
+    p += sizeof(payload);
+    memcpy(p, &present, sizeof(present));
+    p += sizeof(present);
+    for (i = 0; i < MAX_REDIS_FIELDS; ++i) {
+        if (fields->value[i]) {
+            vlen = strlen(fields->value[i]);
+            memcpy(p, &vlen, sizeof(vlen));
+            p += sizeof(vlen);
+            memcpy(p, fields->value[i], vlen);
+            p += vlen;
+        }
+    }
+    extent->tail += len;
+    ++header->records;
+    ++appended;
+
+    // msync wants a page-aligned start
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    unsigned char *start = (unsigned char *)((uintptr_t)rec & ~(page - 1));
+    msync(start, p - start, MS_ASYNC);
+    msync(base, sizeof(*header), MS_ASYNC);
+    pthread_mutex_unlock(&spool_lock);
+    return SLURM_SUCCESS;
+}
+
+/*
+ * Decode up to max job records from the head of the spool into the batch;
+ * the caller owns the decoded fields.  The records stay spooled until
+ * jobcomp_redis_spool_consume.  A damaged record truncates the spool there
+ */
+size_t jobcomp_redis_spool_peek(redis_fields_t **batch, size_t max)
+{
+    assert(batch != NULL);
+    size_t n = 0;
+
+    pthread_mutex_lock(&spool_lock);
+    if (!base) {
+        pthread_mutex_unlock(&spool_lock);
+        return 0;
+    }
+    uint64_t off = extent->head;
+    while ((n < max) && (off < extent->tail)) {
+        uint32_t payload = 0;
+        redis_fields_t *fields = NULL;
+        if (extent->tail - off >= sizeof(payload)) {
+            memcpy(&payload, base + off, sizeof(payload));
+            if (extent->tail - off - sizeof(payload) >= payload) {
+                fields = spool_decode(base + off + sizeof(payload), payload);
+            }
+        }
+        if (!fields) {
+            slurm_error("redis spool damaged at offset %zu, dropping %zu "
+                "job records", (size_t)off, (size_t)header->records - n);
+            extent->tail = off;
+            header->records = n;
+            break;
+        }
+        batch[n++] = fields;
+        off += sizeof(payload) + payload;
+    }
+    if (off == extent->tail) {
+        // Nothing left past what was decoded, whatever the count says
+        header->records = n;
+    }
+    peek_off = off;
+    peek_count = n;
+    pthread_mutex_unlock(&spool_lock);
+    return n;
+}
+
+/*
+ * Remove the job records returned by the last peek.  An emptied spool starts
+ * over at the beginning of the file
+ */
+void jobcomp_redis_spool_consume()
+{
+    pthread_mutex_lock(&spool_lock);
+    if (base) {
+        if (peek_off == extent->tail) {
+            spool_publish(SPOOL_DATA, SPOOL_DATA);
+            header->records = 0;
+        } else {
+            extent->head = peek_off;
+            header->records -= (peek_count < header->records) ?
+                peek_count : header->records;
+        }
+        peek_off = extent->head;
+        peek_count = 0;
+        msync(base, sizeof(*header), MS_ASYNC);
+    }
+    pthread_mutex_unlock(&spool_lock);
+}
+
+/*
+ * Number of job records currently spooled
+ */
+size_t jobcomp_redis_spool_records()
+{
+    size_t records = 0;
+    pthread_mutex_lock(&spool_lock);
+    if (base) {
+        records = header->records;
+    }
+    pthread_mutex_unlock(&spool_lock);
+    return records;
+}
+
+/*
+ * Fetch a snapshot of the spool counters
+ */
+void jobcomp_redis_spool_stats(jobcomp_redis_spool_stats_t *stats)
+{
+    assert(stats != NULL);
+    pthread_mutex_lock(&spool_lock);
+    stats->records = base ? header->records : 0;
+    stats->used = base ? extent->tail - extent->head : 0;
+    stats->size = spool_sz;
+    stats->appended = appended;
+    stats->rejected = rejected;
+    pthread_mutex_unlock(&spool_lock);
+}
@@ -0,0 +1,82 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_REDIS_SPOOL_H
+#define JOBCOMP_REDIS_SPOOL_H
+
+#include <stddef.h>
+
+#include "jobcomp_redis_auto.h"
+
+/*
+ * A durable, append-only spool of job records kept in a memory-mapped file
+ * on the slurmctld host.  It holds records that cannot be sent to redis
+ * (redis unreachable, writer queue full) until they can be replayed
+ */
+
+// Spool initialization
+typedef struct jobcomp_redis_spool_init {
+    // Path of the spool file
+    const char *path;
+    // Size of the spool file in bytes, 0 disables the spool
+    size_t spool_sz;
+} jobcomp_redis_spool_init_t;
+
+// Spool counters
+typedef struct jobcomp_redis_spool_stats {
+    // Job records currently spooled
+    size_t records;
+    // Bytes of the spool file in use
+    size_t used;
+    // Size of the spool file
+    size_t size;
+    // Job records appended to the spool
+    size_t appended;
+    // Job records refused because the spool was full
+    size_t rejected;
+} jobcomp_redis_spool_stats_t;
+
+// Open (or create) the spool file and map it
+int jobcomp_redis_spool_init(const jobcomp_redis_spool_init_t *init);
+
+// Flush and unmap the spool file
+void jobcomp_redis_spool_fini();
+
+// Append a copy of the job fields to the spool
+int jobcomp_redis_spool_append(const redis_fields_t *fields);
+
+// Decode up to max of the oldest job records without removing them
+size_t jobcomp_redis_spool_peek(redis_fields_t **batch, size_t max);
+
+// Remove the job records returned by the last peek
+void jobcomp_redis_spool_consume();
+
+// Number of job records currently spooled
+size_t jobcomp_redis_spool_records();
+
+// Fetch a snapshot of the spool counters
+void jobcomp_redis_spool_stats(jobcomp_redis_spool_stats_t *stats);
+
+#endif /* JOBCOMP_REDIS_SPOOL_H */
@@ -0,0 +1,547 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jobcomp_redis_writer.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include <slurm/slurm.h> /* SLURM_SUCCESS, ... */
+#include <slurm/spank.h> /* slurm_debug, ... */
+#include <src/common/xmalloc.h> /* xmalloc, ... */
+#include <src/common/xstring.h> /* xstrdup, ... */
+
+#include "common/redis_fields.h"
+#include "common/ring_queue.h"
+#include "jobcomp_redis_conn.h"
+#include "jobcomp_redis_format.h"
+#include "jobcomp_redis_spool.h"
+
+// Most spooled job records replayed to redis in one round trip
+#define WRITER_REPLAY_BATCH 1024
+
+// Least seconds between two reports of the writer counters, or between
+// two errors about dropped job records
+#define WRITER_REPORT_SECS 60
+
+// Outcome of writing a batch of job records
+enum {
+    WRITE_OK = 0,
+    WRITE_FAILED = 1,
+    WRITE_RETRY = 2
+};
+
+static char *prefix = NULL;
+static size_t batch_sz = 1;
+static long batch_wait = 0;
+static ring_queue_t queue = NULL;
+static sem_t wakeup;
+static pthread_t writer;
+static atomic_int running = 0;
+static atomic_int stopping = 0;
+static atomic_size_t queue_peak = 0;
+static atomic_size_t queued = 0;
+static atomic_size_t written = 0;
+static atomic_size_t dropped = 0;
+static atomic_size_t failed = 0;
+static atomic_size_t batches = 0;
+static atomic_ullong busy_usec = 0;
+static atomic_size_t replayed = 0;
+static atomic_ullong replay_usec = 0;
+static atomic_llong drop_logged = 0;
+
+/*
+ * Free a heap-allocated redis_fields_t and its values
+ */
+static void release_fields(redis_fields_t *fields)
+{
+    if (fields) {
+        destroy_redis_fields(fields);
+        xfree(fields);
+    }
+}
+
+/*
+ * Sleep on the wakeup semaphore until the absolute (CLOCK_REALTIME) deadline
+ */
+static void writer_wait_until(const struct timespec *deadline)
+{
+    while (sem_timedwait(&wakeup, deadline) == -1 && errno == EINTR) {
+    }
+}
+
+/*
+ * Sleep on the wakeup semaphore for up to msecs milliseconds
+ */
+static void writer_wait(long msecs)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (msecs % 1000) * 1000000L;
+    ts.tv_sec += msecs / 1000 + ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    writer_wait_until(&ts);
+}
+
+/*
+ * Microseconds elapsed since t0 (CLOCK_MONOTONIC)
+ */
+static unsigned long long usec_since(const struct timespec *t0)
+{
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1000000ULL +
+        (t1.tv_nsec - t0->tv_nsec) / 1000;
+}
+
+/*
+ * Log the writer counters every WRITER_REPORT_SECS while the queue peak or
+ * the count of dropped job records grows, so a running slurmctld tells
+ * when the queue is too small for its job completion rate, and while the
+ * spool fills or is replayed, so that it can be sized from the peak spool
+ * use and the replay rate of an outage
+ */
+static void writer_report(void)
+{
+    static time_t last = 0;
+    static size_t last_peak = 0, last_dropped = 0;
+    static size_t last_spooled = 0, last_replayed = 0;
+    time_t now = time(NULL);
+    if (now - last < WRITER_REPORT_SECS) {
+        return;
+    }
+    jobcomp_redis_writer_stats_t stats;
+    jobcomp_redis_writer_stats(&stats);
+    int queue = (stats.queue_peak != last_peak) ||
+        (stats.dropped != last_dropped);
+    int spool = (stats.spooled != last_spooled) ||
+        (stats.replayed != last_replayed);
+    if (!queue && !spool) {
+        return;
+    }
+    last = now;
+    last_peak = stats.queue_peak;
+    last_dropped = stats.dropped;
+    last_spooled = stats.spooled;
+    last_replayed = stats.replayed;
+    slurm_info("redis writer: queue depth %zu, peak %zu/%zu, queued %zu, "
+        "written %zu, failed %zu, dropped %zu", stats.queue_depth,
+        stats.queue_peak, stats.queue_sz, stats.queued, stats.written,
+        stats.failed, stats.dropped);
+    if (spool) {
+        slurm_info("redis writer spool: spooled %zu, replayed %zu "
+            "(%.0f jobs/sec), holding %zu job records in %zu/%zu bytes",
+            stats.spooled, stats.replayed, stats.replay_usec ?
+                (double)stats.replayed * 1e6 / stats.replay_usec : 0.0,
+            stats.spool_records, stats.spool_used, stats.spool_sz);
+    }
+}
+
+/*
+ * Return non-zero if the absolute (CLOCK_REALTIME) deadline has passed
+ */
+static int deadline_passed(const struct timespec *deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (now.tv_sec > deadline->tv_sec) ||
+        ((now.tv_sec == deadline->tv_sec) &&
+         (now.tv_nsec >= deadline->tv_nsec));
+}
+
+/*
+ * Write a batch of job records as one pipeline of SLURMJC.STORE commands
+ * (group commit), one per job.  Each STORE creates the job hash, applies
+ * its ttl and indexes it atomically on the redis server, so no transaction
+ * is needed and the whole batch costs one round trip.  Returns the number
+ * of jobs redis refused byref, or WRITE_RETRY if the connection failed and
+ * the batch should be sent again
+ */
+static int writer_write_batch(redisContext *ctx, redis_fields_t **batch,
+    size_t len, size_t *refused)
+{
+    size_t i;
+    const char *argv[REDIS_FIELDS_ARGC];
+    size_t argvlen[REDIS_FIELDS_ARGC];
+
+    for (i = 0; i < len; ++i) {
+        int argc = jobcomp_redis_format_argv(batch[i], prefix, argv, argvlen);
+        redisAppendCommandArgv(ctx, argc, argv, argvlen);
+    }
+
+    // Pop the pipeline replies, one per job
+    *refused = 0;
+    for (i = 0; i < len; ++i) {
+        AUTO_REPLY redisReply *reply = NULL;
+        if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+            slurm_debug("redis error: %s", ctx->errstr);
+            return WRITE_RETRY;
+        }
+        if (reply && (reply->type == REDIS_REPLY_ERROR)) {
+            slurm_debug("redis error storing job %s: %s",
+                batch[i]->value[kJobID], reply->str);
+            ++(*refused);
+        }
+    }
+
+    slurm_debug2("redis stored %zu of %zu job(s) from job %s", len - *refused,
+        len, batch[0]->value[kJobID]);
+    return (*refused) ? WRITE_FAILED : WRITE_OK;
+}
+
+/*
+ * Move job records that cannot be delivered now to the spool.  Returns the
+ * number of records kept in the batch because the spool could not take them
+ */
+static size_t writer_spool(redis_fields_t **batch, size_t len)
+{
+    size_t i, kept = 0;
+    for (i = 0; i < len; ++i) {
+        if (jobcomp_redis_spool_append(batch[i]) == SLURM_SUCCESS) {
+            release_fields(batch[i]);
+        } else {
+            batch[kept++] = batch[i];
+        }
+    }
+    if (kept < len) {
+        slurm_debug2("redis spooled %zu job record(s)", len - kept);
+    }
+    return kept;
+}
+
+/*
+ * Replay one batch of the oldest spooled job records.  They leave the spool
+ * only once redis has answered for every one of them.  Returns the number
+ * of job records that left the spool
+ */
+static size_t writer_replay(redisContext *ctx, redis_fields_t **replay)
+{
+    size_t i, refused = 0, done = 0;
+    size_t len = jobcomp_redis_spool_peek(replay, WRITER_REPLAY_BATCH);
+    if (!len) {
+        return 0;
+    }
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = writer_write_batch(ctx, replay, len, &refused);
+    unsigned long long usec = usec_since(&t0);
+    atomic_fetch_add(&replay_usec, usec);
+    if (rc != WRITE_RETRY) {
+        jobcomp_redis_latency_add(ctx, usec);
+        jobcomp_redis_spool_consume();
+        done = len;
+        atomic_fetch_add(&replayed, len - refused);
+        atomic_fetch_add(&failed, refused);
+        if (!jobcomp_redis_spool_records()) {
+            size_t n = atomic_load(&replayed);
+            unsigned long long total = atomic_load(&replay_usec);
+            slurm_info("redis spool drained, %zu job records replayed "
+                "at %.0f jobs/sec", n, total ? n * 1e6 / total : 0.0);
+        }
+    }
+    for (i = 0; i < len; ++i) {
+        release_fields(replay[i]);
+    }
+    return done;
+}
+
+/*
+ * The writer thread: gather job records into batches and write them to redis
+ * on a private connection.  A batch is flushed when it is full, or when
+ * batch_wait milliseconds have passed since its first record arrived.  While
+ * redis is unreachable, batches go to the spool (and are only held back if
+ * the spool is full), and reconnects are paced by the connection backoff
+ * rather than by job completions.  Spooled records are replayed in large
+ * batches, one per pass, between new batches once redis is back
+ */
+static void *writer_main(__attribute__((unused)) void *arg)
+{
+    jobcomp_redis_conn_t conn = {0};
+    redis_fields_t **batch = xmalloc(batch_sz *
+        sizeof(redis_fields_t *));
+    redis_fields_t **replay = xmalloc(WRITER_REPLAY_BATCH *
+        sizeof(redis_fields_t *));
+    size_t i, len = 0;
+    struct timespec deadline = {0};
+
+    for (;;) {
+        writer_report();
+
+        // Replay the spool whenever redis is reachable
+        size_t replaying = 0;
+        if (!atomic_load(&stopping) && jobcomp_redis_spool_records()) {
+            redisContext *ctx = jobcomp_redis_conn_get(&conn);
+            if (ctx) {
+                replaying = writer_replay(ctx, replay);
+            }
+        }
+
+        // Gather whatever is queued, up to a full batch
+        while ((len < batch_sz) &&
+            (ring_queue_pop(queue, (void **)&batch[len]) == QUEUE_OK)) {
+            if (len++ == 0) {
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_nsec += batch_wait * 1000000L;
+                deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+                deadline.tv_nsec %= 1000000000L;
+            }
+        }
+        if (len == 0) {
+            if (atomic_load(&stopping)) {
+                break;
+            }
+            // Keep replaying while it makes progress, or wait out the
+            // backoff before the next connection attempt.  A pass that
+            // replayed nothing otherwise waits for new jobs like an empty
+            // spool, so a spool that cannot be read never spins the writer
+            if (replaying) {
+                continue;
+            }
+            if (jobcomp_redis_spool_records() &&
+                (!conn.ctx || conn.ctx->err)) {
+                writer_wait(jobcomp_redis_conn_retry_msec(&conn));
+                continue;
+            }
+            while (sem_wait(&wakeup) == -1 && errno == EINTR) {
+            }
+            continue;
+        }
+
+        // Give a partial batch until its deadline to fill up
+        if ((len < batch_sz) && !atomic_load(&stopping) &&
+            !deadline_passed(&deadline)) {
+            writer_wait_until(&deadline);
+            continue;
+        }
+
+        redisContext *ctx = jobcomp_redis_conn_get(&conn);
+        if (!ctx) {
+            len = writer_spool(batch, len);
+            if (atomic_load(&stopping)) {
+                break;
+            }
+            if (len) {
+                writer_wait(jobcomp_redis_conn_retry_msec(&conn));
+            }
+            continue;
+        }
+
+        size_t refused = 0;
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        int rc = writer_write_batch(ctx, batch, len, &refused);
+        unsigned long long usec = usec_since(&t0);
+        atomic_fetch_add(&busy_usec, usec);
+        if (rc == WRITE_RETRY) {
+            continue;
+        }
+        jobcomp_redis_latency_add(ctx, usec);
+        atomic_fetch_add(&written, len - refused);
+        atomic_fetch_add(&failed, refused);
+        atomic_fetch_add(&batches, 1);
+        for (i = 0; i < len; ++i) {
+            release_fields(batch[i]);
+        }
+        len = 0;
+    }
+
+    // Anything left could not be delivered before shutdown: spool it for
+    // the next start, or drop it if the spool cannot take it
+    len = writer_spool(batch, len);
+    for (i = 0; i < len; ++i) {
+        release_fields(batch[i]);
+        atomic_fetch_add(&dropped, 1);
+    }
+    redis_fields_t *fields = NULL;
+    while (ring_queue_pop(queue, (void **)&fields) == QUEUE_OK) {
+        if (jobcomp_redis_spool_append(fields) != SLURM_SUCCESS) {
+            atomic_fetch_add(&dropped, 1);
+        }
+        release_fields(fields);
+    }
+    jobcomp_redis_conn_close(&conn);
+    xfree(replay);
+    xfree(batch);
+    return NULL;
+}
+
+/*
+ * Create the queue and start the writer thread
+ */
+int jobcomp_redis_writer_init(const jobcomp_redis_writer_init_t *init)
+{
+    assert(init != NULL);
+    if (atomic_load(&running)) {
+        return SLURM_SUCCESS;
+    }
+    ring_queue_init_t queue_init = {
+        .queue_sz = init->queue_sz
+    };
+    jobcomp_redis_spool_init_t spool_init = {
+        .path = init->spool_path,
+        .spool_sz = init->spool_sz
+    };
+    if (jobcomp_redis_spool_init(&spool_init) != SLURM_SUCCESS) {
+        slurm_error("redis spool unavailable, job records will be dropped "
+            "while redis is unreachable");
+    }
+    prefix = xstrdup(init->prefix);
+    batch_sz = init->batch_sz ? init->batch_sz : 1;
+    batch_wait = init->batch_wait;
+    queue = create_ring_queue(&queue_init);
+    sem_init(&wakeup, 0, 0);
+    atomic_store(&stopping, 0);
+    if (pthread_create(&writer, NULL, writer_main, NULL)) {
+        slurm_error("unable to start redis writer thread");
+        sem_destroy(&wakeup);
+        destroy_ring_queue(&queue);
+        jobcomp_redis_spool_fini();
+        xfree(prefix);
+        return SLURM_ERROR;
+    }
+    atomic_store(&running, 1);
+    slurm_debug("redis writer started, queue size %zu, batch size %zu, "
+        "batch wait %ldms", ring_queue_size(queue), batch_sz, batch_wait);
+    return SLURM_SUCCESS;
+}
+
+/*
+ * Stop the writer thread.  The writer drains the queue first unless redis
+ * is unreachable, in which case the remaining records are spooled (or
+ * dropped if the spool cannot take them)
+ */
+void jobcomp_redis_writer_fini()
+{
+    if (!atomic_load(&running)) {
+        return;
+    }
+    atomic_store(&stopping, 1);
+    sem_post(&wakeup);
+    pthread_join(writer, NULL);
+    atomic_store(&running, 0);
+
+    jobcomp_redis_writer_stats_t stats;
+    jobcomp_redis_writer_stats(&stats);
+    slurm_verbose("redis writer stopped: queued %zu, written %zu, "
+        "failed %zu, dropped %zu, queue peak %zu/%zu", stats.queued,
+        stats.written, stats.failed, stats.dropped, stats.queue_peak,
+        stats.queue_sz);
+    if (stats.busy_usec) {
+        slurm_verbose("redis writer throughput: %zu batches, %.1f jobs/batch, "
+            "%.0f jobs/sec while writing", stats.batches,
+            stats.batches ? (double)(stats.written + stats.failed) /
+                stats.batches : 0.0,
+            (double)(stats.written + stats.failed) * 1e6 / stats.busy_usec);
+    }
+    if (stats.spooled || stats.spool_records) {
+        slurm_verbose("redis writer spool: spooled %zu, replayed %zu "
+            "(%.0f jobs/sec), holding %zu job records in %zu/%zu bytes",
+            stats.spooled, stats.replayed, stats.replay_usec ?
+                (double)stats.replayed * 1e6 / stats.replay_usec : 0.0,
+            stats.spool_records, stats.spool_used, stats.spool_sz);
+    }
+
+    sem_destroy(&wakeup);
+    destroy_ring_queue(&queue);
+    jobcomp_redis_spool_fini();
+    xfree(prefix);
+}
+
+/*
+ * Hand job fields to the writer without blocking.  If the queue is full the
+ * fields are spooled instead.  On SLURM_SUCCESS the writer owns the fields;
+ * on SLURM_ERROR (queue and spool full) the caller keeps them
+ */
+int jobcomp_redis_writer_submit(redis_fields_t *fields)
+{
+    assert(fields != NULL);
+    if (!atomic_load(&running) || atomic_load(&stopping)) {
+        return SLURM_ERROR;
+    }
+    if (ring_queue_push(queue, fields) != QUEUE_OK) {
+        if (jobcomp_redis_spool_append(fields) == SLURM_SUCCESS) {
+            release_fields(fields);
+            sem_post(&wakeup);
+            return SLURM_SUCCESS;
+        }
+        // Dropped job records are lost for good, so say so at the default
+        // log level, though not for every one of a burst
+        size_t n = atomic_fetch_add(&dropped, 1) + 1;
+        long long now = time(NULL);
+        long long last = atomic_load(&drop_logged);
+        if ((now - last >= WRITER_REPORT_SECS) &&
+            atomic_compare_exchange_strong(&drop_logged, &last, now)) {
+            slurm_error("redis writer queue and spool full, dropping job %s "
+                "(%zu dropped so far)", fields->value[kJobID], n);
+        } else {
+            slurm_debug("redis writer queue full, dropping job %s "
+                "(%zu dropped)", fields->value[kJobID], n);
+        }
+        return SLURM_ERROR;
+    }
+    atomic_fetch_add(&queued, 1);
+    size_t depth = ring_queue_depth(queue);
+    size_t peak = atomic_load(&queue_peak);
+    while ((depth > peak) &&
+        !atomic_compare_exchange_weak(&queue_peak, &peak, depth)) {
+    }
+    sem_post(&wakeup);
+    return SLURM_SUCCESS;
+}
+
+/*
+ * Fetch a snapshot of the writer counters
+ */
+void jobcomp_redis_writer_stats(jobcomp_redis_writer_stats_t *stats)
+{
+    assert(stats != NULL);
+    stats->queue_depth = queue ? ring_queue_depth(queue) : 0;
+    stats->queue_peak = atomic_load(&queue_peak);
+    stats->queue_sz = queue ? ring_queue_size(queue) : 0;
+    stats->queued = atomic_load(&queued);
+    stats->written = atomic_load(&written);
+    stats->dropped = atomic_load(&dropped);
+    stats->failed = atomic_load(&failed);
+    stats->batches = atomic_load(&batches);
+    stats->busy_usec = atomic_load(&busy_usec);
+    stats->replayed = atomic_load(&replayed);
+    stats->replay_usec = atomic_load(&replay_usec);
+
+    jobcomp_redis_spool_stats_t spool_stats;
+    jobcomp_redis_spool_stats(&spool_stats);
+    stats->spooled = spool_stats.appended;
+    stats->spool_records = spool_stats.records;
+    stats->spool_used = spool_stats.used;
+    stats->spool_sz = spool_stats.size;
+}
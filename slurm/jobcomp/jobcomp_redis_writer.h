@@ -0,0 +1,101 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef JOBCOMP_REDIS_WRITER_H
+#define JOBCOMP_REDIS_WRITER_H
+
+#include <stddef.h>
+
+#include "jobcomp_redis_auto.h"
+
+/*
+ * A background writer which sends formatted job records to redis from its
+ * own thread and connection, so that slurmctld threads never wait on redis
+ */
+
+// Writer initialization
+typedef struct jobcomp_redis_writer_init {
+    // Prefix of the redis job keys
+    const char *prefix;
+    // Number of job records that may be queued for the writer
+    size_t queue_sz;
+    // Most job records committed to redis in one round trip
+    size_t batch_sz;
+    // Milliseconds a partial batch may wait for more job records
+    long batch_wait;
+    // Path of the spool file, NULL for none
+    const char *spool_path;
+    // Size of the spool file in bytes, 0 for none
+    size_t spool_sz;
+} jobcomp_redis_writer_init_t;
+
+// Writer counters
+typedef struct jobcomp_redis_writer_stats {
+    // Job records currently queued
+    size_t queue_depth;
+    // Most job records ever queued at once
+    size_t queue_peak;
+    // Capacity of the queue
+    size_t queue_sz;
+    // Job records accepted onto the queue
+    size_t queued;
+    // Job records written to redis
+    size_t written;
+    // Job records dropped because the queue was full or at shutdown
+    size_t dropped;
+    // Job records redis refused
+    size_t failed;
+    // Batches (round trips) sent to redis
+    size_t batches;
+    // Microseconds spent writing batches
+    unsigned long long busy_usec;
+    // Job records spooled because redis was unreachable or the queue full
+    size_t spooled;
+    // Job records currently spooled
+    size_t spool_records;
+    // Bytes of the spool in use
+    size_t spool_used;
+    // Size of the spool
+    size_t spool_sz;
+    // Spooled job records replayed to redis
+    size_t replayed;
+    // Microseconds spent replaying spooled job records
+    unsigned long long replay_usec;
+} jobcomp_redis_writer_stats_t;
+
+// Start the writer thread
+int jobcomp_redis_writer_init(const jobcomp_redis_writer_init_t *init);
+
+// Stop the writer thread, draining the queue if redis is reachable and
+// spooling what is left otherwise
+void jobcomp_redis_writer_fini();
+
+// Queue job fields for writing; the writer takes ownership on success
+int jobcomp_redis_writer_submit(redis_fields_t *fields);
+
+// Fetch a snapshot of the writer counters
+void jobcomp_redis_writer_stats(jobcomp_redis_writer_stats_t *stats);
+
+#endif /* JOBCOMP_REDIS_WRITER_H */
@@ -0,0 +1,246 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define REDISMODULE_MAIN
+#include "jobcomp/jobcomp_bitmap.h"
+#include "test_check.h"
+
+// Job ids checked one by one: the first four containers
+#define TEST_IDS (4u << 16)
+
+/*
+ * Membership of the test bitmaps, by job id
+ */
+static int in_a(uint32_t id)
+{
+    if (id < (2u << 16)) {
+        return (id % 3) == 0;
+    }
+    if (id < (3u << 16)) {
+        return (id % 100) == 0;
+    }
+    return id == UINT32_MAX;
+}
+
+static int in_b(uint32_t id)
+{
+    if (id < (1u << 16)) {
+        return id == 65535;
+    }
+    if (id < (2u << 16)) {
+        return (id % 5) == 0;
+    }
+    if (id < (3u << 16)) {
+        return (id % 7) == 0;
+    }
+    if (id < (4u << 16)) {
+        return (id % 1000) == 0;
+    }
+    return id == UINT32_MAX;
+}
+
+/*
+ * Create a bitmap of the ids of a membership function
+ */
+static job_bitmap_t create_test_bitmap(int (*in)(uint32_t))
+{
+    job_bitmap_t bitmap = create_job_bitmap();
+    uint32_t id;
+    for (id = 0; id < TEST_IDS; ++id) {
+        if (in(id)) {
+            CHECK(job_bitmap_add(bitmap, id) == 1);
+        }
+    }
+    if (in(UINT32_MAX)) {
+        CHECK(job_bitmap_add(bitmap, UINT32_MAX) == 1);
+    }
+    return bitmap;
+}
+
+/*
+ * Check a bitmap holds the ids of a membership function, and only those,
+ * both by lookup and by iteration
+ */
+static void check_bitmap(const job_bitmap_t bitmap, int (*in)(uint32_t))
+{
+    uint64_t card = 0;
+    uint32_t id, next;
+    job_bitmap_iter_t iter;
+
+    job_bitmap_iter_init(&iter);
+    for (id = 0; id < TEST_IDS; ++id) {
+        CHECK(job_bitmap_contains(bitmap, id) == in(id));
+        if (in(id)) {
+            CHECK(job_bitmap_next(bitmap, &iter, &next) == 1);
+            CHECK(next == id);
+            ++card;
+        }
+    }
+    CHECK(job_bitmap_contains(bitmap, UINT32_MAX) == in(UINT32_MAX));
+    if (in(UINT32_MAX)) {
+        CHECK(job_bitmap_next(bitmap, &iter, &next) == 1);
+        CHECK(next == UINT32_MAX);
+        ++card;
+    }
+    CHECK(job_bitmap_next(bitmap, &iter, &next) == 0);
+    CHECK(job_bitmap_cardinality(bitmap) == card);
+}
+
+static int in_a_or_b(uint32_t id)
+{
+    return in_a(id) || in_b(id);
+}
+
+static int in_a_and_b(uint32_t id)
+{
+    return in_a(id) && in_b(id);
+}
+
+static int in_a_not_b(uint32_t id)
+{
+    return in_a(id) && !in_b(id);
+}
+
+static int in_range(uint32_t id)
+{
+    return in_a(id) && (id >= 65000) && (id <= 140000);
+}
+
+/*
+ * Bitmaps combine container by container, whatever the mix of array and
+ * bitset containers on either side
+ */
+static void test_combine(void)
+{
+    job_bitmap_t a = create_test_bitmap(in_a);
+    job_bitmap_t b = create_test_bitmap(in_b);
+    check_bitmap(a, in_a);
+    check_bitmap(b, in_b);
+
+    job_bitmap_t c = job_bitmap_or(a, b);
+    check_bitmap(c, in_a_or_b);
+    destroy_job_bitmap(&c);
+    c = job_bitmap_and(a, b);
+    check_bitmap(c, in_a_and_b);
+    destroy_job_bitmap(&c);
+    c = job_bitmap_andnot(a, b);
+    check_bitmap(c, in_a_not_b);
+    destroy_job_bitmap(&c);
+    c = job_bitmap_range(a, 65000, 140000);
+    check_bitmap(c, in_range);
+    destroy_job_bitmap(&c);
+
+    uint32_t min;
+    CHECK(job_bitmap_min(b, &min) == 1);
+    CHECK(min == 65535);
+
+    destroy_job_bitmap(&a);
+    destroy_job_bitmap(&b);
+}
+
+/*
+ * Ids on either side of a container boundary land in their own containers
+ */
+static void test_boundary(void)
+{
+    job_bitmap_t bitmap = create_job_bitmap();
+    uint32_t min;
+
+    CHECK(job_bitmap_min(bitmap, &min) == 0);
+    CHECK(job_bitmap_add(bitmap, 65536) == 1);
+    CHECK(job_bitmap_add(bitmap, 65535) == 1);
+    CHECK(job_bitmap_add(bitmap, 65536) == 0);
+    CHECK(job_bitmap_contains(bitmap, 65535));
+    CHECK(job_bitmap_contains(bitmap, 65536));
+    CHECK(!job_bitmap_contains(bitmap, 0));
+    CHECK(!job_bitmap_contains(bitmap, 65537));
+    CHECK(!job_bitmap_contains(bitmap, 131072));
+    CHECK(job_bitmap_cardinality(bitmap) == 2);
+    CHECK(job_bitmap_min(bitmap, &min) == 1);
+    CHECK(min == 65535);
+    destroy_job_bitmap(&bitmap);
+}
+
+/*
+ * An array container turns into a bitset past JOB_BITMAP_ARRAY_MAX ids
+ * without losing any
+ */
+static void test_convert(void)
+{
+    job_bitmap_t bitmap = create_job_bitmap();
+    uint32_t i, base = 5u << 16;
+
+    for (i = 0; i <= JOB_BITMAP_ARRAY_MAX; ++i) {
+        CHECK(job_bitmap_add(bitmap, base + 2 * i) == 1);
+    }
+    CHECK(job_bitmap_cardinality(bitmap) == JOB_BITMAP_ARRAY_MAX + 1);
+    for (i = 0; i <= 2 * JOB_BITMAP_ARRAY_MAX + 1; ++i) {
+        CHECK(job_bitmap_contains(bitmap, base + i) == !(i & 1));
+    }
+    destroy_job_bitmap(&bitmap);
+}
+
+/*
+ * A bitmap reads back the same from its serialization
+ */
+static void test_serialize(void)
+{
+    job_bitmap_t a = create_test_bitmap(in_a);
+    size_t len = job_bitmap_serialized_size(a);
+    char *buf = malloc(len);
+    CHECK(buf != NULL);
+    job_bitmap_serialize(a, buf);
+
+    job_bitmap_t b = job_bitmap_deserialize(buf, len);
+    CHECK(b != NULL);
+    check_bitmap(b, in_a);
+    CHECK(job_bitmap_deserialize(buf, len - 1) == NULL);
+
+    free(buf);
+    destroy_job_bitmap(&a);
+    destroy_job_bitmap(&b);
+}
+
+int main()
+{
+    // The bitmap allocates through the module api, set up by redis
+    RedisModule_Alloc = malloc;
+    RedisModule_Calloc = calloc;
+    RedisModule_Realloc = realloc;
+    RedisModule_Free = free;
+
+    test_boundary();
+    test_convert();
+    test_combine();
+    test_serialize();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <src/common/xmalloc.h> /* xmalloc, ... */
+
+#include "jobcomp/jobcomp_redis_spool.h"
+#include "test_check.h"
+
+// Offset of the first job record in the spool file
+#define SPOOL_DATA 64
+
+static char path[] = "/tmp/jobcomp_redis_spool_XXXXXX";
+
+/*
+ * Open the spool file
+ */
+static void spool_open(size_t spool_sz)
+{
+    jobcomp_redis_spool_init_t init = {
+        .path = path,
+        .spool_sz = spool_sz
+    };
+    CHECK(jobcomp_redis_spool_init(&init) == SLURM_SUCCESS);
+}
+
+/*
+ * Spool a job record holding only its job id
+ */
+static void spool_job(unsigned int jobid)
+{
+    redis_fields_t fields = {0};
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u", jobid);
+    fields.value[kJobID] = buf;
+    CHECK(jobcomp_redis_spool_append(&fields) == SLURM_SUCCESS);
+}
+
+/*
+ * Size of the record spooled by spool_job: the payload length, the field
+ * bitmap, then the length and bytes of the job id
+ */
+static size_t spool_job_size(unsigned int jobid)
+{
+    char buf[16];
+    return 3 * sizeof(uint32_t) + snprintf(buf, sizeof(buf), "%u", jobid);
+}
+
+/*
+ * Replay up to max job records, checking that their job ids run from first,
+ * and return the number replayed
+ */
+static size_t replay_jobs(unsigned int first, size_t max)
+{
+    redis_fields_t *batch[64];
+    size_t i, n = jobcomp_redis_spool_peek(batch, max);
+    for (i = 0; i < n; ++i) {
+        CHECK(batch[i]->value[kJobID] != NULL);
+        CHECK(strtoul(batch[i]->value[kJobID], NULL, 10) == first + i);
+        destroy_redis_fields(batch[i]);
+        xfree(batch[i]);
+    }
+    jobcomp_redis_spool_consume();
+    return n;
+}
+
+/*
+ * Records survive a reopen, and the space of replayed records is reclaimed
+ * once the spool reaches the end of the file
+ */
+static void test_reopen(void)
+{
+    unsigned int jobid = 1, next = 1;
+
+    spool_open(1024);
+    while (jobcomp_redis_spool_records() < 60) {
+        spool_job(jobid++);
+    }
+    jobcomp_redis_spool_fini();
+
+    spool_open(1024);
+    CHECK(jobcomp_redis_spool_records() == 60);
+    next += replay_jobs(next, 55);
+    CHECK(jobcomp_redis_spool_records() == 5);
+    // The file only has room for the new records past the replayed ones
+    while (jobcomp_redis_spool_records() < 25) {
+        spool_job(jobid++);
+    }
+    jobcomp_redis_spool_fini();
+
+    spool_open(1024);
+    CHECK(jobcomp_redis_spool_records() == 25);
+    while (next < jobid) {
+        size_t n = replay_jobs(next, 64);
+        CHECK(n > 0);
+        next += n;
+    }
+    CHECK(jobcomp_redis_spool_records() == 0);
+    jobcomp_redis_spool_fini();
+}
+
+/*
+ * A damaged record drops it and the records after it, keeping those before
+ * it, and the spool takes new records after the reopen
+ */
+static void test_damaged(void)
+{
+    spool_open(1024);
+    spool_job(1);
+    spool_job(2);
+    spool_job(3);
+    jobcomp_redis_spool_fini();
+
+    // Give the second record a payload running past the end of the spool
+    int fd = open(path, O_RDWR);
+    CHECK(fd >= 0);
+    uint32_t payload = UINT32_MAX;
+    CHECK(pwrite(fd, &payload, sizeof(payload),
+        SPOOL_DATA + spool_job_size(1)) == sizeof(payload));
+    close(fd);
+
+    spool_open(1024);
+    CHECK(replay_jobs(1, 64) == 1);
+    CHECK(jobcomp_redis_spool_records() == 0);
+    spool_job(4);
+    jobcomp_redis_spool_fini();
+
+    spool_open(1024);
+    CHECK(jobcomp_redis_spool_records() == 1);
+    CHECK(replay_jobs(4, 64) == 1);
+    jobcomp_redis_spool_fini();
+}
+
+/*
+ * A spool file with a damaged header is discarded
+ */
+static void test_damaged_header(void)
+{
+    spool_open(1024);
+    spool_job(1);
+    jobcomp_redis_spool_fini();
+
+    int fd = open(path, O_RDWR);
+    CHECK(fd >= 0);
+    CHECK(pwrite(fd, "XXXXXXXX", 8, 0) == 8);
+    close(fd);
+
+    spool_open(1024);
+    CHECK(jobcomp_redis_spool_records() == 0);
+    spool_job(2);
+    CHECK(replay_jobs(2, 64) == 1);
+    jobcomp_redis_spool_fini();
+}
+
+int main()
+{
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+
+    test_reopen();
+    unlink(path);
+    test_damaged();
+    unlink(path);
+    test_damaged_header();
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,132 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Philip Kovacs
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "common/ring_queue.h"
+#include "test_check.h"
+
+// Items pushed by each producer of the threaded test
+#define TEST_ITEMS 20000
+#define TEST_PRODUCERS 4
+
+/*
+ * A queue takes as many items as it has slots, hands them back in order and
+ * keeps doing so as the positions wrap around the ring
+ */
+static void test_wraparound(void)
+{
+    ring_queue_init_t init = {
+        .queue_sz = 5
+    };
+    ring_queue_t queue = create_ring_queue(&init);
+    size_t sz = ring_queue_size(queue);
+    uintptr_t next = 1, popped = 1;
+    void *item;
+    int lap;
+
+    // Rounded up to a power of two
+    CHECK(sz == 8);
+    CHECK(ring_queue_pop(queue, &item) == QUEUE_EMPTY);
+    for (lap = 0; lap < 5; ++lap) {
+        while (ring_queue_depth(queue) < sz) {
+            CHECK(ring_queue_push(queue, (void *)next++) == QUEUE_OK);
+        }
+        CHECK(ring_queue_push(queue, (void *)next) == QUEUE_FULL);
+        // Drain part of the queue so that the next lap starts mid-ring
+        while (ring_queue_depth(queue) > (size_t)lap % sz) {
+            CHECK(ring_queue_pop(queue, &item) == QUEUE_OK);
+            CHECK((uintptr_t)item == popped++);
+        }
+    }
+    while (ring_queue_pop(queue, &item) == QUEUE_OK) {
+        CHECK((uintptr_t)item == popped++);
+    }
+    CHECK(popped == next);
+    CHECK(ring_queue_depth(queue) == 0);
+    CHECK(ring_queue_pop(queue, &item) == QUEUE_EMPTY);
+    destroy_ring_queue(&queue);
+}
+
+static ring_queue_t shared;
+
+static void *produce(void *arg)
+{
+    uintptr_t i;
+    (void)arg;
+    for (i = 1; i <= TEST_ITEMS; ++i) {
+        while (ring_queue_push(shared, (void *)i) != QUEUE_OK) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Items pushed by concurrent producers are each popped exactly once
+ */
+static void test_producers(void)
+{
+    ring_queue_init_t init = {
+        .queue_sz = 64
+    };
+    pthread_t producers[TEST_PRODUCERS];
+    uint64_t count = 0, sum = 0;
+    void *item;
+    int i;
+
+    shared = create_ring_queue(&init);
+    for (i = 0; i < TEST_PRODUCERS; ++i) {
+        CHECK(pthread_create(&producers[i], NULL, produce, NULL) == 0);
+    }
+    while (count < (uint64_t)TEST_PRODUCERS * TEST_ITEMS) {
+        if (ring_queue_pop(shared, &item) == QUEUE_OK) {
+            sum += (uintptr_t)item;
+            ++count;
+        } else {
+            sched_yield();
+        }
+    }
+    for (i = 0; i < TEST_PRODUCERS; ++i) {
+        pthread_join(producers[i], NULL);
+    }
+    CHECK(sum == (uint64_t)TEST_PRODUCERS * TEST_ITEMS * (TEST_ITEMS + 1) / 2);
+    CHECK(ring_queue_pop(shared, &item) == QUEUE_EMPTY);
+    destroy_ring_queue(&shared);
+}
+
+int main()
+{
+    test_wraparound();
+    test_producers();
+    return EXIT_SUCCESS;
+}